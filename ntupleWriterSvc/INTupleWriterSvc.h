@@ -8,9 +8,10 @@
 
 #include "GaudiKernel/IInterface.h"
 #include <string>
+#include <vector>
 
 // Declaration of the interface ID ( interface id, major version, minor version) 
-static const InterfaceID IID_INTupleWriterSvc("INTupleWriterSvc",  9 ,0); 
+static const InterfaceID IID_INTupleWriterSvc("INTupleWriterSvc",  10 ,1); 
 
 /*! @class INTupleWriterSvc
  @brief Proper Gaudi abstract interface class for the ntupleWriterSvc 
@@ -127,6 +128,100 @@ public:
     virtual long long index() = 0 ;
     virtual long long getNumberOfEvents() = 0;
 
+    // methods added after version 9.0 follow the original ones, in the order they were added
+
+    /** @brief Fill a batch of rows of an existing tuple from per-column arrays
+    @param tupleName - name of a tree already set up with addItem
+    @param nRows - number of rows in the batch
+    @param itemNames - item names, as given to addItem; every item of the tree must be present
+    @param columns - one contiguous array per item name, holding nRows values (nRows*n for an item[n])
+    @return number of rows written, or -1 if nRows is negative or the columns do not match the tree
+    The tree's filter (RootTupleSvc.TreeFilters), the non-finite check and RejectIfBad apply to
+    each row, as for rows stored at the end of an event.
+    Character string items are not supported.
+    */
+    virtual long long fillRows(const std::string& tupleName, long long nRows,
+                               const std::vector<std::string>& itemNames,
+                               const std::vector<const void*>& columns)=0;
+
+    /** @brief Output format of a tuple
+    @return "TTree", or the name of another format such as "RNTuple", or empty if the tuple is not known
+    For a format other than TTree, getOutputTreePtr sets the pointer to zero.
+    */
+    virtual std::string getOutputTreeType(const std::string& tupleName="MeritTuple") = 0;
+
+    /** @brief Register a count kept by a client, such as the Count algorithm
+    @param counterName - unique name of the counter
+    @param counter - pointer to the count, which must stay valid until finalize
+    The value is saved with each checkpoint, and restored when a job resumes from one.
+    */
+    virtual void addCounter(const std::string& counterName, int* counter) = 0;
+
+    /** @name Concurrent mode
+    With RootTupleSvc.ConcurrentSlots > 0, events are processed in that many slots, possibly
+    at the same time on different threads, instead of one at a time between the BeginEvent and
+    EndEvent incidents. Each slot has its own copy of the tuple variables: a client registers
+    them once per slot with addItem, after selecting the slot on its thread. Slot 0 must be
+    registered first: it defines the items of each tuple. Rows stored by a slot are copied
+    at endSlotEvent and written by the service on its own thread.
+    */
+    //@{
+    /// make the calling thread work for an event slot: addItem, getItem and storeRowFlag apply to it
+    virtual void selectSlot(unsigned int slot) = 0;
+    /** @brief start an event in a slot: selects the slot, reads entry eventIndex of the input
+    tuples into the slot's items, and clears its store flags.
+    @param eventIndex - event number, unique in the job; with ordered output
+    (RootTupleSvc.OrderedOutput) the numbers must follow each other without gaps
+    */
+    virtual StatusCode beginSlotEvent(unsigned int slot, long long eventIndex) = 0;
+    /// end the event of a slot: copies the rows flagged for storing and submits them to the writer
+    virtual StatusCode endSlotEvent(unsigned int slot) = 0;
+    /// wait until every row submitted by endSlotEvent is in its tuple
+    virtual void drainSlots() = 0;
+    //@}
+
+    /** @brief Read the input entries of a whole list of keys, as findEntry with load for each key
+    @param tupleName - an input tuple with a key: see declareKey
+    @param keyList - for each key, one pointer per key item, as the keyValues of findEntry
+    @return the number of entries to read; keys that are not in the input are skipped
+    The entries of all the keys, with those of earlier calls not read yet, are read in entry order,
+    each once, whatever the order of the list, so that each input file is read once, forwards.
+    The run stops after the last of them.
+    */
+    virtual long long findEntries(const std::string& tupleName,
+                                  const std::vector<std::vector<const void*> >& keyList) = 0;
+
+    /** @brief Resolve an item once for an ItemRef (see ItemRef.h), rather than with getItem
+    @param ref - pointer kept by the ItemRef: set to the item now, and again whenever the input
+                 chain of the tuple moves to another file
+    @return the ROOT type name of the item, as getItem
+    */
+    virtual std::string bindItemRef(const std::string& tupleName, const std::string& itemName,
+                                    void** ref) = 0;
+    /// forget a reference bound with bindItemRef
+    virtual void unbindItemRef(void** ref) = 0;
+
+    /** @brief Index the rows of a memory resident or input tuple by the values of some of its items
+    @param keyItems - names of items already added, as given to addItem
+    For a memory resident tuple, the index is kept up to date as rows are stored; for rows with
+    the same key, findEntry returns the last one. For an input tuple, the key is one or two integer
+    items, as RootTupleSvc.InputKey, and the whole input chain is indexed at once: entries sharing
+    a key are reported, and all kept.
+    */
+    virtual StatusCode declareKey(const std::string& tupleName,
+                                  const std::vector<std::string>& keyItems) = 0;
+    /** @brief Find the row of a tuple indexed with declareKey
+    @param keyValues - one pointer per key item, in the order of declareKey, to a value of the
+                       item's type (all the elements for an array item, a string for a char item)
+    @param load - if true, read that row, and only that one, into the tuple variables. For an
+                  input tuple, the following events read instead the entries with this key, with
+                  those of earlier calls not read yet, in entry order; the run stops after the last
+    @return the entry number of the row (in the whole input chain, the first with the key, for
+            an input tuple), or -1 if there is none with this key
+    */
+    virtual long long findEntry(const std::string& tupleName,
+                                const std::vector<const void*>& keyValues, bool load=true) = 0;
+
     /// Retrieve interface ID
     static const InterfaceID& interfaceID() { return IID_INTupleWriterSvc; }
 
@@ -0,0 +1,84 @@
+/** @file ItemRef.h
+    @brief declare ItemRef, a typed reference to a tuple item, resolved once
+
+    $Header$
+*/
+#ifndef _H_ntupleWriterSvc_ItemRef_
+#define _H_ntupleWriterSvc_ItemRef_
+
+#include "ntupleWriterSvc/INTupleWriterSvc.h"
+
+#include <stdexcept>
+#include <string>
+
+/** @class ItemRefType
+    @brief ROOT type name of each C++ type an ItemRef can refer to.
+    Only the specializations are defined: an ItemRef of any other type does not compile.
+*/
+template <class T> struct ItemRefType;
+template <> struct ItemRefType<float>              { static const char* name() { return "Float_t"; } };
+template <> struct ItemRefType<double>             { static const char* name() { return "Double_t"; } };
+template <> struct ItemRefType<int>                { static const char* name() { return "Int_t"; } };
+template <> struct ItemRefType<unsigned int>       { static const char* name() { return "UInt_t"; } };
+template <> struct ItemRefType<unsigned long long> { static const char* name() { return "ULong64_t"; } };
+template <> struct ItemRefType<char>               { static const char* name() { return "Char_t"; } };
+
+/** @class ItemRef
+    @brief Typed access to an item of a tuple, for instance one read from the input files
+
+    Replaces getItem and the check of the type string it returns:
+    @verbatim
+    ItemRef<float> energy;
+    ...
+    // initialize: throws std::invalid_argument if the item is missing or not a Float_t
+    energy.bind(m_rootTupleSvc, "MeritTuple", "EvtEnergyCorr");
+    ...
+    // each event
+    if (*energy > 100) ...
+    @endverbatim
+    The service keeps the pointer up to date: when the input chain moves to a new file,
+    it rebinds every ItemRef of that tuple, so reading a value is one dereference.
+    An ItemRef cannot be copied, since the service knows it by its address.
+*/
+template <class T>
+class ItemRef {
+public:
+    ItemRef() : m_ptr(0), m_svc(0) {}
+    ItemRef(INTupleWriterSvc* svc, const std::string& tupleName, const std::string& itemName)
+        : m_ptr(0), m_svc(0) { bind(svc, tupleName, itemName); }
+    ~ItemRef() { release(); }
+
+    /// resolve the item, and check its type
+    void bind(INTupleWriterSvc* svc, const std::string& tupleName, const std::string& itemName) {
+        release();
+        std::string type = svc->bindItemRef(tupleName, itemName, &m_ptr);
+        m_svc = svc;
+        if (type != ItemRefType<T>::name()) {
+            release();
+            throw std::invalid_argument("ItemRef: item "+itemName+" of tuple "+tupleName
+                                        +" is a "+type+", not a "+ItemRefType<T>::name());
+        }
+    }
+
+    /// give up the item: the service no longer updates this reference
+    void release() {
+        if (m_svc != 0) m_svc->unbindItemRef(&m_ptr);
+        m_svc = 0;
+        m_ptr = 0;
+    }
+
+    bool bound() const { return m_ptr != 0; }
+    const T& operator*() const { return *static_cast<const T*>(m_ptr); }
+    /// element of an array item
+    const T& operator[](int i) const { return static_cast<const T*>(m_ptr)[i]; }
+    const T* get() const { return static_cast<const T*>(m_ptr); }
+
+private:
+    ItemRef(const ItemRef&);
+    ItemRef& operator=(const ItemRef&);
+
+    void* m_ptr; ///< set by the service
+    INTupleWriterSvc* m_svc;
+};
+
+#endif
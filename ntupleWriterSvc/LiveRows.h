@@ -0,0 +1,97 @@
+/** @file LiveRows.h
+    @brief layout of the shared memory segments in which RootTupleSvc publishes its latest rows
+
+    $Header$
+*/
+#ifndef _H_ntupleWriterSvc_LiveRows_
+#define _H_ntupleWriterSvc_LiveRows_
+
+// POSIX shared memory: LiveTrees are not available on Windows
+#ifndef WIN32
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+
+/** @namespace LiveRows
+    @brief The segment written for a tree named in RootTupleSvc.LiveTrees, for monitors to read
+
+    A segment, opened with shm_open under the name that RootTupleSvc logs, holds in turn
+    - a Header,
+    - Header::columns Column descriptions, in branch order,
+    - Header::capacity slots, each a 64 bit sequence number followed by Header::rowBytes of values.
+
+    Row n (counted from 0) goes to slot n % capacity. The writer makes the sequence of the slot
+    odd while it copies the row, then sets it to 2n+2; Header::written is then n+1. A reader
+    copies a row and checks that the sequence was 2n+2 both before and after, as readRow does,
+    so it never waits for the writer nor slows it down.
+    Values are in the byte order of the writer. A string item takes stringBytes, zero terminated.
+    @verbatim
+    int fd = shm_open(name, O_RDONLY, 0);
+    ... mmap the size of the file ...
+    const LiveRows::Header* h = static_cast<const LiveRows::Header*>(base);
+    std::uint64_t n = h->written.load(std::memory_order_acquire);
+    std::vector<char> row(h->rowBytes);
+    if (n > 0 && LiveRows::readRow(base, n-1, &row[0])) ... the latest row ...
+    @endverbatim
+*/
+namespace LiveRows {
+    const std::uint32_t magic = 0x4c495645; // "LIVE"
+    const std::uint32_t version = 1;
+    const unsigned int nameBytes = 64;
+    const unsigned int stringBytes = 64;
+
+    struct Header {
+        std::uint32_t magic;
+        std::uint32_t version;
+        std::uint32_t columns;
+        std::uint32_t rowBytes;
+        std::uint64_t capacity;               ///< number of slots
+        std::uint64_t pid;                    ///< of the writer
+        char tree[nameBytes];
+        std::atomic<std::uint64_t> written;   ///< rows published
+        std::atomic<std::uint32_t> closed;    ///< 1 once the writer is done
+        std::uint32_t pad;
+    };
+
+    struct Column {
+        char name[nameBytes];
+        char type;              ///< ROOT leaflist type code: 'D', 'F', 'I', 'i', 'l' or 'C'
+        char pad[3];
+        std::uint32_t size;     ///< bytes per element
+        std::uint32_t length;   ///< number of elements
+        std::uint32_t offset;   ///< of the values in a row
+    };
+
+    /// bytes of a slot, the sequence included, kept a multiple of 8
+    inline std::uint64_t slotBytes(std::uint32_t rowBytes) { return 8 + (rowBytes + 7)/8*8; }
+    inline std::uint64_t columnsOffset() { return sizeof(Header); }
+    inline std::uint64_t slotsOffset(std::uint32_t columns) {
+        return (sizeof(Header) + columns*sizeof(Column) + 7)/8*8;
+    }
+    inline std::uint64_t segmentBytes(std::uint32_t columns, std::uint32_t rowBytes, std::uint64_t capacity) {
+        return slotsOffset(columns) + capacity*slotBytes(rowBytes);
+    }
+    inline const Column* columnsOf(const void* base) {
+        return reinterpret_cast<const Column*>(static_cast<const char*>(base) + columnsOffset());
+    }
+
+    /** @brief copy row n to out, rowBytes long
+        @return false if the slot no longer holds it (it was overwritten) or is being written
+    */
+    inline bool readRow(const void* base, std::uint64_t n, char* out) {
+        const Header* h = static_cast<const Header*>(base);
+        const char* slot = static_cast<const char*>(base) + slotsOffset(h->columns)
+            + (n % h->capacity)*slotBytes(h->rowBytes);
+        const std::atomic<std::uint64_t>* sequence = reinterpret_cast<const std::atomic<std::uint64_t>*>(slot);
+        std::uint64_t expected = 2*n + 2;
+        if (sequence->load(std::memory_order_acquire) != expected) return false;
+        std::memcpy(out, slot + 8, h->rowBytes);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return sequence->load(std::memory_order_relaxed) == expected;
+    }
+}
+
+#endif // WIN32
+
+#endif
@@ -0,0 +1,123 @@
+/** @file TupleCapture.h
+    @brief format of the capture files written by RootTupleSvc.CaptureFile, and their reader
+
+    $Header$
+*/
+#ifndef _H_ntupleWriterSvc_TupleCapture_
+#define _H_ntupleWriterSvc_TupleCapture_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+/** @namespace TupleCapture
+    @brief What a job asked of RootTupleSvc, to replay it without the job
+
+    A capture file is the uint32 magic and version, then records, each a uint8 kind and:
+    - Item: the addItem calls, as they were made: string tree, string item, string type
+      ("/D", "/F", "/I", "/i", "/l" or "/C"), string file, uint8 write.
+      The tree and file names are those resolved by the service, never empty.
+    - Event: the rows stored at an event: uint32 number of trees, then per tree uint32 index
+      (trees are numbered in the order of their first Item), uint32 bytes and the row: the values
+      of the items of the tree in the order they were added, a string taking its length and a zero.
+    - Row: a row stored during an event by saveRow, before the Event record of that event:
+      uint32 tree index, uint32 bytes and the row, as in an Event.
+    Items copied from the input tree, which the job did not add, are recorded as Items of the tree
+    when its first row is stored, in the file of its first Item.
+    A string is a uint32 length and its bytes. Values are in the byte order of the job.
+*/
+namespace TupleCapture {
+    const std::uint32_t magic = 0x52544350; // "RTCP"
+    const std::uint32_t version = 2;
+
+    enum RecordKind { Item = 1, Event = 2, Row = 3 };
+
+    /// how the values of an item are laid out in a row
+    struct Column {
+        Column() : type(0), size(0), length(1) {}
+        char type;             ///< the letter of the type string
+        unsigned int size;     ///< bytes per element
+        unsigned int length;   ///< elements: the product of the dimensions in the item name
+    };
+
+    /// the layout of an item, from its name ("a[2][3]") and type string
+    inline Column column(const std::string& item, const std::string& type) {
+        Column c;
+        c.type = type.size() == 2 ? type[1] : 0;
+        switch (c.type) {
+            case 'D': case 'l': c.size = 8; break;
+            case 'F': case 'I': case 'i': c.size = 4; break;
+            case 'C': c.size = 1; break;
+            default: c.type = 0;
+        }
+        for (std::string::size_type open = item.find('['); open != std::string::npos; open = item.find('[', open+1))
+            c.length *= std::max(1, atoi(item.c_str() + open + 1));
+        return c;
+    }
+
+    /** @class Reader
+        @brief Reads the records of a capture file in turn
+    */
+    class Reader {
+    public:
+        Reader() : m_file(0) {}
+        ~Reader() { if (m_file) fclose(m_file); }
+
+        /// false if it cannot be opened or is not a capture file of this version or an earlier one
+        bool open(const std::string& fileName) {
+            m_file = fopen(fileName.c_str(), "rb");
+            std::uint32_t head[2] = {0, 0};
+            return m_file != 0 && fread(head, sizeof(head), 1, m_file) == 1
+                && head[0] == magic && head[1] >= 1 && head[1] <= version;
+        }
+
+        /** @brief the next record
+            @return Item, Event or Row; 0 at the end of the file, or if it is cut short
+        */
+        int next() {
+            unsigned char kind = 0;
+            if (fread(&kind, 1, 1, m_file) != 1) return 0;
+            if (kind == Item) {
+                unsigned char write = 0;
+                bool ok = getString(tree) && getString(item) && getString(type) && getString(file)
+                    && fread(&write, 1, 1, m_file) == 1;
+                this->write = write != 0;
+                return ok ? Item : 0;
+            }
+            if (kind != Event && kind != Row) return 0;
+            std::uint32_t n = 1;
+            if (kind == Event && !get(n)) return 0;
+            trees.resize(n);
+            rows.resize(n);
+            for (unsigned int i = 0; i<n; ++i) {
+                std::uint32_t bytes = 0;
+                if (!get(trees[i]) || !get(bytes)) return 0;
+                rows[i].resize(bytes);
+                if (bytes > 0 && fread(&rows[i][0], bytes, 1, m_file) != 1) return 0;
+            }
+            return kind;
+        }
+
+        /// the last Item
+        std::string tree, item, type, file;
+        bool write;
+        /// the last Event: the index of each tree stored, and its row; the last Row: the one of its tree
+        std::vector<std::uint32_t> trees;
+        std::vector<std::string> rows;
+
+    private:
+        template <class T> bool get(T& value) { return fread(&value, sizeof(T), 1, m_file) == 1; }
+        bool getString(std::string& s) {
+            std::uint32_t n = 0;
+            if (!get(n)) return false;
+            s.resize(n);
+            return n == 0 || fread(&s[0], n, 1, m_file) == 1;
+        }
+        FILE* m_file;
+    };
+}
+
+#endif
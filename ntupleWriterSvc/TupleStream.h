@@ -0,0 +1,140 @@
+/** @file TupleStream.h
+    @brief the protocol by which RootTupleSvc streams tuples to a consumer over a Unix socket
+
+    $Header$
+*/
+#ifndef _H_ntupleWriterSvc_TupleStream_
+#define _H_ntupleWriterSvc_TupleStream_
+
+// Unix sockets: StreamTrees are not available on Windows
+#ifndef WIN32
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+/** @namespace TupleStream
+    @brief Frames exchanged on the socket named by RootTupleSvc.StreamSocket
+
+    The consumer listens on the socket; the job connects at initialize and sends, on that one
+    connection, the trees named in RootTupleSvc.StreamTrees, each as a stream of its own:
+    - Schema, once per stream, before its first batch: uint32 stream, string tree name,
+      uint32 number of columns, then per column: string name, char type (ROOT leaflist code
+      'D', 'F', 'I', 'i', 'l' or 'C'), uint32 bytes per element, uint32 number of elements.
+    - Batch: uint32 stream, uint32 rows, then each column in turn, all its rows: the values of
+      a numeric column back to back, a string column as uint32 length and bytes per row.
+    - End, when the job is done with all streams: no payload.
+
+    The consumer answers with
+    - Credit: uint32 number of further Batch frames it accepts. It grants some when the
+      connection opens, then one for each batch it has processed: the job waits when it has none.
+    - Ack, after End, once everything received is safe.
+
+    A string is a uint32 length and its bytes. Every value is in the byte order of the job,
+    which is that of the consumer, on the same node.
+*/
+namespace TupleStream {
+    const std::uint16_t magic = 0x5453; // "TS"
+    const std::uint16_t version = 1;
+
+    enum FrameType { Schema = 1, Batch = 2, End = 3, Credit = 4, Ack = 5 };
+
+    struct FrameHeader {
+        std::uint16_t magic;
+        std::uint16_t version;
+        std::uint32_t type;
+        std::uint64_t bytes;   ///< of the payload that follows
+    };
+
+    /// write all of a buffer: false if the connection is gone
+    inline bool sendAll(int fd, const void* data, size_t n) {
+        const char* p = static_cast<const char*>(data);
+        while (n > 0) {
+            // no SIGPIPE if the peer went away: the error is returned
+            ssize_t sent = send(fd, p, n, MSG_NOSIGNAL);
+            if (sent < 0 && errno == EINTR) continue;
+            if (sent <= 0) return false;
+            p += sent;
+            n -= sent;
+        }
+        return true;
+    }
+
+    /// read exactly n bytes: false at the end of the connection or on error
+    inline bool recvAll(int fd, void* data, size_t n) {
+        char* p = static_cast<char*>(data);
+        while (n > 0) {
+            ssize_t got = recv(fd, p, n, 0);
+            if (got < 0 && errno == EINTR) continue;
+            if (got <= 0) return false;
+            p += got;
+            n -= got;
+        }
+        return true;
+    }
+
+    inline bool sendFrame(int fd, FrameType type, const std::string& payload) {
+        FrameHeader h;
+        h.magic = magic;
+        h.version = version;
+        h.type = type;
+        h.bytes = payload.size();
+        return sendAll(fd, &h, sizeof(h)) && sendAll(fd, payload.data(), payload.size());
+    }
+
+    /// read a frame: false at the end of the connection, or if it is not a frame of this version
+    inline bool recvFrame(int fd, std::uint32_t& type, std::string& payload) {
+        FrameHeader h;
+        if (!recvAll(fd, &h, sizeof(h)) || h.magic != magic || h.version != version) return false;
+        type = h.type;
+        payload.resize(h.bytes);
+        return h.bytes == 0 || recvAll(fd, &payload[0], h.bytes);
+    }
+
+    /// append a value to a payload
+    template <class T> void put(std::string& out, const T& value) {
+        out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+    inline void putString(std::string& out, const std::string& s) {
+        put<std::uint32_t>(out, s.size());
+        out.append(s);
+    }
+
+    /// reads the values of a payload in turn; ok() turns false if it runs past the end
+    class Reader {
+    public:
+        explicit Reader(const std::string& payload)
+        : m_p(payload.data()), m_end(payload.data() + payload.size()), m_ok(true) {}
+        template <class T> T get() {
+            T value = T();
+            const char* p = bytes(sizeof(T));
+            if (p) std::memcpy(&value, p, sizeof(T));
+            return value;
+        }
+        std::string getString() {
+            std::uint32_t n = get<std::uint32_t>();
+            const char* p = bytes(n);
+            return p ? std::string(p, n) : std::string();
+        }
+        /// n bytes in place, or 0 if there are not that many
+        const char* bytes(size_t n) {
+            if (!m_ok || n > size_t(m_end - m_p)) { m_ok = false; return 0; }
+            const char* p = m_p;
+            m_p += n;
+            return p;
+        }
+        bool ok() const { return m_ok; }
+        bool atEnd() const { return m_p == m_end; }
+    private:
+        const char* m_p;
+        const char* m_end;
+        bool m_ok;
+    };
+}
+
+#endif // WIN32
+
+#endif
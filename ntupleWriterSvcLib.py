@@ -4,6 +4,8 @@ def generate(env, **kw):
         env.Tool('addLibrary', library = ['ntupleWriterSvc'])
         if env['PLATFORM']=='win32' and env.get('CONTAINERNAME','')=='GlastRelease':
 	    env.Tool('findPkgPath', package = 'ntupleWriterSvc') 
+    # the Gaudi-independent core of the component
+    env.Tool('addLibrary', library = ['tupleEngine'])
     env.Tool('facilitiesLib')
     env.Tool('addLibrary', library = env['gaudiLibs'])
     env.Tool('addLibrary', library = env['rootLibs'])
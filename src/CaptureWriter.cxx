@@ -0,0 +1,153 @@
+/** @file CaptureWriter.cxx
+    @brief implement CaptureWriter
+
+    $Header$
+*/
+#include "CaptureWriter.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+namespace {
+    template <class T> void append(std::string& out, const T& value) {
+        out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+}
+
+CaptureWriter::CaptureWriter()
+: m_file(0), m_ok(false), m_eventTrees(0), m_events(0), m_bytes(0)
+{}
+
+CaptureWriter::~CaptureWriter()
+{
+    close();
+}
+
+bool CaptureWriter::open(const std::string& fileName)
+{
+    m_file = fopen(fileName.c_str(), "wb");
+    if (m_file == 0) return false;
+    // rows are small: write in large blocks
+    setvbuf(m_file, 0, _IOFBF, 1<<20);
+    m_ok = true;
+    std::uint32_t head[2] = { TupleCapture::magic, TupleCapture::version };
+    write(head, sizeof(head));
+    return m_ok;
+}
+
+void CaptureWriter::write(const void* data, size_t n)
+{
+    if (m_ok && fwrite(data, 1, n, m_file) != n) m_ok = false;
+    m_bytes += n;
+}
+
+void CaptureWriter::writeString(const std::string& s)
+{
+    std::uint32_t n = s.size();
+    write(&n, sizeof(n));
+    write(s.data(), n);
+}
+
+void CaptureWriter::item(const std::string& tree, const std::string& item, const std::string& type,
+                         const void* address, const std::string& file, bool write)
+{
+    if (m_file == 0) return;
+    std::map<std::string, Tree>::iterator it = m_trees.find(tree);
+    if (it == m_trees.end()) {
+        it = m_trees.insert(std::make_pair(tree, Tree())).first;
+        it->second.index = m_trees.size()-1;
+        it->second.file = file;
+        it->second.write = write;
+    }
+    Tree& t = it->second;
+    std::vector<std::string>::iterator name = std::find(t.names.begin(), t.names.end(), item);
+    if (name != t.names.end()) {
+        t.addresses[name - t.names.begin()] = address;
+        t.copied[name - t.names.begin()] = false;
+        return;
+    }
+    t.names.push_back(item);
+    t.cols.push_back(TupleCapture::column(item, type));
+    t.addresses.push_back(address);
+    t.copied.push_back(false);
+
+    unsigned char kind = TupleCapture::Item, w = write ? 1 : 0;
+    this->write(&kind, 1);
+    writeString(tree);
+    writeString(item);
+    writeString(type);
+    writeString(file);
+    this->write(&w, 1);
+}
+
+void CaptureWriter::copied(const std::string& tree, const std::string& item, const std::string& type,
+                           const void* address)
+{
+    std::map<std::string, Tree>::iterator it = m_trees.find(tree);
+    if (m_file == 0 || it == m_trees.end()) return;
+    Tree& t = it->second;
+    std::vector<std::string>::iterator name = std::find(t.names.begin(), t.names.end(), item);
+    if (name != t.names.end()) {
+        // the client variable of an item added is what the client filled, not the branch
+        if (t.copied[name - t.names.begin()]) t.addresses[name - t.names.begin()] = address;
+        return;
+    }
+    this->item(tree, item, type, address, t.file, t.write);
+    t.copied.back() = true;
+}
+
+void CaptureWriter::beginEvent()
+{
+    m_event.clear();
+    m_eventTrees = 0;
+}
+
+void CaptureWriter::pack(const Tree& t, std::string& out) const
+{
+    append<std::uint32_t>(out, t.index);
+    // the size, once known
+    std::string::size_type sizeAt = out.size();
+    append<std::uint32_t>(out, 0);
+    for (unsigned int i = 0; i<t.cols.size(); ++i) {
+        const char* value = static_cast<const char*>(t.addresses[i]);
+        if (t.cols[i].type == 'C') out.append(value, strlen(value)+1);
+        else out.append(value, t.cols[i].size*t.cols[i].length);
+    }
+    std::uint32_t bytes = out.size() - sizeAt - sizeof(std::uint32_t);
+    memcpy(&out[sizeAt], &bytes, sizeof(bytes));
+}
+
+void CaptureWriter::row(const std::string& tree)
+{
+    std::map<std::string, Tree>::const_iterator it = m_trees.find(tree);
+    if (m_file == 0 || it == m_trees.end()) return;
+    pack(it->second, m_event);
+    ++m_eventTrees;
+}
+
+void CaptureWriter::saved(const std::string& tree)
+{
+    std::map<std::string, Tree>::const_iterator it = m_trees.find(tree);
+    if (m_file == 0 || it == m_trees.end()) return;
+    std::string record(1, char(TupleCapture::Row));
+    pack(it->second, record);
+    write(record.data(), record.size());
+}
+
+void CaptureWriter::endEvent()
+{
+    if (m_file == 0) return;
+    unsigned char kind = TupleCapture::Event;
+    write(&kind, 1);
+    write(&m_eventTrees, sizeof(m_eventTrees));
+    write(m_event.data(), m_event.size());
+    ++m_events;
+}
+
+void CaptureWriter::close()
+{
+    if (m_file == 0) return;
+    if (fclose(m_file) != 0) m_ok = false;
+    m_file = 0;
+}
@@ -0,0 +1,77 @@
+/** @file CaptureWriter.h
+    @brief declare CaptureWriter, which records what a job asks of RootTupleSvc
+
+    $Header$
+*/
+#ifndef ntupleWriterSvc_CaptureWriter_h
+#define ntupleWriterSvc_CaptureWriter_h
+
+#include "ntupleWriterSvc/TupleCapture.h"
+
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+/** @class CaptureWriter
+    @brief Writes a capture file, as described in ntupleWriterSvc/TupleCapture.h
+
+    It reads the client variables itself, so the rows are those the client filled,
+    before any filter, sampling or encoding the service applies.
+*/
+class CaptureWriter {
+public:
+    CaptureWriter();
+    ~CaptureWriter();
+
+    /// false if the file cannot be created
+    bool open(const std::string& fileName);
+
+    /// an addItem: a new item is recorded, one already there only moves to the new address
+    void item(const std::string& tree, const std::string& item, const std::string& type,
+              const void* address, const std::string& file, bool write);
+
+    /** @brief an item of a tree copied from the input: recorded as if added, unless the client added it;
+        called again when its address changes
+    */
+    void copied(const std::string& tree, const std::string& item, const std::string& type,
+                const void* address);
+
+    /// start the record of an event; then row for each tree stored, then endEvent
+    void beginEvent();
+    void row(const std::string& tree);
+    void endEvent();
+
+    /// a row stored at once by saveRow, recorded before the event it belongs to
+    void saved(const std::string& tree);
+
+    long long events() const { return m_events; }
+    long long bytes() const { return m_bytes; }
+    /// false once a write has failed
+    bool ok() const { return m_ok; }
+    void close();
+
+private:
+    struct Tree {
+        unsigned int index;
+        std::vector<std::string> names;
+        std::vector<TupleCapture::Column> cols;
+        std::vector<const void*> addresses;
+        std::vector<bool> copied;  ///< not added by the client: its address is the branch's
+        std::string file;  ///< of its first item
+        bool write;
+    };
+    /// the tree index, the size and the values of the current row of a tree
+    void pack(const Tree& t, std::string& out) const;
+    void write(const void* data, size_t n);
+    void writeString(const std::string& s);
+
+    FILE* m_file;
+    bool m_ok;
+    std::map<std::string, Tree> m_trees;
+    std::string m_event;  ///< the record being made
+    unsigned int m_eventTrees;
+    long long m_events, m_bytes;
+};
+
+#endif
@@ -0,0 +1,144 @@
+/** @file ColumnarWriter.cxx
+    @brief implement ColumnarWriter
+
+    $Header$
+*/
+#include "ColumnarWriter.h"
+
+#include "TTree.h"
+#include "TSystem.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+namespace {
+    /// append a block of bytes to a file, creating it if needed
+    void appendTo(const std::string& path, const void* data, size_t n)
+    {
+        FILE* f = fopen(path.c_str(), "ab");
+        if (f==0) throw std::runtime_error("ColumnarWriter: cannot open "+path);
+        size_t written = n>0 ? fwrite(data, 1, n, f) : 0;
+        fclose(f);
+        if (written!=n) throw std::runtime_error("ColumnarWriter: short write to "+path);
+    }
+    /// create an empty file, or empty an existing one
+    void truncate(const std::string& path)
+    {
+        FILE* f = fopen(path.c_str(), "wb");
+        if (f==0) throw std::runtime_error("ColumnarWriter: cannot create "+path);
+        fclose(f);
+    }
+    /// column file name: the item name without the array dimension
+    std::string columnFile(const TupleColumn& col) { return col.leafName; }
+}
+
+ColumnarWriter::ColumnarWriter(const std::string& directory, const std::string& treeName,
+                               TTree* tree, int clusterRows)
+: m_directory(directory), m_treeName(treeName), m_tree(tree)
+, m_clusterRows(clusterRows>0 ? clusterRows : 1), m_entries(0)
+, m_created(false), m_closed(false), m_pending(0)
+{}
+
+ColumnarWriter::~ColumnarWriter()
+{
+    close();
+}
+
+void ColumnarWriter::create()
+{
+    gSystem->mkdir(m_directory.c_str(), kTRUE);
+    describeColumns(m_tree, m_cols);
+    m_buffers.resize(m_cols.size());
+    m_offsets.resize(m_cols.size());
+    m_stringBytes.assign(m_cols.size(), 0);
+    for (unsigned int i = 0; i<m_cols.size(); ++i) {
+        const TupleColumn& col = m_cols[i];
+        // start from empty files
+        std::string path = m_directory+"/"+columnFile(col);
+        truncate(path+".col");
+        if (col.type=='C') truncate(path+".offsets");
+        else m_buffers[i].reserve(col.bytes()*m_clusterRows);
+    }
+    m_created = true;
+    writeSchema();
+}
+
+void ColumnarWriter::bind()
+{
+    if (!m_created) return;
+    std::vector<TupleColumn> cols;
+    describeColumns(m_tree, cols);
+    for (unsigned int i = 0; i<cols.size() && i<m_cols.size(); ++i)
+        m_cols[i].address = cols[i].address;
+}
+
+void ColumnarWriter::fill()
+{
+    if (m_closed) return;
+    if (!m_created) create();
+    for (unsigned int i = 0; i<m_cols.size(); ++i) {
+        const TupleColumn& col = m_cols[i];
+        const char* p = static_cast<const char*>(col.address);
+        if (col.type=='C') {
+            size_t n = strlen(p)+1;
+            m_offsets[i].push_back(m_stringBytes[i]);
+            m_stringBytes[i] += n;
+            m_buffers[i].append(p, n);
+        } else {
+            m_buffers[i].append(p, col.bytes());
+        }
+    }
+    ++m_entries;
+    if (++m_pending >= m_clusterRows) flush();
+}
+
+void ColumnarWriter::flush()
+{
+    if (m_pending==0) return;
+    for (unsigned int i = 0; i<m_cols.size(); ++i) {
+        std::string path = m_directory+"/"+columnFile(m_cols[i]);
+        appendTo(path+".col", m_buffers[i].data(), m_buffers[i].size());
+        m_buffers[i].clear();
+        if (m_cols[i].type=='C') {
+            appendTo(path+".offsets", m_offsets[i].data(),
+                     m_offsets[i].size()*sizeof(unsigned long long));
+            m_offsets[i].clear();
+        }
+    }
+    m_pending = 0;
+    writeSchema();
+}
+
+void ColumnarWriter::writeSchema()
+{
+    // write a new file and rename it, so that a reader never sees a partial schema
+    std::string path = m_directory+"/schema.json";
+    std::string temp = path+".tmp";
+    {
+        std::ofstream out(temp.c_str());
+        out << "{\n  \"tree\": \"" << m_treeName << "\",\n"
+            << "  \"rows\": " << m_entries << ",\n"
+            << "  \"clusterRows\": " << m_clusterRows << ",\n"
+            << "  \"columns\": [\n";
+        for (unsigned int i = 0; i<m_cols.size(); ++i) {
+            const TupleColumn& col = m_cols[i];
+            out << "    { \"name\": \"" << col.leafName << "\", \"type\": \"" << col.type << "\""
+                << ", \"elementSize\": " << col.size << ", \"length\": " << col.length
+                << ", \"file\": \"" << columnFile(col) << ".col\"";
+            if (col.type=='C') out << ", \"offsets\": \"" << columnFile(col) << ".offsets\"";
+            out << " }" << (i+1<m_cols.size() ? "," : "") << "\n";
+        }
+        out << "  ]\n}\n";
+    }
+    gSystem->Rename(temp.c_str(), path.c_str());
+}
+
+void ColumnarWriter::close()
+{
+    if (m_closed || !m_created) { m_closed = true; return; }
+    flush();
+    writeSchema(); // in case there was nothing left to flush
+    m_closed = true;
+}
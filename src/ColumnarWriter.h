@@ -0,0 +1,63 @@
+/** @file ColumnarWriter.h
+    @brief declare ColumnarWriter, a flat uncompressed copy of a tuple for memory-mapped analysis
+
+    $Header$
+*/
+#ifndef ntupleWriterSvc_ColumnarWriter_h
+#define ntupleWriterSvc_ColumnarWriter_h
+
+#include "TupleSink.h"
+#include "TupleColumn.h"
+
+#include <string>
+#include <vector>
+
+/** @class ColumnarWriter
+    @brief TupleSink that appends each row to a directory with one raw file per column
+
+    Layout of the directory:
+    - schema.json: tree name, row count, cluster size, and for each column its name, ROOT type code,
+      element size, element count and file name
+    - one <item>.col file per column: the values of all rows, native byte order, no header,
+      so that it can be mapped with mmap and used as an array
+    - for a character string item, <item>.col holds the zero-terminated strings back to back,
+      and <item>.offsets the 64-bit offset of each row's string in it
+
+    Rows are buffered in memory for one cluster of clusterRows rows, then appended to the files.
+*/
+class ColumnarWriter : public TupleSink {
+public:
+    ColumnarWriter(const std::string& directory, const std::string& treeName,
+                   TTree* tree, int clusterRows);
+    virtual ~ColumnarWriter();
+
+    virtual std::string type() const { return "columnar"; }
+    virtual void bind();
+    virtual void fill();
+    virtual long long entries() const { return m_entries; }
+    virtual void close();
+
+    const std::string& directory() const { return m_directory; }
+
+private:
+    void create();
+    void flush();
+    void writeSchema();
+
+    std::string m_directory;
+    std::string m_treeName;
+    TTree*      m_tree;
+    int         m_clusterRows;
+    long long   m_entries;
+    bool        m_created;
+    bool        m_closed;
+    std::vector<TupleColumn> m_cols;
+    /// per column, the rows of the current cluster
+    std::vector<std::string> m_buffers;
+    /// per string column, the offsets of the current cluster and the total bytes written
+    std::vector<std::vector<unsigned long long> > m_offsets;
+    std::vector<unsigned long long> m_stringBytes;
+    int m_pending; ///< rows in the buffers
+};
+
+#endif
@@ -0,0 +1,114 @@
+/** @file CompressionTrial.cxx
+    @brief implement trialCompress
+
+    $Header$
+*/
+#include "CompressionTrial.h"
+
+#include "RZip.h"
+#include "Compression.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <vector>
+
+namespace {
+    /// largest block the ROOT compression routines take at once
+    const int maxBlock = 0xffffff;
+    /// repetitions of each measure
+    const int repeats = 3;
+
+    struct Algorithm {
+        const char* name;
+        ROOT::RCompressionSetting::EAlgorithm::EValues value;
+    };
+    const Algorithm algorithms[] = {
+        { "ZLIB", ROOT::RCompressionSetting::EAlgorithm::kZLIB },
+        { "LZMA", ROOT::RCompressionSetting::EAlgorithm::kLZMA },
+        { "LZ4",  ROOT::RCompressionSetting::EAlgorithm::kLZ4 },
+        { "ZSTD", ROOT::RCompressionSetting::EAlgorithm::kZSTD },
+    };
+    const int nAlgorithms = sizeof(algorithms)/sizeof(algorithms[0]);
+
+    double seconds(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+}
+
+bool parseCompression(const std::string& setting, int& settings)
+{
+    std::string::size_type colon = setting.find(':');
+    if (colon == std::string::npos) return false;
+    std::string name = setting.substr(0, colon);
+    int level = atoi(setting.substr(colon+1).c_str());
+    if (level < 1 || level > 9) return false;
+    for (int i = 0; i<nAlgorithms; ++i) {
+        if (name == algorithms[i].name) {
+            settings = ROOT::CompressionSettings(algorithms[i].value, level);
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string compressionName(int settings)
+{
+    for (int i = 0; i<nAlgorithms; ++i) {
+        if (settings/100 == algorithms[i].value)
+            return std::string(algorithms[i].name) + ":" + std::to_string(settings%100);
+    }
+    return std::to_string(settings);
+}
+
+CompressionTrial trialCompress(const std::string& sample, int settings, int blockSize)
+{
+    CompressionTrial trial;
+    trial.settings = settings;
+    trial.bytes = sample.size();
+    ROOT::RCompressionSetting::EAlgorithm::EValues algorithm =
+        static_cast<ROOT::RCompressionSetting::EAlgorithm::EValues>(settings/100);
+    int level = settings%100;
+
+    // blocks as baskets would be, each compressed on its own
+    size_t block = blockSize > 0 ? std::min(blockSize, maxBlock) : maxBlock;
+    std::vector<char> source(sample.begin(), sample.end());
+    std::vector<std::vector<char> > compressed;
+    std::vector<int> sizes;
+    for (int r = 0; r<repeats; ++r) {
+        compressed.clear();
+        sizes.clear();
+        trial.compressedBytes = 0;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (size_t offset = 0; offset < source.size(); offset += block) {
+            int srcSize = std::min<size_t>(block, source.size()-offset);
+            // room for the header when the block does not shrink
+            int tgtSize = srcSize + 9;
+            std::vector<char> target(tgtSize);
+            int irep = 0;
+            R__zipMultipleAlgorithm(level, &srcSize, &source[offset], &tgtSize, &target[0], &irep, algorithm);
+            // irep 0: not compressed, ROOT stores the block as it is
+            trial.compressedBytes += irep > 0 ? irep : srcSize;
+            target.resize(irep > 0 ? irep : 0);
+            compressed.push_back(target);
+            sizes.push_back(srcSize);
+        }
+        double t = seconds(start);
+        if (r == 0 || t < trial.compressSeconds) trial.compressSeconds = t;
+    }
+
+    std::vector<unsigned char> output(block);
+    for (int r = 0; r<repeats; ++r) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i<compressed.size(); ++i) {
+            if (compressed[i].empty()) continue;
+            int srcSize = compressed[i].size();
+            int tgtSize = sizes[i];
+            int irep = 0;
+            R__unzip(&srcSize, reinterpret_cast<unsigned char*>(&compressed[i][0]), &tgtSize, &output[0], &irep);
+        }
+        double t = seconds(start);
+        if (r == 0 || t < trial.decompressSeconds) trial.decompressSeconds = t;
+    }
+    return trial;
+}
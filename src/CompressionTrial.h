@@ -0,0 +1,43 @@
+/** @file CompressionTrial.h
+    @brief declare trialCompress, a measure of how a ROOT compression setting does on sample data
+
+    $Header$
+*/
+#ifndef ntupleWriterSvc_CompressionTrial_h
+#define ntupleWriterSvc_CompressionTrial_h
+
+#include <string>
+
+/** @class CompressionTrial
+    @brief Result of compressing a sample with one setting, as ROOT would compress a basket
+*/
+struct CompressionTrial {
+    CompressionTrial() : settings(0), bytes(0), compressedBytes(0), compressSeconds(0), decompressSeconds(0) {}
+    int       settings;        ///< as TBranch::SetCompressionSettings: 100*algorithm + level
+    long long bytes;           ///< of the sample
+    long long compressedBytes; ///< the sample size for data that does not compress
+    double    compressSeconds;
+    double    decompressSeconds;
+
+    double ratio() const { return compressedBytes > 0 ? double(bytes)/compressedBytes : 1; }
+    /// MB/s of sample data
+    double compressSpeed() const   { return compressSeconds > 0 ? 1e-6*bytes/compressSeconds : 0; }
+    double decompressSpeed() const { return decompressSeconds > 0 ? 1e-6*bytes/decompressSeconds : 0; }
+};
+
+/** @brief parse a setting "ZLIB:6", "LZMA:5", "LZ4:4" or "ZSTD:5"
+    @return false if the algorithm is unknown, or the level not in 1..9
+*/
+bool parseCompression(const std::string& setting, int& settings);
+
+/// the name of a setting, as parseCompression reads it
+std::string compressionName(int settings);
+
+/** @brief compress a sample, and decompress it, with the ROOT compression routines
+    @param blockSize - bytes compressed at once: the basket size, since ROOT compresses each
+                       basket on its own and the ratio depends on it
+    The times are the best of a few repetitions, since samples are small.
+*/
+CompressionTrial trialCompress(const std::string& sample, int settings, int blockSize);
+
+#endif
@@ -9,12 +9,26 @@
 #include "GaudiKernel/DataObject.h"
 #include "GaudiKernel/SmartDataPtr.h"
 #include "GaudiKernel/DataSvc.h"
+#include "GaudiKernel/IAlgManager.h"
 #include "ntupleWriterSvc/INTupleWriterSvc.h"
 
+#include <chrono>
 #include <map>
+#include <sstream>
+#include <vector>
 /** @class Count
  * @brief Alg that counts and records the value in the jobinfo tuple
  * 
+ * Placed between the algorithms of a sequence, the Count instances also measure where
+ * the time goes: a Count given the name of the Count before it (property Previous) times
+ * the section since that one, and the events that reached that one but not this one are
+ * counted as rejected. At the end, the jobinfo tuple gets, for a Count named X:
+ * - X: number of events that reached it
+ * - X_rejected: events that passed the previous Count but not this one
+ * - X_time: seconds spent since the previous Count, total over the events (Double_t)
+ * - X_timeHist[n]: those times, histogrammed in bins of a factor 2, starting at 1 microsecond
+ *   (first bin: below 2 microseconds, last bin: everything above)
+ *
  * $Header: /nfs/slac/g/glast/ground/cvs/GlastRelease-scons/ntupleWriterSvc/src/Count.cxx,v 1.2.612.1 2010/10/08 16:43:48 heather Exp $
 */
 class Count : public Algorithm
@@ -26,9 +40,30 @@ public:
     StatusCode execute();
     StatusCode finalize();
 private:
+    /// time accounting of one Count, as written to jobinfo
+    struct Timing {
+        Timing() : rejected(0), seconds(0) {}
+        int rejected;
+        double seconds;
+        std::vector<int> hist;
+    };
+
     INTupleWriterSvc* m_ntupleWriterSvc;
     // have to save the counts in a static, since this object gets deleted before the tuple is filled :-(
     static std::map<std::string, int> s_map; 
+    // and the times, copied there at finalize, for the same reason
+    static std::map<std::string, Timing> s_timing;
+
+    StringProperty  m_previousName; ///< the Count before this one, for the times
+    BooleanProperty m_time;         ///< measure times
+    IntegerProperty m_nBins;        ///< bins in the time histogram
+
+    /// resolved at initialize, so that execute does no lookup
+    int*   m_count;
+    Count* m_previous;
+    /// when this Count last executed
+    std::chrono::steady_clock::time_point m_lastTime;
+    Timing m_timing;
 };
 
 //  factory stuff
@@ -37,11 +72,15 @@ private:
 DECLARE_ALGORITHM_FACTORY(Count);
 
 std::map<std::string,int> Count::s_map;
+std::map<std::string,Count::Timing> Count::s_timing;
 
 Count::Count(const std::string& name, ISvcLocator* pSvcLocator) 
-: Algorithm(name, pSvcLocator) 
+: Algorithm(name, pSvcLocator), m_count(0), m_previous(0)
 {
     s_map[name]=0;
+    declareProperty("Previous", m_previousName="");
+    declareProperty("Time", m_time=true);
+    declareProperty("TimeBins", m_nBins=20);
 }
 Count::~Count(){
 }
@@ -57,14 +96,45 @@ StatusCode Count::initialize() {
     
     if(sc.isFailure())    {
         log << MSG::ERROR << "Could not locate the ntupleSvc" <<endreq;
+        return sc;
+    }
+    m_count = &s_map[name()];
+    if (m_nBins < 1) m_nBins = 1;
+    m_timing.hist.assign(m_nBins, 0);
+    if (!m_previousName.value().empty()) {
+        IAlgManager* algMgr = 0;
+        IAlgorithm* alg = 0;
+        if (serviceLocator()->queryInterface(IAlgManager::interfaceID(), (void**)&algMgr).isSuccess())
+            algMgr->getAlgorithm(m_previousName.value(), alg);
+        m_previous = dynamic_cast<Count*>(alg);
+        if (m_previous == 0) {
+            log << MSG::ERROR << "Previous: no Count named " << m_previousName.value() << endreq;
+            return StatusCode::FAILURE;
+        }
     }
+
+    // so that the count is saved with checkpoints
+    m_ntupleWriterSvc->addCounter(name(), m_count);
     return sc;   
 }
 
 
 StatusCode Count::execute() {
 
-    ++ s_map[name()];
+    ++ *m_count;
+    if (!m_time) return StatusCode::SUCCESS;
+
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (m_previous != 0 && m_previous->m_lastTime > m_lastTime) {
+        // the previous Count ran since this one did: the section since then, in this event
+        long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now - m_previous->m_lastTime).count();
+        m_timing.seconds += 1e-9*ns;
+        unsigned long long us = ns/1000;
+        int bin = 0;
+        while ((us >>= 1) != 0 && bin < m_nBins-1) ++bin;
+        ++m_timing.hist[bin];
+    }
+    m_lastTime = now;
     return StatusCode::SUCCESS;
 }
 
@@ -72,10 +142,22 @@ StatusCode Count::execute() {
 StatusCode Count::finalize() {
     
     MsgStream log(msgSvc(), name());
-    log << MSG::INFO << "counted " << s_map[name()] << " times" << endreq;
+    if (m_previous != 0) m_timing.rejected = *m_previous->m_count - *m_count;
+    log << MSG::INFO << "counted " << s_map[name()] << " times";
+    if (m_previous != 0) log << ", rejected " << m_timing.rejected << ", " << m_timing.seconds << " s";
+    log << endreq;
     std::map<std::string, int>::iterator p = s_map.find(name());
     int * i = &(p->second);
     m_ntupleWriterSvc->addItem("jobinfo", name(), i);
+    if (!m_time || m_previous == 0) return StatusCode::SUCCESS;
+
+    Timing& timing = s_timing[name()];
+    timing = m_timing;
+    m_ntupleWriterSvc->addItem("jobinfo", name()+"_rejected", &timing.rejected);
+    m_ntupleWriterSvc->addItem("jobinfo", name()+"_time", &timing.seconds);
+    std::ostringstream hist;
+    hist << name() << "_timeHist[" << m_nBins.value() << "]";
+    m_ntupleWriterSvc->addItem("jobinfo", hist.str(), &timing.hist[0]);
     return StatusCode::SUCCESS;
 }
 
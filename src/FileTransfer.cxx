@@ -0,0 +1,108 @@
+/** @file FileTransfer.cxx
+    @brief implement transferFile
+
+    $Header$
+*/
+#include "FileTransfer.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace {
+    const size_t chunk = 4*1024*1024;
+
+    /// continue an Adler-32 checksum over a buffer
+    unsigned long adler32(unsigned long adler, const unsigned char* p, size_t n) {
+        const unsigned long base = 65521;
+        unsigned long a = adler & 0xffff, b = (adler >> 16) & 0xffff;
+        while (n > 0) {
+            // the largest run for which the sums cannot overflow before the modulo
+            size_t run = n < 5552 ? n : 5552;
+            n -= run;
+            while (run-- > 0) {
+                a += *p++;
+                b += a;
+            }
+            a %= base;
+            b %= base;
+        }
+        return (b << 16) | a;
+    }
+}
+
+bool adler32File(const std::string& fileName, unsigned long& checksum, long long& bytes)
+{
+    FILE* in = fopen(fileName.c_str(), "rb");
+    if (in == 0) return false;
+    std::vector<unsigned char> buffer(chunk);
+    checksum = 1;
+    bytes = 0;
+    size_t n;
+    while ((n = fread(&buffer[0], 1, buffer.size(), in)) > 0) {
+        checksum = adler32(checksum, &buffer[0], n);
+        bytes += n;
+    }
+    bool ok = !ferror(in);
+    fclose(in);
+    return ok;
+}
+
+void transferFile(FileTransfer* t)
+{
+    t->start = std::chrono::steady_clock::now();
+    t->ok = false;
+    if (rename(t->source.c_str(), t->destination.c_str()) == 0) {
+        t->ok = true;
+        t->end = std::chrono::steady_clock::now();
+        return;
+    }
+    if (errno != EXDEV) {
+        t->error = std::string("cannot rename to the destination: ") + strerror(errno);
+        t->end = std::chrono::steady_clock::now();
+        return;
+    }
+
+    // another file system: copy, computing the checksum of what is read
+    t->copied = true;
+    std::string part = t->destination + ".part";
+    FILE* in = fopen(t->source.c_str(), "rb");
+    FILE* out = in == 0 ? 0 : fopen(part.c_str(), "wb");
+    if (in == 0 || out == 0) {
+        t->error = std::string("cannot open ") + (in == 0 ? t->source : part) + ": " + strerror(errno);
+        if (in != 0) fclose(in);
+        t->end = std::chrono::steady_clock::now();
+        return;
+    }
+    std::vector<unsigned char> buffer(chunk);
+    unsigned long checksum = 1;
+    t->bytes = 0;
+    size_t n;
+    bool ok = true;
+    while (ok && (n = fread(&buffer[0], 1, buffer.size(), in)) > 0) {
+        checksum = adler32(checksum, &buffer[0], n);
+        ok = fwrite(&buffer[0], 1, n, out) == n;
+        t->bytes += n;
+    }
+    ok = ok && !ferror(in);
+    fclose(in);
+    ok = fclose(out) == 0 && ok;
+    t->checksum = checksum;
+
+    // read back what was written
+    unsigned long copy = 0;
+    long long copyBytes = 0;
+    if (!ok) {
+        t->error = "copy to " + part + " failed";
+    } else if (!adler32File(part, copy, copyBytes) || copy != checksum || copyBytes != t->bytes) {
+        t->error = "checksum of " + part + " differs from the staged file";
+    } else if (rename(part.c_str(), t->destination.c_str()) != 0) {
+        t->error = std::string("cannot rename ") + part + ": " + strerror(errno);
+    } else {
+        remove(t->source.c_str());
+        t->ok = true;
+    }
+    if (!t->ok) remove(part.c_str());
+    t->end = std::chrono::steady_clock::now();
+}
@@ -0,0 +1,40 @@
+/** @file FileTransfer.h
+    @brief declare transferFile, the move of a staged output file to its destination
+
+    $Header$
+*/
+#ifndef ntupleWriterSvc_FileTransfer_h
+#define ntupleWriterSvc_FileTransfer_h
+
+#include <chrono>
+#include <string>
+
+/** @class FileTransfer
+    @brief A file to move, and how it went
+*/
+struct FileTransfer {
+    FileTransfer() : ok(false), copied(false), bytes(0), checksum(0) {}
+    std::string source;      ///< the staged file
+    std::string destination;
+    bool        ok;
+    bool        copied;      ///< not renamed: the destination is on another file system
+    std::string error;
+    long long   bytes;
+    unsigned long checksum;  ///< Adler-32 of the file, when copied
+    std::chrono::steady_clock::time_point start, end;
+
+    double seconds() const { return std::chrono::duration<double>(end - start).count(); }
+};
+
+/** @brief move a file: rename it if possible, else copy it to destination.part,
+    check that the Adler-32 checksum of the copy is that of the source, rename the copy
+    to the destination and remove the source. The source is kept if anything fails.
+*/
+void transferFile(FileTransfer* transfer);
+
+/** @brief Adler-32 checksum of a file, as zlib's adler32
+    @return false if it cannot be read
+*/
+bool adler32File(const std::string& fileName, unsigned long& checksum, long long& bytes);
+
+#endif
@@ -0,0 +1,179 @@
+/** @file InputPrefetcher.cxx
+    @brief implement InputPrefetcher
+
+    $Header$
+*/
+#include "InputPrefetcher.h"
+
+#include "TSystem.h"
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+namespace {
+    /// bytes copied between checks of the stop flag
+    const size_t chunkBytes = 4*1024*1024;
+}
+
+InputPrefetcher::InputPrefetcher(const std::string& directory, const std::vector<std::string>& files,
+                                 int ahead, long long limitBytes)
+: m_directory(directory), m_files(files), m_state(files.size(), None), m_size(files.size(), 0)
+, m_ahead(ahead), m_limit(limitBytes), m_used(0), m_current(0), m_stop(false)
+, m_copied(0), m_failed(0), m_copiedBytes(0), m_copySeconds(0)
+{
+    // jobs may share the directory
+    for (unsigned int i = 0; i<m_files.size(); ++i) {
+        m_local.push_back(m_directory + "/" + std::to_string(gSystem->GetPid()) + "_" + std::to_string(i)
+                          + "_" + gSystem->BaseName(m_files[i].c_str()));
+    }
+    m_thread = std::thread(&InputPrefetcher::run, this);
+}
+
+InputPrefetcher::~InputPrefetcher()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+    m_thread.join();
+    for (unsigned int i = 0; i<m_files.size(); ++i) {
+        if (m_state[i] == Done) remove(m_local[i].c_str());
+    }
+}
+
+void InputPrefetcher::setCurrent(int file)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (file == m_current) return;
+        m_current = file;
+    }
+    m_wake.notify_all();
+}
+
+std::string InputPrefetcher::localPath(int file)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (file < 0 || file >= (int)m_files.size() || m_state[file] != Done) return "";
+    return m_local[file];
+}
+
+void InputPrefetcher::dropOutside()
+{
+    for (unsigned int i = 0; i<m_files.size(); ++i) {
+        if (m_state[i] == Done && ((int)i < m_current || (int)i > m_current + m_ahead)) {
+            remove(m_local[i].c_str());
+            m_used -= m_size[i];
+            m_state[i] = None;
+        }
+    }
+}
+
+long long InputPrefetcher::fileSize(int file)
+{
+    struct stat info;
+    if (stat(m_files[file].c_str(), &info) != 0) return -1;
+    return info.st_size;
+}
+
+bool InputPrefetcher::stopping()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stop;
+}
+
+bool InputPrefetcher::copyFile(const std::string& source, const std::string& target, long long& bytes)
+{
+    bytes = 0;
+    FILE* in = fopen(source.c_str(), "rb");
+    if (in == 0) return false;
+    FILE* out = fopen(target.c_str(), "wb");
+    if (out == 0) {
+        fclose(in);
+        return false;
+    }
+    std::vector<char> chunk(chunkBytes);
+    bool ok = true;
+    while (ok) {
+        size_t n = fread(&chunk[0], 1, chunk.size(), in);
+        if (n > 0 && fwrite(&chunk[0], 1, n, out) != n) ok = false;
+        bytes += n;
+        if (n < chunk.size()) {
+            ok = ok && !ferror(in);
+            break;
+        }
+        if (stopping()) ok = false;
+    }
+    fclose(in);
+    if (fclose(out) != 0) ok = false;
+    return ok;
+}
+
+void InputPrefetcher::run()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_stop) {
+        dropOutside();
+        // the first file of the window without a copy
+        int next = -1;
+        for (int f = m_current+1; f <= m_current+m_ahead && f < (int)m_files.size(); ++f) {
+            if (m_state[f] == None) { next = f; break; }
+        }
+        if (next < 0) {
+            m_wake.wait(lock);
+            continue;
+        }
+        lock.unlock();
+        long long size = fileSize(next);
+        lock.lock();
+        if (size < 0) {
+            // not in the file system: read from where it is
+            m_state[next] = Failed;
+            ++m_failed;
+            continue;
+        }
+        if (m_used + size > m_limit) {
+            if (m_used == 0) {
+                // would not fit alone: read from where it is
+                m_state[next] = Failed;
+                ++m_failed;
+            } else {
+                m_wake.wait(lock);
+            }
+            continue;
+        }
+        m_state[next] = Copying;
+        m_size[next] = size;
+        m_used += size;
+        std::string source = m_files[next];
+        std::string local = m_local[next];
+        lock.unlock();
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        std::string part = local + ".part";
+        long long actual = 0;
+        bool ok = copyFile(source, part, actual);
+        // a complete copy only ever has its final name
+        ok = ok && rename(part.c_str(), local.c_str()) == 0;
+        if (!ok) remove(part.c_str());
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        lock.lock();
+        if (ok) {
+            m_state[next] = Done;
+            m_used += actual - size;
+            m_size[next] = actual;
+            ++m_copied;
+            m_copiedBytes += actual;
+            m_copySeconds += seconds;
+        } else {
+            m_state[next] = Failed;
+            m_used -= size;
+            ++m_failed;
+        }
+    }
+}
@@ -0,0 +1,74 @@
+/** @file InputPrefetcher.h
+    @brief declare InputPrefetcher, copies of the next input files on local disk
+
+    $Header$
+*/
+#ifndef ntupleWriterSvc_InputPrefetcher_h
+#define ntupleWriterSvc_InputPrefetcher_h
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/** @class InputPrefetcher
+    @brief A thread that copies the files following the one being read to a local directory
+
+    The reader says which file it is at with setCurrent; the thread then copies the next
+    ahead files, in order, and removes the copies of the files outside that window.
+    The copies never take more than limitBytes: a copy waits until there is room for it.
+    Only files of the file system are copied, in chunks with plain file I/O, so that the
+    thread makes no ROOT call and stops within a chunk when the prefetcher is deleted;
+    remote files (URLs) are read where they are.
+*/
+class InputPrefetcher {
+public:
+    InputPrefetcher(const std::string& directory, const std::vector<std::string>& files,
+                    int ahead, long long limitBytes);
+    /// stops the thread, and removes the copies
+    ~InputPrefetcher();
+
+    /// the reader is at this file: copy the next ones, drop the others
+    void setCurrent(int file);
+    /// the path of the complete copy of a file, or empty if there is none
+    std::string localPath(int file);
+
+    /// statistics, for the end of the job
+    int copied() const { return m_copied; }
+    int failed() const { return m_failed; }
+    long long copiedBytes() const { return m_copiedBytes; }
+    double copySeconds() const { return m_copySeconds; }
+
+private:
+    enum State { None, Copying, Done, Failed };
+    void run();
+    /// remove the copies outside the window, with the mutex held
+    void dropOutside();
+    /// size in the file system, -1 for a file that is not there (a URL)
+    long long fileSize(int file);
+    /// copy a file chunk by chunk, false if it fails or the prefetcher stops meanwhile
+    bool copyFile(const std::string& source, const std::string& target, long long& bytes);
+    bool stopping();
+
+    std::string m_directory;
+    std::vector<std::string> m_files;
+    std::vector<std::string> m_local;
+    std::vector<State> m_state;
+    std::vector<long long> m_size; ///< bytes each copy takes, or reserves while being made
+    int m_ahead;
+    long long m_limit;
+    long long m_used;
+    int m_current;
+    bool m_stop;
+
+    int m_copied, m_failed;
+    long long m_copiedBytes;
+    double m_copySeconds;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::thread m_thread;
+};
+
+#endif
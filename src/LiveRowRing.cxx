@@ -0,0 +1,109 @@
+/** @file LiveRowRing.cxx
+    @brief implement LiveRowRing
+
+    $Header$
+*/
+// POSIX shared memory, not built on Windows (see SConscript)
+#ifndef WIN32
+#include "LiveRowRing.h"
+#include "ntupleWriterSvc/LiveRows.h"
+
+#include "TBranch.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+LiveRowRing::LiveRowRing(const std::string& segment, const std::string& tree,
+                         const std::vector<TupleColumn>& cols, unsigned int capacity)
+: m_segment(segment), m_cols(cols), m_rowBytes(0), m_capacity(std::max(capacity, 1u))
+, m_bytes(0), m_rows(0), m_base(0), m_slots(0)
+{
+    for (unsigned int i = 0; i<m_cols.size(); ++i) {
+        m_offsets.push_back(m_rowBytes);
+        // a string has a fixed room, aligned for what follows
+        m_rowBytes += m_cols[i].type == 'C' ? LiveRows::stringBytes : m_cols[i].bytes();
+    }
+    m_bytes = LiveRows::segmentBytes(m_cols.size(), m_rowBytes, m_capacity);
+
+    // a segment left by a job that crashed is replaced
+    shm_unlink(m_segment.c_str());
+    int fd = shm_open(m_segment.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0) {
+        m_error = std::string("shm_open: ") + strerror(errno);
+        return;
+    }
+    void* base = MAP_FAILED;
+    if (ftruncate(fd, m_bytes) != 0) m_error = std::string("ftruncate: ") + strerror(errno);
+    else {
+        base = mmap(0, m_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (base == MAP_FAILED) m_error = std::string("mmap: ") + strerror(errno);
+    }
+    close(fd);
+    if (base == MAP_FAILED) {
+        shm_unlink(m_segment.c_str());
+        return;
+    }
+    m_base = static_cast<char*>(base);
+
+    // the new segment is zeroed: every slot is empty
+    LiveRows::Header* h = new (m_base) LiveRows::Header;
+    h->version = LiveRows::version;
+    h->columns = m_cols.size();
+    h->rowBytes = m_rowBytes;
+    h->capacity = m_capacity;
+    h->pid = getpid();
+    strncpy(h->tree, tree.c_str(), LiveRows::nameBytes-1);
+    h->written.store(0);
+    h->closed.store(0);
+    LiveRows::Column* c = reinterpret_cast<LiveRows::Column*>(m_base + LiveRows::columnsOffset());
+    for (unsigned int i = 0; i<m_cols.size(); ++i) {
+        strncpy(c[i].name, m_cols[i].leafName.c_str(), LiveRows::nameBytes-1);
+        c[i].type = m_cols[i].type;
+        c[i].size = m_cols[i].size;
+        c[i].length = m_cols[i].type == 'C' ? LiveRows::stringBytes : m_cols[i].length;
+        c[i].offset = m_offsets[i];
+    }
+    m_slots = m_base + LiveRows::slotsOffset(m_cols.size());
+    // last, so that a reader seeing the magic number sees the schema
+    std::atomic_thread_fence(std::memory_order_release);
+    h->magic = LiveRows::magic;
+}
+
+LiveRowRing::~LiveRowRing()
+{
+    if (m_base == 0) return;
+    reinterpret_cast<LiveRows::Header*>(m_base)->closed.store(1, std::memory_order_release);
+    munmap(m_base, m_bytes);
+    // readers that have it mapped keep it until they unmap it
+    shm_unlink(m_segment.c_str());
+}
+
+void LiveRowRing::publish()
+{
+    if (m_base == 0) return;
+    char* slot = m_slots + (m_rows % m_capacity)*LiveRows::slotBytes(m_rowBytes);
+    std::atomic<std::uint64_t>* sequence = reinterpret_cast<std::atomic<std::uint64_t>*>(slot);
+    char* row = slot + 8;
+    sequence->store(2*m_rows + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (unsigned int i = 0; i<m_cols.size(); ++i) {
+        // the branch address: the client variable, or the buffer standing in for it
+        const char* value = m_cols[i].branch->GetAddress();
+        if (m_cols[i].type == 'C') {
+            strncpy(row + m_offsets[i], value, LiveRows::stringBytes-1);
+            row[m_offsets[i] + LiveRows::stringBytes-1] = 0;
+        } else {
+            memcpy(row + m_offsets[i], value, m_cols[i].bytes());
+        }
+    }
+    sequence->store(2*m_rows + 2, std::memory_order_release);
+    ++m_rows;
+    reinterpret_cast<LiveRows::Header*>(m_base)->written.store(m_rows, std::memory_order_release);
+}
+
+#endif // WIN32
@@ -0,0 +1,55 @@
+/** @file LiveRowRing.h
+    @brief declare LiveRowRing, the writer of a LiveRows shared memory segment
+
+    $Header$
+*/
+#ifndef ntupleWriterSvc_LiveRowRing_h
+#define ntupleWriterSvc_LiveRowRing_h
+
+#include "TupleColumn.h"
+
+#include <string>
+#include <vector>
+
+/** @class LiveRowRing
+    @brief Publishes the latest rows of a tree in a POSIX shared memory segment laid out as
+    described in ntupleWriterSvc/LiveRows.h
+
+    The segment is created by the constructor and removed by the destructor.
+    publish copies the current values of the columns: a few hundred bytes per row.
+*/
+class LiveRowRing {
+public:
+    /** @param segment - shm_open name, starting with '/'
+        @param tree - the name of the tree, for the readers
+        @param cols - the columns to publish
+        @param capacity - number of rows kept
+    */
+    LiveRowRing(const std::string& segment, const std::string& tree,
+                const std::vector<TupleColumn>& cols, unsigned int capacity);
+    /// marks the segment closed, and removes its name
+    ~LiveRowRing();
+
+    /// false, with a message in error, if the segment could not be created
+    bool ok() const { return m_base != 0; }
+    const std::string& error() const { return m_error; }
+    const std::string& segment() const { return m_segment; }
+    unsigned long long bytes() const { return m_bytes; }
+
+    /// copy the current values of the columns as the next row
+    void publish();
+
+private:
+    std::string m_segment;
+    std::string m_error;
+    std::vector<TupleColumn> m_cols;
+    std::vector<unsigned int> m_offsets;
+    unsigned int m_rowBytes;
+    unsigned long long m_capacity;
+    unsigned long long m_bytes;
+    unsigned long long m_rows;
+    char* m_base;
+    char* m_slots;
+};
+
+#endif
@@ -0,0 +1,122 @@
+/** @file RNTupleSink.cxx
+    @brief implement RNTupleSink
+
+    $Header$
+*/
+#include "RNTupleSink.h"
+
+#include "TTree.h"
+#include "TFile.h"
+#include "TDirectory.h"
+
+#include <sstream>
+#include <stdexcept>
+
+#ifdef NTUPLEWRITERSVC_HAS_RNTUPLE
+#include "ROOT/RNTupleModel.hxx"
+#include "ROOT/RNTupleWriter.hxx"
+#include "ROOT/RField.hxx"
+#include "ROOT/REntry.hxx"
+
+using ROOT::Experimental::RNTupleModel;
+using ROOT::Experimental::RNTupleWriter;
+using ROOT::Experimental::RFieldBase;
+
+namespace {
+    /// RNTuple field type for a column
+    std::string fieldType(const TupleColumn& col)
+    {
+        std::string t;
+        switch (col.type) {
+            case 'F': t = "float"; break;
+            case 'D': t = "double"; break;
+            case 'I': t = "std::int32_t"; break;
+            case 'i': t = "std::uint32_t"; break;
+            case 'l': t = "std::uint64_t"; break;
+            case 'C': return "std::string";
+            default:  return "";
+        }
+        if (col.length==1) return t;
+        std::ostringstream s;
+        s << "std::array<" << t << "," << col.length << ">";
+        return s.str();
+    }
+}
+#endif
+
+RNTupleSink::RNTupleSink(const std::string& name, TTree* schema, TFile* file)
+: m_name(name), m_schema(schema), m_file(file), m_entries(0)
+{}
+
+RNTupleSink::~RNTupleSink()
+{
+    close();
+}
+
+bool RNTupleSink::available()
+{
+#ifdef NTUPLEWRITERSVC_HAS_RNTUPLE
+    return true;
+#else
+    return false;
+#endif
+}
+
+void RNTupleSink::create()
+{
+#ifdef NTUPLEWRITERSVC_HAS_RNTUPLE
+    describeColumns(m_schema, m_cols);
+    std::unique_ptr<RNTupleModel> model = RNTupleModel::CreateBare();
+    for (unsigned int i = 0; i<m_cols.size(); ++i) {
+        std::string type = fieldType(m_cols[i]);
+        if (type.empty())
+            throw std::invalid_argument("RNTupleSink: unsupported type for item "+m_cols[i].name);
+        model->AddField(RFieldBase::Create(m_cols[i].leafName, type).Unwrap());
+    }
+    TDirectory* saveDir = gDirectory;
+    m_writer = RNTupleWriter::Append(std::move(model), m_name, *m_file);
+    m_entry  = m_writer->CreateEntry();
+    saveDir->cd();
+    bind();
+#endif
+}
+
+void RNTupleSink::bind()
+{
+#ifdef NTUPLEWRITERSVC_HAS_RNTUPLE
+    if (!m_entry) return; // nothing to bind yet: done by create
+    std::vector<TupleColumn> cols;
+    describeColumns(m_schema, cols);
+    m_strings.resize(cols.size());
+    for (unsigned int i = 0; i<cols.size() && i<m_cols.size(); ++i) {
+        m_cols[i].address = cols[i].address;
+        if (m_cols[i].type=='C')
+            m_entry->BindRawPtr(m_cols[i].leafName, &m_strings[i]);
+        else
+            m_entry->BindRawPtr(m_cols[i].leafName, m_cols[i].address);
+    }
+#endif
+}
+
+void RNTupleSink::fill()
+{
+#ifdef NTUPLEWRITERSVC_HAS_RNTUPLE
+    if (!m_writer) create();
+    for (unsigned int i = 0; i<m_cols.size(); ++i) {
+        if (m_cols[i].type=='C') m_strings[i] = static_cast<const char*>(m_cols[i].address);
+    }
+    m_writer->Fill(*m_entry);
+    ++m_entries;
+#endif
+}
+
+void RNTupleSink::close()
+{
+#ifdef NTUPLEWRITERSVC_HAS_RNTUPLE
+    // destroying the writer commits the last cluster and the RNTuple anchor to the file
+    TDirectory* saveDir = gDirectory;
+    m_entry.reset();
+    m_writer.reset();
+    saveDir->cd();
+#endif
+}
@@ -0,0 +1,62 @@
+/** @file RNTupleSink.h
+    @brief declare RNTupleSink, which writes a tuple as a ROOT RNTuple
+
+    $Header$
+*/
+#ifndef ntupleWriterSvc_RNTupleSink_h
+#define ntupleWriterSvc_RNTupleSink_h
+
+#include "TupleSink.h"
+#include "TupleColumn.h"
+
+#include "RVersion.h"
+
+#include <string>
+#include <vector>
+
+class TFile;
+
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6,32,0)
+#define NTUPLEWRITERSVC_HAS_RNTUPLE 1
+#include <memory>
+namespace ROOT { namespace Experimental { class RNTupleWriter; class REntry; } }
+#endif
+
+/** @class RNTupleSink
+    @brief TupleSink that writes an RNTuple into the tuple's output file
+
+    The RNTuple model is made from the branches of the schema tree when the first row is
+    written, so all items must be added before then (as is the case for items added in
+    initialize). Character string items are copied into a std::string field.
+*/
+class RNTupleSink : public TupleSink {
+public:
+    RNTupleSink(const std::string& name, TTree* schema, TFile* file);
+    virtual ~RNTupleSink();
+
+    /// true if this ROOT build supports RNTuple
+    static bool available();
+
+    virtual std::string type() const { return "RNTuple"; }
+    virtual void bind();
+    virtual void fill();
+    virtual long long entries() const { return m_entries; }
+    virtual void close();
+
+private:
+    void create();
+
+    std::string m_name;
+    TTree*      m_schema;
+    TFile*      m_file;
+    long long   m_entries;
+    std::vector<TupleColumn> m_cols;
+    /// one per 'C' column: the value copied from the client's char array
+    std::vector<std::string> m_strings;
+#ifdef NTUPLEWRITERSVC_HAS_RNTUPLE
+    std::unique_ptr<ROOT::Experimental::RNTupleWriter> m_writer;
+    std::unique_ptr<ROOT::Experimental::REntry>        m_entry;
+#endif
+};
+
+#endif
@@ -15,24 +15,59 @@
 #include "GaudiKernel/Property.h"
 #include "GaudiKernel/SmartDataPtr.h"
 #include "GaudiKernel/MsgStream.h"
+#include "GaudiKernel/IEventProcessor.h"
 
 #include "ntupleWriterSvc/INTupleWriterSvc.h"
 #include "facilities/Util.h"
+#include "TupleColumn.h"
+#include "RNTupleSink.h"
+#include "ColumnarWriter.h"
+#include "SlotQueue.h"
+#include "TupleCut.h"
+#include "CompressionTrial.h"
+#include "FileTransfer.h"
+#include "InputPrefetcher.h"
+#include "LiveRowRing.h"
+#include "StreamSink.h"
+#include "CaptureWriter.h"
+#include "engine/TupleEngine.h"
 
 // root includes
 #include "TTree.h"
 #include "TChain.h"
+#include "TChainElement.h"
+#include "TBranch.h"
+#include "TBasket.h"
+#include "TKey.h"
 #include "TFile.h"
 #include "TSystem.h"
 #include "TLeafD.h"
 #include "TLeaf.h"
-
+#include "TROOT.h"
+#include "TParameter.h"
+#include "TNamed.h"
+#include "RVersion.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
 #include <map>
 #include <fstream>
 #include <iomanip>
 #include <list>
+#include <sstream>
+#include <mutex>
+#include <condition_variable>
+#include <random>
 #include <string>
 #include <utility>
+#include <vector>
+#include <thread>
+#include <unordered_map>
+#include <cstdlib>
+#include <cstring>
+#include <cfloat>
 
 #ifdef WIN32
 #include <float.h> // used to check for NaN
@@ -42,6 +77,241 @@
 
 namespace {
 
+    /// bytes of buffer held by the baskets being filled by the branches of a tree
+    long long basketMemory(TTree* t) {
+        long long total = 0;
+        TObjArray* ta = t->GetListOfBranches();
+        int entries = ta->GetEntries();
+        for( int i = 0; i<entries; ++i) {
+            TBranch* branch = (TBranch*)(*ta)[i];
+            TBasket* basket = branch->GetBasket(branch->GetWriteBasket());
+            if (basket != 0) total += basket->GetBufferSize();
+        }
+        return total;
+    }
+
+    /// seconds since a start time, on the monotonic clock
+    double secondsSince(const std::chrono::steady_clock::time_point& start) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+    }
+
+    /// an output file closed by finalize, and its move if it was staged
+    struct FileWrite {
+        FileWrite() : transfer(0), mover(0) {}
+        std::string   fileName;
+        FileTransfer* transfer; ///< for a staged file: its move to the destination
+        std::thread*  mover;
+    };
+
+    /// the event slot of the calling thread, in concurrent mode
+    thread_local unsigned int t_currentSlot = 0;
+
+    /// a buffer for the values of an input leaf, as in the item pool; 0 for an unsupported type
+    void* newItemBuffer(TLeaf* leaf) {
+        std::string type_name = leaf->GetTypeName();
+        int n = leaf->GetNdata();
+        if (type_name == "Float_t")   return new Float_t[n];
+        if (type_name == "Int_t")     return new Int_t[n];
+        if (type_name == "UInt_t")    return new UInt_t[n];
+        if (type_name == "ULong64_t") return new ULong64_t[n];
+        if (type_name == "Double_t")  return new Double_t[n];
+        if (type_name == "Char_t")    return new Char_t[n];
+        return 0;
+    }
+
+    /// key index of a memory resident tree: see RootTupleSvc::declareKey
+    struct KeyIndex {
+        std::vector<TupleColumn> keys;
+        /// entry number by the bytes of the key values
+        std::unordered_map<std::string, long long> entries;
+    };
+
+    /// the bytes of the key values at the current branch addresses, which may be staging buffers
+    std::string currentKey(const std::vector<TupleColumn>& keys) {
+        std::string key;
+        for (unsigned int i = 0; i<keys.size(); ++i) {
+            const char* p = keys[i].branch->GetAddress();
+            if (keys[i].type=='C') key.append(p, strlen(p)+1);
+            else                   key.append(p, keys[i].bytes());
+        }
+        return key;
+    }
+
+    /// a string item written as an integer code: see RootTupleSvc DictionaryItems
+    struct DictEncoder {
+        DictEncoder(const std::string& i, const char* s) : item(i), source(s), code(0) {}
+        std::string item;
+        const char* source; ///< the client's string
+        Int_t code;         ///< the branch holds this
+        std::unordered_map<std::string, Int_t> codes;
+        std::vector<std::string> values; ///< by code
+        /// set the code of the current value, adding it to the dictionary if new
+        void encode() {
+            std::unordered_map<std::string, Int_t>::const_iterator it = codes.find(source);
+            if (it != codes.end()) { code = it->second; return; }
+            code = values.size();
+            codes[source] = code;
+            values.push_back(source);
+        }
+    };
+
+    /// a dictionary encoded string item read from the input: the code and the string it stands for
+    struct DictDecoder {
+        DictDecoder() : code(0), treeNumber(-1) {}
+        Int_t* code;       ///< the item pool buffer of the code branch
+        std::vector<std::string> values;
+        std::vector<char> text; ///< the decoded value, what getItem returns
+        int treeNumber;    ///< chain tree whose dictionary is loaded
+        void decode() {
+            const std::string& value = (*code >= 0 && *code < (Int_t)values.size()) ? values[*code] : std::string();
+            strncpy(&text[0], value.c_str(), text.size()-1);
+        }
+    };
+
+    /// an integer item written as the difference to the previous row: see RootTupleSvc DeltaItems
+    struct DeltaEncoder {
+        DeltaEncoder(const std::string& i, char t, const void* s, int b)
+            : item(i), type(t), source(s), block(b), delta32(0), delta64(0), previous(0), rows(0), bits(0) {}
+        std::string item;
+        char type;          ///< 'I', 'i' or 'l', as in the leaf list
+        const void* source; ///< the client's value
+        int block;          ///< rows between values stored whole
+        UInt_t delta32;     ///< the branch holds this, or delta64 for 'l'
+        ULong64_t delta64;
+        ULong64_t previous;
+        long long rows;
+        double bits;        ///< significant bits of the differences, summed
+        void* buffer() { return type == 'l' ? (void*)&delta64 : (void*)&delta32; }
+        /// store the current value: the first of a block whole, the others as the zigzag encoded difference
+        void encode() {
+            ULong64_t value = type == 'l' ? *static_cast<const ULong64_t*>(source) : *static_cast<const UInt_t*>(source);
+            ULong64_t stored = value;
+            if (rows % block != 0) {
+                if (type == 'l') {
+                    Long64_t d = (Long64_t)(value - previous);
+                    stored = ((ULong64_t)d << 1) ^ (ULong64_t)(d >> 63);
+                } else {
+                    Int_t d = (Int_t)(UInt_t)(value - previous);
+                    stored = (UInt_t)(((UInt_t)d << 1) ^ (UInt_t)(d >> 31));
+                }
+                for (ULong64_t z = stored; z != 0; z >>= 1) ++bits;
+            }
+            if (type == 'l') delta64 = stored; else delta32 = (UInt_t)stored;
+            previous = value;
+            ++rows;
+        }
+    };
+
+    /// a delta encoded integer item read from the input, decoded in place in its item pool buffer
+    struct DeltaDecoder {
+        DeltaDecoder(char t, void* v) : type(t), value(v), block(0), entry(-1), treeNumber(-1), previous(0) {}
+        char type;
+        void* value;      ///< the item pool buffer
+        int block;        ///< of the current file
+        long long entry;  ///< last entry decoded, in the current file
+        int treeNumber;
+        ULong64_t previous;
+        ULong64_t read() const {
+            return type == 'l' ? *static_cast<ULong64_t*>(value) : *static_cast<UInt_t*>(value);
+        }
+        ULong64_t undo(ULong64_t stored) const {
+            ULong64_t d = (stored >> 1) ^ (ULong64_t)(-(Long64_t)(stored & 1));
+            return type == 'l' ? previous + d : (UInt_t)(previous + d);
+        }
+        /// decode the value just read for an entry of a tree of the chain
+        void decode(TTree* tree, const std::string& item, long long local, int number) {
+            if (local % block == 0) {
+                previous = read();
+            } else if (number == treeNumber && local == entry+1) {
+                previous = undo(read());
+            } else {
+                // not the next entry: add up the differences from the start of the block
+                TBranch* b = tree->GetBranch(item.c_str());
+                long long first = local - local % block;
+                b->GetEntry(first);
+                previous = read();
+                for (long long e = first+1; e<=local; ++e) {
+                    b->GetEntry(e);
+                    previous = undo(read());
+                }
+            }
+            if (type == 'l') *static_cast<ULong64_t*>(value) = previous;
+            else *static_cast<UInt_t*>(value) = (UInt_t)previous;
+            entry = local;
+            treeNumber = number;
+        }
+    };
+
+    /// name of the block size parameter that marks a delta encoded item
+    std::string deltaName(const std::string& treeName, const std::string& item) {
+        return treeName + "_" + item + "_delta";
+    }
+
+    /// true if an item, or tree:item, is in a list
+    bool listedItem(const std::vector<std::string>& items, const std::string& treeName, const std::string& itemName) {
+        return std::find(items.begin(), items.end(), itemName) != items.end()
+            || std::find(items.begin(), items.end(), treeName+":"+itemName) != items.end();
+    }
+
+    /// name of the dictionary tree of an item
+    std::string dictionaryName(const std::string& treeName, const std::string& item) {
+        return treeName + "_" + item + "_dict";
+    }
+
+    /// the values of a dictionary tree, by code
+    void readDictionary(TTree* dict, std::vector<std::string>& values) {
+        Int_t code = 0;
+        // a string leaf knows the size of its longest value: ROOT reads no more
+        TLeaf* leaf = dict->GetLeaf("value");
+        std::vector<char> value((leaf != 0 ? std::max(leaf->GetMaximum(), 0) : 0) + 1, 0);
+        dict->SetBranchAddress("code", &code);
+        dict->SetBranchAddress("value", &value[0]);
+        values.assign(dict->GetEntries(), std::string());
+        for (long long entry = 0; entry<dict->GetEntries(); ++entry) {
+            dict->GetEntry(entry);
+            if (code >= 0 && code < (Int_t)values.size()) values[code] = &value[0];
+        }
+        dict->ResetBranchAddresses();
+    }
+
+    /// TObject whose Notify, called by a TChain when it opens another file, calls a function
+    class ChainNotify : public TObject {
+    public:
+        explicit ChainNotify(const std::function<void()>& f) : m_notify(f) {}
+        virtual Bool_t Notify() { m_notify(); return kTRUE; }
+    private:
+        std::function<void()> m_notify;
+    };
+
+    /// sends the messages of the TupleEngine to the MsgStream of the service
+    class ServiceTupleLog : public TupleLog {
+    public:
+        ServiceTupleLog() : m_msgSvc(0), m_level(MSG::INFO) {}
+        void bind(IMessageSvc* msgSvc, const std::string& name) {
+            m_msgSvc = msgSvc;
+            m_name = name;
+            MsgStream log(msgSvc, name);
+            m_level = log.level();
+        }
+        virtual bool enabled(Level level) const { return m_msgSvc != 0 && msgLevel(level) >= m_level; }
+        virtual void message(Level level, const std::string& text) {
+            MsgStream log(m_msgSvc, m_name);
+            log << msgLevel(level) << text << endreq;
+        }
+    private:
+        static MSG::Level msgLevel(Level level) {
+            switch (level) {
+                case Debug:   return MSG::DEBUG;
+                case Info:    return MSG::INFO;
+                case Warning: return MSG::WARNING;
+                default:      return MSG::ERROR;
+            }
+        }
+        IMessageSvc* m_msgSvc;
+        std::string m_name;
+        MSG::Level m_level;
+    };
+
     bool isFinite(double val) {
         using namespace std; // should allow either std::isfinite or ::isfinite
 #ifdef WIN32 
@@ -50,8 +320,150 @@ namespace {
         return (isfinite(val)!=0); // gcc call available in math.h 
 #endif
     }
+
+    /** running minimum, maximum and count of non-finite values of each numeric column of an
+        output tree, per zone of consecutive entries. Every element of an array item counts,
+        since a cut on the item may be tested on any of them.
+    */
+    struct ZoneMap {
+        ZoneMap() : described(false), rows(0) {}
+        bool described; ///< cols is set at the first row, when all the items have been added
+        std::vector<TupleColumn> cols;
+        long long rows; ///< in the current zone
+        std::vector<double> min, max;
+        std::vector<Int_t> nonFinite;
+        /// the closed zones: first entry and entries, then the values of each column in turn
+        std::vector<Long64_t> firsts, sizes;
+        std::vector<double> mins, maxs;
+        std::vector<Int_t> nonFinites;
+
+        void add() {
+            if (rows == 0) {
+                min.assign(cols.size(), DBL_MAX);
+                max.assign(cols.size(), -DBL_MAX);
+                nonFinite.assign(cols.size(), 0);
+            }
+            for (unsigned int i = 0; i<cols.size(); ++i) {
+                int len = cols[i].leaf->GetLen();
+                for (int j = 0; j<len; ++j) {
+                    double v = cols[i].leaf->GetValue(j);
+                    if (!isFinite(v)) { ++nonFinite[i]; continue; }
+                    if (v < min[i]) min[i] = v;
+                    if (v > max[i]) max[i] = v;
+                }
+            }
+            ++rows;
+        }
+        void close(long long entries) {
+            if (rows == 0) return;
+            firsts.push_back(entries - rows);
+            sizes.push_back(rows);
+            mins.insert(mins.end(), min.begin(), min.end());
+            maxs.insert(maxs.end(), max.begin(), max.end());
+            nonFinites.insert(nonFinites.end(), nonFinite.begin(), nonFinite.end());
+            rows = 0;
+        }
+    };
+
+    /// zone maps of the current file of an input chain, reduced to the items of a cut
+    struct InputZones {
+        InputZones() : treeNumber(-1), zone(0) {}
+        int treeNumber;
+        std::vector<Long64_t> firsts, sizes;
+        std::vector<std::vector<double> > mins, maxs; ///< per zone, in the order of TupleCut::names
+        std::vector<std::vector<int> > nonFinites;
+        unsigned int zone; ///< the last one found
+        /// index of the zone of an entry, or -1
+        int find(long long entry) {
+            if (zone >= firsts.size() || entry < firsts[zone]) zone = 0;
+            while (zone < firsts.size() && entry >= firsts[zone] + sizes[zone]) ++zone;
+            return zone < firsts.size() && entry >= firsts[zone] ? (int)zone : -1;
+        }
+    };
+
+    std::string zoneMapName(const std::string& treeName) { return treeName + "_zonemap"; }
+
+    /// remove the spaces around a string
+    std::string trimmed(const std::string& s) {
+        std::string::size_type first = s.find_first_not_of(" \t");
+        if (first == std::string::npos) return "";
+        return s.substr(first, s.find_last_not_of(" \t") - first + 1);
+    }
+
+    /// split "tree: rest" in its tree, or a default one without a colon, and the rest
+    std::string treePrefix(const std::string& s, const std::string& defaultTree, std::string& tree) {
+        std::string::size_type colon = s.find(':');
+        tree = colon == std::string::npos ? defaultTree : trimmed(s.substr(0, colon));
+        return colon == std::string::npos ? s : s.substr(colon+1);
+    }
+
+    /// compression tuning of an output tree: see RootTupleSvc CompressionTuneEvents
+    struct CompressionTuning {
+        CompressionTuning() : rows(0), done(false) {}
+        std::vector<TupleColumn> cols;
+        std::vector<std::string> samples; ///< the values of each column, row after row
+        long long rows;
+        bool done;
+        std::vector<CompressionTrial> chosen; ///< per column, once done
+    };
+
+    std::string compressionTableName(const std::string& treeName) { return treeName + "_compression"; }
+
+    /// the rows kept for a tree by RootTupleSvc Reservoir: a uniform sample of a fixed number of rows
+    struct Reservoir {
+        Reservoir() : size(0), candidates(0) {}
+        long long size;
+        long long candidates; ///< rows offered so far
+        std::vector<TupleColumn> cols;
+        std::vector<std::pair<long long, std::string> > rows; ///< candidate number, packed row
+    };
+
+    /// a RootTupleSvc TreeFilters selection of the rows of an output tree
+    struct RowFilter {
+        RowFilter() : bound(false), passed(0), failed(0) {}
+        TupleCut cut;
+        bool bound;                       ///< items looked up, at the first row
+        std::vector<TupleColumn> cols;    ///< per TupleCut::names
+        std::vector<const DeltaEncoder*> deltas; ///< per column, the encoder of a delta encoded item
+        std::vector<double> values;
+        unsigned long long passed, failed;
+    };
+
+    /// the value of a numeric scalar item as a double
+    double columnValue(const TupleColumn& col) {
+        switch (col.type) {
+            case 'D': return *static_cast<const double*>(col.address);
+            case 'F': return *static_cast<const float*>(col.address);
+            case 'I': return *static_cast<const int*>(col.address);
+            case 'i': return *static_cast<const unsigned int*>(col.address);
+            case 'l': return double(*static_cast<const unsigned long long*>(col.address));
+        }
+        return 0;
+    }
+
+    /// an input entry, by its key: see RootTupleSvc InputKey
+    struct KeyEntry {
+        ULong64_t key[2]; ///< the second is 0 for a key of one item
+        Long64_t entry;
+        bool operator<(const KeyEntry& other) const {
+            if (key[0] != other.key[0]) return key[0] < other.key[0];
+            if (key[1] != other.key[1]) return key[1] < other.key[1];
+            return entry < other.entry;
+        }
+    };
 } // anom namespace
 
+/** @class ConcurrentTree
+    @brief An output tree in concurrent mode: the writer thread copies each row submitted
+    by a slot into the staging buffers, then fills the tree from them
+*/
+struct ConcurrentTree {
+    ConcurrentTree(const std::string& n, TTree* t) : name(n), tree(t), staging(t) {}
+    std::string name;
+    TTree*      tree;
+    RowStaging  staging; ///< its columns have the addresses registered for slot 0
+};
+
 
 
 
@@ -160,9 +572,9 @@ public:
                bool write=true);
 
     /// Set a flag to denote whether or not to store a row at the end of this event,
-    virtual void storeRowFlag(bool flag) { m_storeAll = flag; }
+    virtual void storeRowFlag(bool flag);
     /// retrieve the flag that denotes whether or not to store a row
-    virtual bool storeRowFlag() { return m_storeAll; }
+    virtual bool storeRowFlag();
 
     // Had to remove const due to reprocessing needs, and the requirement to store branch pointers in some cases
     virtual std::string getItem(const std::string & tupleName, 
@@ -186,9 +598,20 @@ public:
     virtual long long getOutputTreePtr(void*& treePtr,
                          const std::string& tupleName="MeritTuple");
 
+    //! Returns the output format of the requested tuple
+    virtual std::string getOutputTreeType(const std::string& tupleName="MeritTuple");
+
     //! Save the row in the output file
     virtual void saveRow(const std::string& tupleName);
 
+    /** @brief Fill a batch of rows from per-column arrays
+    The branches are pointed at a row staging buffer for the duration of the batch,
+    so the client variables registered with addItem are not touched.
+    */
+    virtual long long fillRows(const std::string& tupleName, long long nRows,
+                               const std::vector<std::string>& itemNames,
+                               const std::vector<const void*>& columns);
+
     /// allow clients to set TTree buffer size on a per branch basis or
     /// for whole TTree by setting bname="*"
     virtual void setBufferSize(const std::string& tupleName, int bufSize, 
@@ -200,6 +623,25 @@ public:
           return false;
     }
 
+    virtual void addCounter(const std::string& counterName, int* counter);
+
+    virtual std::string bindItemRef(const std::string& tupleName, const std::string& itemName,
+                                    void** ref);
+    virtual void unbindItemRef(void** ref);
+
+    virtual StatusCode declareKey(const std::string& tupleName,
+                                  const std::vector<std::string>& keyItems);
+    virtual long long findEntry(const std::string& tupleName,
+                                const std::vector<const void*>& keyValues, bool load=true);
+    virtual long long findEntries(const std::string& tupleName,
+                                  const std::vector<std::vector<const void*> >& keyList);
+
+    /// concurrent mode: see INTupleWriterSvc
+    virtual void selectSlot(unsigned int slot);
+    virtual StatusCode beginSlotEvent(unsigned int slot, long long eventIndex);
+    virtual StatusCode endSlotEvent(unsigned int slot);
+    virtual void drainSlots();
+
     virtual bool setIndex( Long64_t i );
     virtual Long64_t index();
     virtual Long64_t getNumberOfEvents();
@@ -215,22 +657,181 @@ private:
 
     bool fileExists( const std::string & filename );
 
-    /// For getting "the" current tree...
-    bool getTree(std::string& treeName, TTree*& t);
+    /// set up an output tree the engine has just made: input decoders, encoders, then attachTree
+    void setupTree(const std::string& treeName, TFile* tf);
+
+    /// put a newly created output tree in its file, or give it a TupleSink writing to that file
+    void attachTree(const std::string& treeName, TFile* tf, MsgStream& log);
+
+    /// true for a tree that is neither written to a file nor routed to a TupleSink
+    bool isMemoryResident(const std::string& treeName);
+
+    /// store the current row of a tree, through its TupleSink if it has one
+    void fillTree(const std::string& treeName, TTree* t);
+
+    /// number of rows stored for a tree
+    long long treeEntries(const std::string& treeName, TTree* t);
+
+    /// record basket memory per tree, and rebalance it if outside the budget
+    void checkMemoryBudget();
+
+    /// flush all file trees and save the job state: see CheckpointInterval
+    void writeCheckpoint();
+    /// read the state saved by writeCheckpoint, false if there is none
+    bool readCheckpoint(MsgStream& log);
+    /** @brief the tree saved in a resumed output file, cut back to the checkpoint, or 0
+    A tree is only found longer than at the checkpoint if it was saved again later, for instance by
+    a job that reached finalize. Cutting it back reads and rewrites, unzipping and zipping, every
+    entry up to the checkpoint: as long as writing them in the first place, less the clients' work.
+    The entries after the checkpoint are not read.
+    */
+    TTree* resumeTree(const std::string& treeName, TFile* tf, MsgStream& log);
+    /// mode for opening an output file: "UPDATE" if resuming and it exists
+    const char* outputMode(const std::string& fileName);
+    /// read "tree1=value1,tree2=value2"
+    StatusCode parseTreeValues(const std::string& property, const std::string& value,
+                               std::map<std::string, long long>& values, MsgStream& log);
+#ifndef WIN32
+    /// create the LiveTrees segment of a tree, at its first row
+    LiveRowRing* openLive(const std::string& treeName, TTree* t);
+#endif
+
+    /// record the current row of a tree in the capture: at the end of the event, or at once for saveRow
+    void captureRow(const std::string& treeName, bool saved);
+
+    /// false for the rows the TreeFilters expression of the tree rejects
+    bool passesFilter(const std::string& treeName, TTree* t, MsgStream& log);
+    /// false for the rows a Prescale drops
+    bool keepPrescaled(const std::string& treeName);
+    /// fill a row, or offer it to the reservoir of the tree
+    void storeRow(const std::string& treeName, TTree* t);
+    /// fill the trees with the rows kept in their reservoirs
+    void fillReservoirs(MsgStream& log);
+    /// add the weights of the sampled trees, and the counts of the filtered ones, to jobinfo
+    void addSelectionInfo();
+
+    /// create an output file: in StagingDirectory, if set
+    TFile* openOutput(const std::string& fileName);
+    /// start copying the input files to PrefetchDirectory
+    void startPrefetch(TChain* ch, MsgStream& log);
+    /// point the input chains at the local copy of the file of an entry, if there is one
+    void usePrefetched(long long entry);
+    /// stop the copies, and report
+    void stopPrefetch(MsgStream& log);
 
     // ADW 26-May-2011: Make friends from various trees
     bool makeFriends();
 
+    /// set the ItemRefs of a tree again: called when its input chain opens another file
+    void rebindItemRefs(const std::string& treeName);
+
+    /// the encoder of an item, or 0
+    DictEncoder* findEncoder(const std::string& treeName, const std::string& itemName);
+    DeltaEncoder* findDeltaEncoder(const std::string& treeName, const std::string& itemName);
+    /// find the dictionary encoded items of an input chain, and decode them
+    void setupDecoders(const std::string& treeName, TChain* ch, MsgStream& log);
+    /// decode the items of an input chain after reading an entry
+    void decodeInputs(const std::string& treeName, TChain* ch);
+    /// read the dictionary of an item from the current file of a chain
+    bool loadDictionary(const std::string& treeName, const std::string& item, TChain* ch, DictDecoder& d);
+    /// the size, with its terminating 0, of the longest value in the dictionaries of an item in all the files of a chain
+    size_t longestDictionaryValue(const std::string& treeName, const std::string& item, TChain* ch);
+    /// block size of a delta encoded item in the current file of a chain, 0 if it is not encoded
+    int deltaBlock(const std::string& treeName, const std::string& item, TChain* ch);
+    /// write the zone maps of the output trees next to them
+    void writeZoneMaps(MsgStream& log);
+    /// read the zone maps of the current file of the chain the input cut applies to
+    void loadZones(TChain* ch, MsgStream& log);
+    /** move the next input entry past the zones that cannot pass the input cut
+        @return false if there is none left, before EndingIndex
+    */
+    bool skipToSelected(MsgStream& log);
+    /// true if the input is read selectively: an input cut, an ending index or a key list
+    bool selectiveInput() const;
+    /// ask the application manager to stop after this event: the input has no entry left
+    void stopInput(MsgStream& log);
+
+    /// build the index of the input entries by InputKey, or read it from InputKeyCache
+    bool buildKeyIndex(MsgStream& log);
+    /// description of the input files an index is valid for
+    std::string keyIndexInputs(TChain* ch);
+    /// declareKey for the input tree
+    StatusCode declareInputKey(const std::string& tupleName, const std::vector<std::string>& keyItems,
+                               MsgStream& log);
+    /// findEntry for the input tree: the first entry with the key, and all of them scheduled if load
+    long long findInputEntry(const std::vector<const void*>& keyValues, bool load);
+    /// the key of the input tree, as the index keeps it, from pointers to the values of its items
+    KeyEntry inputKey(const std::vector<const void*>& keyValues, MsgStream& log);
+    /// add entries to those left to read, which stay in entry order, each once
+    void scheduleEntries(const std::vector<long long>& entries, MsgStream& log);
+
+    /// add the current row of a tree to the compression samples, and choose when there are enough
+    void sampleCompression(const std::string& treeName, TTree* t, CompressionTuning& tuning);
+    /// compress the samples of each branch with each candidate, and apply the best
+    void chooseCompression(const std::string& treeName, CompressionTuning& tuning);
+    /// read the tables of CompressionTable
+    StatusCode readCompressionTables(MsgStream& log);
+    /// write the chosen settings next to each tree
+    void writeCompressionTables(MsgStream& log);
+
+    /// file that gets the dictionaries and markers of an output tree
+    TFile* encodingFile(const std::string& treeName);
+    /// write the dictionaries and markers of the encoded items next to their trees
+    void writeEncodings(MsgStream& log);
+    /// write the dictionary of an item, replacing any written at a checkpoint
+    void writeDictionary(const std::string& treeName, const DictEncoder& d, TFile* f);
+    /// write the block size of a delta encoded item, which marks it as encoded
+    void writeDeltaBlock(const std::string& treeName, const DeltaEncoder& d, TFile* f);
+    /// bring the encoders of a tree cut back to a checkpoint to their state then, from what it saved
+    void resumeEncoders(const std::string& treeName, MsgStream& log);
+    void resumeEncoder(const std::string& treeName, DictEncoder& d, MsgStream& log);
+    void resumeEncoder(const std::string& treeName, DeltaEncoder& d, MsgStream& log);
+
+    /// point the TupleSink and export of a tree at its current branch addresses
+    void bindOutputs(const std::string& treeName);
+
+    /// a tree as seen by one slot: where to copy each column from
+    struct SlotTree {
+        SlotTree() : tree(0) {}
+        ConcurrentTree* tree;
+        std::vector<const void*> addresses;
+    };
+    /// false, with a message, if the slot number is not below ConcurrentSlots
+    bool checkSlot(unsigned int slot);
+    /// record the variable a slot uses for an item already added for slot 0
+    StatusCode addSlotItem(unsigned int slot, const std::string& treeName,
+                           const std::string& itemName, const void* pval);
+    /// the input chain of a slot for a tree, created the first time
+    TChain* slotChain(unsigned int slot, const std::string& treeName);
+    /// create the input chains of all the slots, before any of them reads
+    void openSlotInputs();
+    /// the columns of a tree and where a slot keeps them, set up the first time
+    SlotTree& slotTree(unsigned int slot, const std::string& treeName, TTree* t);
+    /// item of a slot for getItem: its own input buffer or registered variable
+    bool slotItem(unsigned int slot, const std::string& treeName, const std::string& itemName,
+                  void*& pval, std::string& type_name);
+    /// body of the writer thread: fill the trees from the submitted records
+    void writeSlots();
+    /// fill the trees with the rows of one record
+    void writeRecord(SlotRecord* record);
+    /// stop the writer thread, write what is left, and give the trees back their client variables
+    void stopSlots(MsgStream& log);
+
     /// routine to be called at the beginning of an event
     void beginEvent();
     /// routine that is called when we reach the end of an event
     StatusCode endEvent();
 
+    /// the core of the service: trees, files, input chains, store flags and the event cycle.
+    /// The members below that are references are its state.
+    TupleEngine m_engine;
+    ServiceTupleLog m_engineLog;
+
     // Associated with the name of the first output ROOT file
     StringProperty m_filename;
     StringArrayProperty m_inFileJoParam;
     // stores the list of input files after env variables have been expanded
-    std::vector<std::string> m_inFileList;
+    std::vector<std::string>& m_inFileList;
     StringProperty m_treename;
     StringProperty m_title;
 
@@ -247,42 +848,257 @@ private:
 
     /// the ROOT stuff: a file and a a set of trees to put into it
     // replaced with m_fileCol, so we can handle multiple ROOT output files
-    std::map<std::string, TFile*> m_fileCol;
+    std::map<std::string, TFile*>& m_fileCol;
 
     /// collection of output TTrees
-    std::map<std::string, TTree *> m_tree;
+    std::map<std::string, TTree *>& m_tree;
+
+    /// trees to write as RNTuple rather than TTree
+    StringArrayProperty m_rntupleTrees;
+
+    /// output backends for trees that are not written as TTree, by tree name.
+    /// The corresponding entry in m_tree is memory resident and only holds the branches.
+    std::map<std::string, TupleSink*> m_sink;
+
+    /// trees to also export as flat column files, "*" for all trees written to a file
+    StringArrayProperty m_columnarTrees;
+    /// rows buffered per column before appending to the column files
+    IntegerProperty m_columnarClusterRows;
+    /// the flat column exports, by tree name: filled with the tree, in addition to it
+    std::map<std::string, ColumnarWriter*> m_export;
 
     //std::map<std::string, TTree *> m_inTree;
 
     /// collection of input TChains
-    std::map<std::string, TChain *> m_inChain;
+    std::map<std::string, TChain *>& m_inChain;
 
     /// collection of leaf addresses for items that we have to create an object for.
     /// This occurs in reprocessing, when not all AnaTup Tools are executed - so not all branches have a corresponding
     /// variable to TChain::SetBranchAddress for, so that we have a stable location to provide via the getItem call.
-    std::map<std::string, void*> m_itemPool;
+    /// By tree, then branch name: input trees may have branches of the same name
+    std::map<std::string, std::map<std::string, void*> >& m_itemPool;
+
+    /// an item bound with bindItemRef: tree and item name
+    typedef std::pair<std::string, std::string> ItemRefName;
+    /// the ItemRefs, by the address of their pointer
+    std::map<void**, ItemRefName> m_itemRefs;
+    /// the objects notified by the input chains when they open another file, by tree name
+    std::map<std::string, ChainNotify*> m_chainNotify;
+
+    /// key indexes of memory resident trees, by tree name
+    std::map<std::string, KeyIndex> m_keyIndex;
+
+    /// string items to write as a code and a dictionary: "tree:item", or "item" for all trees
+    StringArrayProperty m_dictionaryItems;
+    /// encoded items of the output trees, by tree name
+    std::map<std::string, std::vector<DictEncoder*> > m_dictEncoders;
+    /// encoded items of the input chains, by tree and item name
+    std::map<std::string, std::map<std::string, DictDecoder*> > m_dictDecoders;
+
+    /// integer items written as differences: "tree:item", or "item" for all trees
+    StringArrayProperty m_deltaItems;
+    /// rows between values of a delta encoded item written whole
+    IntegerProperty m_deltaBlockRows;
+    std::map<std::string, std::vector<DeltaEncoder*> > m_deltaEncoders;
+    std::map<std::string, std::map<std::string, DeltaDecoder*> > m_deltaDecoders;
+
+    /// trees that get zone maps
+    StringArrayProperty m_zoneMapTrees;
+    /// entries per zone, while the cluster size of the tree is not chosen
+    IntegerProperty m_zoneMapRows;
+    std::map<std::string, ZoneMap> m_zoneMaps;
+    /// "tree: cut" on the input, to skip the zones that cannot pass it
+    StringProperty m_inputCut;
+    std::string m_cutTree;
+    TupleCut m_cut;
+    InputZones m_inputZones;
+    /// number of rows sampled before the compression of each branch is chosen, 0 not to
+    IntegerProperty m_compressionTuneEvents;
+    /// settings tried, "ZLIB:6"
+    StringArrayProperty m_compressionCandidates;
+    std::vector<int> m_candidateSettings;
+    /// "size", "write" or "read"
+    StringProperty m_compressionObjective;
+    /// for the speed objectives, how much larger than the smallest a choice may be
+    DoubleProperty m_compressionSizeTolerance;
+    /// output of an earlier job, whose chosen settings are applied without sampling
+    StringProperty m_compressionTableFile;
+    std::map<std::string, std::map<std::string, int> > m_compressionTable;
+    std::map<std::string, CompressionTuning> m_compressionTuning;
+
+    /// local directory the output files are written to, then moved to their destination at the end
+    StringProperty m_stagingDirectory;
+    /// path of each staged file, by destination
+    std::map<std::string, std::string> m_stagedPath;
+
+    /// file recording the items and rows of the job, for replayTuple
+    StringProperty m_captureFile;
+    CaptureWriter* m_capture;
+    /// input file of each copied tree, when the capture last took the addresses of its input items
+    std::map<std::string, int> m_captureInput;
+
+    /// Unix socket of the consumer the StreamTrees are sent to
+    StringProperty m_streamSocket;
+    StringArrayProperty m_streamTrees;
+    /// rows per frame
+    IntegerProperty m_streamBatchRows;
+    StreamConnection* m_stream;
+
+    /// trees whose latest rows are published in shared memory
+    StringArrayProperty m_liveTrees;
+    /// rows kept in each segment
+    IntegerProperty m_liveRows;
+    /// start of the segment names, followed by _tree
+    StringProperty m_liveSegment;
+    std::map<std::string, LiveRowRing*> m_liveRings; ///< 0 until the first row
+
+    /// "tree: expression" selecting the rows of an output tree
+    StringArrayProperty m_treeFilters;
+    std::map<std::string, RowFilter> m_rowFilters;
+    /// "tree1=N,tree2=M": keep one row in N of those stored
+    StringProperty m_prescale;
+    std::map<std::string, long long> m_prescaleMap;
+    std::map<std::string, long long> m_prescaleCount;
+    /// "tree1=N": keep a uniform sample of N of the rows stored, filled at the end
+    StringProperty m_reservoir;
+    IntegerProperty m_reservoirSeed;
+    std::map<std::string, Reservoir> m_reservoirs;
+    std::mt19937_64 m_random;
+    /// jobinfo items: the number of rows each row kept stands for
+    std::map<std::string, double> m_sampleWeights;
+
+    /// local directory the next input files are copied to
+    StringProperty m_prefetchDirectory;
+    /// number of files copied ahead of the one being read
+    IntegerProperty m_prefetchFiles;
+    /// disk space the copies may take
+    IntegerProperty m_prefetchLimitMB;
+    InputPrefetcher* m_prefetcher;
+    /// the files of the input chains, as given
+    std::vector<std::string> m_prefetchOriginal;
+    /// files whose chain elements point at the local copy
+    std::vector<bool> m_prefetchSwapped;
+    /// file of the entry last read
+    int m_prefetchFile;
+
+    /// "tree: item1, item2": the items that identify an input entry, for findEntry
+    StringProperty m_inputKey;
+    /// file that keeps the index of the input by key, between jobs
+    StringProperty m_inputKeyCache;
+    std::string m_keyTree;
+    std::vector<std::string> m_keyItems;
+    /// sorted, empty until the first declareKey or findEntry on the input tree
+    std::vector<KeyEntry> m_keyEntries;
+    /// input entries to read, from findEntry and findEntries on the input tree: in entry order
+    /// from m_schedulePos, so that the chain reads each file once, forwards
+    std::vector<long long> m_schedule;
+    unsigned int m_schedulePos;
+    bool m_scheduled;
+
+    /// last input entry + 1, -1 for all
+    long long m_endingIndex;
+    /// no input entry left: the events are not stored
+    bool m_inputDone;
+    /// m_nextEvent is the next entry to read, chosen at the end of the previous event
+    bool m_entrySelected;
+    long long m_zonesSkipped, m_entriesSkipped;
 
     /// the flags, one per tree, for storing at the end of an event
     // assumes each TTree has a unique name
-    std::map<std::string, bool> m_storeTree;
+    std::map<std::string, bool>& m_storeTree;
 
     /// If reading an input tuple also, then this is next event
-    long long m_nextEvent;
+    long long& m_nextEvent;
 
     /// store number of events in the file
-    long long m_nevents;
+    long long& m_nevents;
 
     /// if set, store all ttrees 
-    bool m_storeAll;
+    bool& m_storeAll;
 
     int m_trials; /// total number of calls
     bool m_defaultStoreFlag;
     IntegerProperty m_autoSave; // passed to TTree::SetAutoSave.
 
+    /// uncompressed bytes of the first cluster (negative TTree::SetAutoFlush) for all trees; 0 for ROOT's default
+    IntegerProperty m_flushBytes;
+    /// per tree values, "tree1=bytes,tree2=bytes"
+    StringProperty m_treeFlushBytes;
+    std::map<std::string, long long> m_treeFlushBytesMap;
+
+    /// total basket memory, in MB, allowed for all trees written to files; 0 for no limit
+    IntegerProperty m_memoryBudget;
+    /// number of events between checks of the basket memory
+    IntegerProperty m_memoryCheckInterval;
+    /// largest basket memory seen for each tree written to a file
+    std::map<std::string, long long> m_peakBasketMemory;
+    /// per tree, the times its baskets were flushed to keep within the budget
+    std::map<std::string, int> m_earlyFlushes;
+    /// total basket memory just after the last redistribution
+    long long m_rebalancedMemory;
+
+    /// number of events between checkpoints, 0 for none
+    IntegerProperty m_checkpointInterval;
+    /// file for the checkpoint state record, default the output file name + ".checkpoint"
+    StringProperty m_checkpointFile;
+    /// if set, continue from the last checkpoint
+    BooleanProperty m_resume;
+
+    /// write and close the output files concurrently at the end of the job
+    BooleanProperty m_parallelFinalize;
+    /// print a summary of each tree written (TTree::Print) at the end of the job
+    BooleanProperty m_printTrees;
+    /// scan the jobinfo tree at the end of the job
+    BooleanProperty m_scanJobInfo;
+    /// number of event slots for concurrent mode, 0 for one event at a time through the incidents
+    IntegerProperty m_concurrentSlots;
+    /// in concurrent mode, write the rows in event order rather than as the slots finish
+    BooleanProperty m_orderedOutput;
+    /// per slot: variables registered with addItem, by tree then item name (not used for slot 0)
+    std::vector<std::map<std::string, std::map<std::string, const void*> > > m_slotItems;
+    /// per slot: input chains and their item buffers (slot 0 uses m_inChain and m_itemPool)
+    std::vector<std::map<std::string, TChain*> > m_slotChain;
+    std::vector<std::map<std::string, std::map<std::string, void*> > > m_slotPool;
+    /// per slot: store flags, the store all flag, and the current event
+    std::vector<std::map<std::string, bool> > m_slotStore;
+    std::vector<char> m_slotStoreAll;
+    std::vector<long long> m_slotEvent;
+    /// per slot: the trees the slot has stored rows in
+    std::vector<std::map<std::string, SlotTree> > m_slotTrees;
+    /// the trees written in concurrent mode
+    std::map<std::string, ConcurrentTree*> m_concurrentTrees;
+    /// guards the set up of the per slot structures
+    std::mutex m_slotMutex;
+    std::once_flag m_slotInputOnce;
+    /// submitted records, and the writer thread that takes them
+    SlotQueue m_slotQueue;
+    std::thread m_writer;
+    std::atomic<bool> m_stopWriter;
+    std::atomic<long long> m_submitted;
+    std::atomic<long long> m_written;
+    /// the writer waits on m_writerWake for a record or the stop, drainSlots on m_drained;
+    /// the queue keeps the records, the mutex only orders the waits and the notifications
+    std::mutex m_writerMutex;
+    std::condition_variable m_writerWake;
+    std::condition_variable m_drained;
+    /// for ordered output: the next event to write, and the records waiting for it
+    long long m_nextOrdered;
+    std::map<long long, SlotRecord*> m_reorder;
+    unsigned int m_maxReorder;
+
+    /// true if a checkpoint was found and is being resumed
+    bool m_resuming;
+    /// per tree entry counts from the checkpoint
+    std::map<std::string, long long> m_resumeEntries;
+    /// counters from the checkpoint, applied as they are registered
+    std::map<std::string, int> m_resumeCounters;
+    /// counters registered by clients with addCounter
+    std::map<std::string, int*> m_counters;
+
     /// keep track of how many events had non-finite values
-    int m_badEventCount;
+    long long& m_badEventCount;
     // assumes each leaf has a uniue name across all trees and files
-    std::map<std::string, int> m_badMap; ///< map of counts for individual values
+    std::map<std::string, int>& m_badMap; ///< map of counts for individual values
     BooleanProperty m_rejectIfBad; ///< set true to reject the tuple entry if bad values
 
     /// JO parameter to set the default buffer size for all TTrees
@@ -316,8 +1132,11 @@ int RootTupleSvc::m_meritVersion = 1;
 //         Implementation of RootTupleSvc methods
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 RootTupleSvc::RootTupleSvc(const std::string& name,ISvcLocator* svc)
-: Service(name,svc), m_nextEvent(0), m_nevents(0), m_trials(0), 
-  m_badEventCount(0)
+: Service(name,svc), m_inFileList(m_engine.options().inputFiles), m_fileCol(m_engine.files()),
+  m_tree(m_engine.trees()), m_inChain(m_engine.chains()), m_itemPool(m_engine.itemPool()),
+  m_storeTree(m_engine.storeFlags()), m_nextEvent(m_engine.nextEntry()), m_nevents(m_engine.inputEntries()),
+  m_storeAll(m_engine.storeAllFlag()), m_trials(0), m_resuming(false),
+  m_badEventCount(m_engine.badRows()), m_badMap(m_engine.badCounts())
 {
     // declare the properties and set defaults
     declareProperty("filename",  m_filename="RootTupleSvc.root");
@@ -333,6 +1152,18 @@ RootTupleSvc::RootTupleSvc(const std::string& name,ISvcLocator* svc)
     declareProperty("title", m_title="Glast tuple");
     declareProperty("defaultStoreFlag", m_defaultStoreFlag=false);
     declareProperty("AutoSave", m_autoSave=100000); // ROOT default is 10000000
+    declareProperty("FlushBytes", m_flushBytes=0);
+    declareProperty("TreeFlushBytes", m_treeFlushBytes="");
+    declareProperty("OutputMemoryBudget", m_memoryBudget=0); // MB
+    declareProperty("MemoryCheckInterval", m_memoryCheckInterval=100);
+    declareProperty("CheckpointInterval", m_checkpointInterval=0);
+    declareProperty("CheckpointFile", m_checkpointFile="");
+    declareProperty("Resume", m_resume=false);
+    declareProperty("ParallelFinalize", m_parallelFinalize=false);
+    declareProperty("PrintTrees", m_printTrees=false);
+    declareProperty("ScanJobInfo", m_scanJobInfo=false);
+    declareProperty("ConcurrentSlots", m_concurrentSlots=0);
+    declareProperty("OrderedOutput", m_orderedOutput=true);
     declareProperty("RejectIfBad", m_rejectIfBad=true); 
     declareProperty("JobInfoTreeName", m_jobInfoTreeName="jobinfo");
     declareProperty("JobInfo", m_jobInfo=""); // string, if present, will write out single TTree entry
@@ -344,6 +1175,45 @@ RootTupleSvc::RootTupleSvc(const std::string& name,ISvcLocator* svc)
 
     /// ADW
     declareProperty("TreeFriends", m_treeFriendsList=initList);
+
+    declareProperty("RNTupleTrees", m_rntupleTrees=initList);
+    declareProperty("ColumnarTrees", m_columnarTrees=initList);
+    declareProperty("ColumnarClusterRows", m_columnarClusterRows=10000);
+    declareProperty("DictionaryItems", m_dictionaryItems=initList);
+    declareProperty("DeltaItems", m_deltaItems=initList);
+    declareProperty("DeltaBlockRows", m_deltaBlockRows=1000);
+    declareProperty("ZoneMapTrees", m_zoneMapTrees=initList);
+    declareProperty("ZoneMapRows", m_zoneMapRows=10000);
+    declareProperty("InputCut", m_inputCut="");
+    declareProperty("EndingIndex", m_endingIndex=-1);
+    declareProperty("InputKey", m_inputKey="");
+    declareProperty("StagingDirectory", m_stagingDirectory="");
+    declareProperty("PrefetchDirectory", m_prefetchDirectory="");
+    declareProperty("TreeFilters", m_treeFilters);
+    declareProperty("CaptureFile", m_captureFile="");
+    declareProperty("StreamSocket", m_streamSocket="");
+    declareProperty("StreamTrees", m_streamTrees);
+    declareProperty("StreamBatchRows", m_streamBatchRows=1000);
+    declareProperty("LiveTrees", m_liveTrees);
+    declareProperty("LiveRows", m_liveRows=1000);
+    declareProperty("LiveSegment", m_liveSegment="");
+    declareProperty("Prescale", m_prescale="");
+    declareProperty("Reservoir", m_reservoir="");
+    declareProperty("ReservoirSeed", m_reservoirSeed=12345);
+    declareProperty("PrefetchFiles", m_prefetchFiles=2);
+    declareProperty("PrefetchLimitMB", m_prefetchLimitMB=10000);
+    declareProperty("CompressionTuneEvents", m_compressionTuneEvents=0);
+    std::vector<std::string> candidates;
+    candidates.push_back("ZLIB:1");
+    candidates.push_back("ZLIB:6");
+    candidates.push_back("LZMA:5");
+    candidates.push_back("LZ4:4");
+    candidates.push_back("ZSTD:5");
+    declareProperty("CompressionCandidates", m_compressionCandidates=candidates);
+    declareProperty("CompressionObjective", m_compressionObjective="size");
+    declareProperty("CompressionSizeTolerance", m_compressionSizeTolerance=1.5);
+    declareProperty("CompressionTable", m_compressionTableFile="");
+    declareProperty("InputKeyCache", m_inputKeyCache="");
 }
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 StatusCode RootTupleSvc::initialize () 
@@ -375,11 +1245,81 @@ StatusCode RootTupleSvc::initialize ()
 
     m_fileCol.clear();
     m_tree.clear();
+    m_sink.clear();
+    m_stream = 0;
+    m_capture = 0;
+    m_export.clear();
+    m_peakBasketMemory.clear();
+    m_earlyFlushes.clear();
+    m_rebalancedMemory = -1;
+    m_resumeEntries.clear();
+    m_resumeCounters.clear();
+    m_counters.clear();
     //m_inTree.clear();
     m_badMap.clear();
     m_inChain.clear();
     m_inFileList.clear();
     m_itemPool.clear();
+    m_itemRefs.clear();
+    m_chainNotify.clear();
+    m_keyIndex.clear();
+    m_dictEncoders.clear();
+    m_dictDecoders.clear();
+    m_deltaEncoders.clear();
+    m_deltaDecoders.clear();
+    m_zoneMaps.clear();
+    m_inputZones = InputZones();
+    m_inputDone = false;
+    m_entrySelected = false;
+    m_zonesSkipped = m_entriesSkipped = 0;
+
+    // the cut applies to the tree named before a colon, or the default tree
+    std::string cutError;
+    if (!m_cut.parse(treePrefix(m_inputCut.value(), m_treename.value(), m_cutTree), cutError)) {
+        log << MSG::ERROR << "InputCut \"" << m_inputCut.value() << "\": " << cutError << endreq;
+        return StatusCode::FAILURE;
+    }
+
+    m_prefetcher = 0;
+    m_prefetchOriginal.clear();
+    m_prefetchSwapped.clear();
+    m_prefetchFile = -1;
+
+    // compression tuning
+    m_compressionTuning.clear();
+    m_candidateSettings.clear();
+    for (unsigned int i = 0; i<m_compressionCandidates.value().size(); ++i) {
+        int settings = 0;
+        if (!parseCompression(m_compressionCandidates.value()[i], settings)) {
+            log << MSG::ERROR << "CompressionCandidates: " << m_compressionCandidates.value()[i]
+                << " is not ALGORITHM:level, with ZLIB, LZMA, LZ4 or ZSTD" << endreq;
+            return StatusCode::FAILURE;
+        }
+        m_candidateSettings.push_back(settings);
+    }
+    const std::string& objective = m_compressionObjective.value();
+    if (objective != "size" && objective != "write" && objective != "read") {
+        log << MSG::ERROR << "CompressionObjective must be size, write or read, not " << objective << endreq;
+        return StatusCode::FAILURE;
+    }
+    if (readCompressionTables(log).isFailure()) return StatusCode::FAILURE;
+
+    // the items of the input key
+    m_keyItems.clear();
+    m_keyEntries.clear();
+    m_schedule.clear();
+    m_scheduled = false;
+    m_schedulePos = 0;
+    std::string keyList = treePrefix(m_inputKey.value(), m_treename.value(), m_keyTree);
+    for (std::string::size_type start = 0, comma; !trimmed(keyList).empty() && start <= keyList.size(); start = comma+1) {
+        comma = keyList.find(',', start);
+        if (comma == std::string::npos) comma = keyList.size();
+        m_keyItems.push_back(trimmed(keyList.substr(start, comma-start)));
+    }
+    if (m_keyItems.size() > 2) {
+        log << MSG::ERROR << "InputKey \"" << m_inputKey.value() << "\": at most two items" << endreq;
+        return StatusCode::FAILURE;
+    }
 
     // Split here depending on whether we are reading an input ntuple
     // and augmenting its output
@@ -419,15 +1359,70 @@ StatusCode RootTupleSvc::initialize ()
         */
     }
 
-    // -- create primary output root file---
-    TFile *tf   = new TFile( m_filename.value().c_str(), "RECREATE");
-    if (!tf->IsOpen()) {
-        log << MSG::ERROR 
-            << "cannot open ROOT file: " << m_filename.value() << endreq;
-        delete tf;
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6,0,0)
+    // must be on before any thread other than this one uses ROOT, and before the files are opened
+    if (m_concurrentSlots > 0 || m_parallelFinalize) ROOT::EnableThreadSafety();
+#else
+    if (m_parallelFinalize) {
+        log << MSG::WARNING << "ParallelFinalize needs ROOT 6: files will be written one at a time" << endreq;
+        m_parallelFinalize = false;
+    }
+    if (m_concurrentSlots > 0) {
+        log << MSG::ERROR << "ConcurrentSlots needs ROOT 6" << endreq;
         return StatusCode::FAILURE;
     }
-    m_fileCol[m_filename.value()] = tf;
+#endif
+
+    // the trees, files, input chains and flags are the engine's: it takes the same settings
+    TupleEngineOptions& options = m_engine.options();
+    options.fileName = m_filename.value();
+    options.treeName = m_treename.value();
+    options.title = m_title.value();
+    options.autoSave = m_autoSave.value();
+    options.bufferSize = m_bufferSize;
+    options.defaultStore = m_defaultStoreFlag;
+    options.rejectIfBad = m_rejectIfBad.value();
+    options.includeBranches = m_includeBranchList.value();
+    options.excludeBranches = m_excludeBranchList.value();
+    m_engineLog.bind(msgSvc(), name());
+    m_engine.setLog(&m_engineLog);
+    // the rows filtered out or dropped by a prescale cost nothing more
+    m_engine.setSelect([this](const std::string& treeName, TTree* t) {
+        if (m_rowFilters.find(treeName) != m_rowFilters.end()) {
+            MsgStream log(msgSvc(), name());
+            if (!passesFilter(treeName, t, log)) return false;
+        }
+        return keepPrescaled(treeName);
+    });
+    m_engine.setFill([this](const std::string& treeName, TTree* t) {
+        if (t->GetCurrentFile() != 0)
+            t->GetCurrentFile()->cd();
+        else
+            gDirectory->cd(0);
+        storeRow(treeName, t);
+    });
+    // the files are opened where they are staged, and the trees given their sinks, encoders and decoders
+    m_engine.setOpen(std::bind(&RootTupleSvc::openOutput, this, std::placeholders::_1));
+    m_engine.setTree(std::bind(&RootTupleSvc::setupTree, this, std::placeholders::_1, std::placeholders::_2));
+
+    if (m_checkpointFile.value().empty()) m_checkpointFile = m_filename.value() + ".checkpoint";
+    m_resuming = false;
+    if (m_resume) {
+        m_resuming = readCheckpoint(log);
+        if (!m_resuming)
+            log << MSG::WARNING << "Resume requested, but no checkpoint "
+                << m_checkpointFile.value() << ": starting from the beginning" << endreq;
+    }
+
+    // a checkpoint is only useful where the files are
+    m_stagedPath.clear();
+    if (!m_stagingDirectory.value().empty() && (m_checkpointInterval > 0 || m_resume)) {
+        log << MSG::WARNING << "StagingDirectory is not used with checkpoints" << endreq;
+        m_stagingDirectory = "";
+    }
+
+    // -- create primary output root file---
+    if (m_engine.outputFile(m_filename.value()) == 0) return StatusCode::FAILURE;
 
     curdir->cd(); // restore previous directory
 
@@ -435,168 +1430,176 @@ StatusCode RootTupleSvc::initialize ()
 
     if (m_joMeritVersion != 0) setMeritVersion(m_joMeritVersion);
 
+    if (parseTreeValues("TreeFlushBytes", m_treeFlushBytes.value(), m_treeFlushBytesMap, log).isFailure())
+        return StatusCode::FAILURE;
+
+    // shared memory segments, created at the first row of each tree
+    m_liveRings.clear();
+#ifdef WIN32
+    if (m_liveTrees.value().size() > 0) {
+        log << MSG::ERROR << "LiveTrees: shared memory segments are not available on Windows" << endreq;
+        return StatusCode::FAILURE;
+    }
+#else
+    for (unsigned int i = 0; i<m_liveTrees.value().size(); ++i) m_liveRings[m_liveTrees.value()[i]] = 0;
+#endif
+
+    // selection of the rows: the items are looked up when the first row is stored
+    m_rowFilters.clear();
+    for (unsigned int i = 0; i<m_treeFilters.value().size(); ++i) {
+        std::string tree, error;
+        std::string expression = treePrefix(m_treeFilters.value()[i], m_treename.value(), tree);
+        RowFilter& filter = m_rowFilters[tree];
+        if (!filter.cut.empty()) {
+            log << MSG::ERROR << "TreeFilters: more than one expression for tree " << tree << endreq;
+            return StatusCode::FAILURE;
+        }
+        if (!filter.cut.parse(expression, error) || filter.cut.empty()) {
+            log << MSG::ERROR << "TreeFilters \"" << m_treeFilters.value()[i] << "\": "
+                << (error.empty() ? "no expression" : error) << endreq;
+            return StatusCode::FAILURE;
+        }
+    }
+
+    // sampling of the rows
+    std::map<std::string, long long> reservoirs;
+    if (parseTreeValues("Prescale", m_prescale.value(), m_prescaleMap, log).isFailure()
+        || parseTreeValues("Reservoir", m_reservoir.value(), reservoirs, log).isFailure())
+        return StatusCode::FAILURE;
+    m_prescaleCount.clear();
+    m_reservoirs.clear();
+    m_sampleWeights.clear();
+    for (std::map<std::string, long long>::const_iterator it = m_prescaleMap.begin(); it != m_prescaleMap.end(); ++it) {
+        if (it->second < 1) {
+            log << MSG::ERROR << "Prescale of " << it->first << " must be at least 1" << endreq;
+            return StatusCode::FAILURE;
+        }
+    }
+    for (std::map<std::string, long long>::const_iterator it = reservoirs.begin(); it != reservoirs.end(); ++it) {
+        m_reservoirs[it->first].size = it->second;
+        // a reservoir keeps rows as the client sees them, and an encoder works on the current row only
+        std::vector<std::string> encoded(m_dictionaryItems.value());
+        encoded.insert(encoded.end(), m_deltaItems.value().begin(), m_deltaItems.value().end());
+        for (unsigned int i = 0; i<encoded.size(); ++i) {
+            // an item without "tree:" is encoded in every tree
+            if (encoded[i].find(':') != std::string::npos
+                && encoded[i].compare(0, it->first.size()+1, it->first+":") != 0) continue;
+            log << MSG::ERROR << "Reservoir tree " << it->first << " cannot have encoded items: "
+                << encoded[i] << endreq;
+            return StatusCode::FAILURE;
+        }
+    }
+    m_random.seed(m_reservoirSeed.value());
+
+    if (m_concurrentSlots > 0) {
+        if (m_checkpointInterval > 0) {
+            log << MSG::WARNING << "Checkpoints are not supported in concurrent mode: "
+                << "CheckpointInterval ignored" << endreq;
+            m_checkpointInterval = 0;
+        }
+        // the slots read any file at any time: there is no next file to copy
+        if (!m_prefetchDirectory.value().empty()) {
+            log << MSG::WARNING << "PrefetchDirectory is not used in concurrent mode" << endreq;
+            m_prefetchDirectory = "";
+        }
+        // the encoders keep the previous row, and the slots' rows come in any order
+        if (m_dictionaryItems.value().size() > 0 || m_deltaItems.value().size() > 0) {
+            log << MSG::ERROR << "DictionaryItems and DeltaItems are not available in concurrent mode" << endreq;
+            return StatusCode::FAILURE;
+        }
+        unsigned int slots = m_concurrentSlots.value();
+        m_slotItems.assign(slots, std::map<std::string, std::map<std::string, const void*> >());
+        m_slotChain.assign(slots, std::map<std::string, TChain*>());
+        m_slotPool.assign(slots, std::map<std::string, std::map<std::string, void*> >());
+        m_slotStore.assign(slots, std::map<std::string, bool>());
+        m_slotStoreAll.assign(slots, m_defaultStoreFlag);
+        m_slotEvent.assign(slots, 0);
+        m_slotTrees.assign(slots, std::map<std::string, SlotTree>());
+        m_stopWriter = false;
+        m_submitted = 0;
+        m_written = 0;
+        m_nextOrdered = m_nextEvent;
+        m_maxReorder = 0;
+        m_writer = std::thread(&RootTupleSvc::writeSlots, this);
+        log << MSG::INFO << "Concurrent mode with " << slots << " event slots, "
+            << (m_orderedOutput ? "ordered" : "unordered") << " output" << endreq;
+    }
+
+    if (m_rntupleTrees.value().size() > 0 && !RNTupleSink::available()) {
+        log << MSG::WARNING << "RNTupleTrees specified, but this ROOT version does not "
+            << "support RNTuple: writing them as TTrees" << endreq;
+    }
+
+    if (!m_captureFile.value().empty()) {
+        if (m_concurrentSlots > 0) {
+            log << MSG::ERROR << "CaptureFile is not available with ConcurrentSlots" << endreq;
+            return StatusCode::FAILURE;
+        }
+        m_capture = new CaptureWriter;
+        if (!m_capture->open(m_captureFile.value())) {
+            log << MSG::ERROR << "Cannot create capture file " << m_captureFile.value() << endreq;
+            return StatusCode::FAILURE;
+        }
+        log << MSG::INFO << "Capturing the items and rows to " << m_captureFile.value() << endreq;
+    }
+
+    // the consumer must be listening already: the rows would have nowhere else to go
+#ifdef WIN32
+    if (m_streamTrees.value().size() > 0) {
+        log << MSG::ERROR << "StreamTrees: Unix sockets are not available on Windows" << endreq;
+        return StatusCode::FAILURE;
+    }
+#else
+    if (m_streamTrees.value().size() > 0) {
+        m_stream = new StreamConnection;
+        if (!m_stream->open(m_streamSocket.value())) {
+            log << MSG::ERROR << "StreamTrees: cannot connect to \"" << m_streamSocket.value() << "\": "
+                << m_stream->error() << endreq;
+            delete m_stream;
+            m_stream = 0;
+            return StatusCode::FAILURE;
+        }
+        log << MSG::INFO << "Streaming to " << m_streamSocket.value() << endreq;
+    }
+#endif
+
     return status;
 }
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 
-bool RootTupleSvc::getTree(std::string& treeName, TTree*& t)
+void RootTupleSvc::setupTree(const std::string& treeName, TFile* tf)
 {
     MsgStream log(msgSvc(),name());
-    TDirectory* saveDir = gDirectory; // will prevent unauthorized use
-
-    bool inFileFlag = false;
-    t = 0;
+    TTree* t = m_tree[treeName];
 
-    // Are we reading from input ntuple(s)?
-    if (m_inFileList.size() > 0)
+    // Are we reading from input ntuple(s)? The engine made the chain for this tree
+    std::map<std::string, TChain*>::const_iterator chainit = m_inChain.find(treeName);
+    if (chainit != m_inChain.end())
     {
-        inFileFlag = true;
-        std::map<std::string, TChain*>::iterator inIter = m_inChain.find(treeName);
-        // Must self-initialize the first time around
-        if (inIter == m_inChain.end()) {
-            
-            // Assuming all input ROOT files have the same tree name,
-            // we could adjust the code to pick out the TTree and provide 
-            // its name in the TChain::Add call
-            TChain *ch = new TChain(treeName.c_str());
-            // Add all files in the JO list
-            std::vector<std::string>::const_iterator fileListItr;
-            for (fileListItr = m_inFileList.begin();
-                 fileListItr != m_inFileList.end();
-                 fileListItr++ ) {
-                std::string fileName = *fileListItr;
-                facilities::Util::expandEnvVar(&fileName);
-                    int stat = ch->Add(fileName.c_str());
-                    if (stat <= 0)
-                        log << MSG::WARNING << "Failed to TChain::Add " 
-                            << fileName << " return code: " << stat << endreq;
-                    else
-                        log << MSG::INFO << "Added File: " << fileName << endreq;
-
-            }  // end for loop TChain initialized
-
-            // add new TChain to the map
-            m_inChain[treeName] = ch;
-            // call GetEntries to load the headers of the TFiles
-            m_nevents = ch->GetEntries();
-            log << MSG::INFO << "Number of events in input files = " 
-                << m_nevents << " StartingIndex: " << m_nextEvent << endreq;
-            if ((m_nextEvent > m_nevents-1) || (m_nextEvent < 0)) {
-                log << MSG::WARNING << "StartingIndex invalid, resetting "
-                    << m_nextEvent << " to zero" << endreq;
-                m_nextEvent = 0;
-            }
-            int numbytes = ch->GetEntry(m_nextEvent);
-            if (numbytes <= 0) 
-                log << MSG::WARNING << "Unable to read tuple event, "
-                    << m_nextEvent << endreq;
-            // Here is our chance to set up branch pointers for the whole 
-            // input TChain, so that no elements are missed
-            TObjArray *brCol = ch->GetListOfBranches();
-            int numBranches = brCol->GetEntries();
-            int iBranch;
-            for (iBranch=0;iBranch<numBranches;iBranch++) {
-                std::string branchName(((TBranch*)(brCol->At(iBranch)))->GetName());
-                std::string leafName = branchName;
-                size_t index = leafName.find("[");
-                if(index!=std::string::npos) leafName = leafName.substr(0,index); 
-                log << MSG::DEBUG << "setting branch: " << branchName
-                    << " and Leaf: " << leafName << endreq;
-                TLeaf *leaf = ((TBranch*)brCol->At(iBranch))->GetLeaf(leafName.c_str());
-                if (!leaf) {
-                    log << MSG::WARNING << "Leaf: " << leafName << " not found" << endreq;
-                    continue;
-                }
-                std::string type_name = leaf->GetTypeName();
-                if (type_name == "Float_t")
-                {
-                    m_itemPool[branchName] = new Float_t[leaf->GetNdata()];
-                }
-                else if (type_name == "Int_t")
-                {
-                    m_itemPool[branchName]= new Int_t[leaf->GetNdata()];
-                }
-                else if (type_name == "UInt_t")
-                {
-                    m_itemPool[branchName]= new UInt_t[leaf->GetNdata()];
-                }        
-                else if (type_name == "ULong64_t")
-                {
-                    m_itemPool[branchName]= new ULong64_t[leaf->GetNdata()];
-                }
-                else if (type_name == "Double_t")
-                {
-                    m_itemPool[branchName] = new Double_t[leaf->GetNdata()];
-                }
-                else if (type_name == "Char_t")
-                {
-                    m_itemPool[branchName] = new Char_t[leaf->GetNdata()];
-                }
-                else
-                {
-                    log << MSG::WARNING << "type: " << type_name <<" not found" << endreq;
-                }
-                ch->SetBranchAddress(branchName.c_str(), m_itemPool[branchName]);
-            } // end for branch list
-
-            if (m_includeBranchList.value().size() > 0) {
-                ch->SetBranchStatus("*",0);
-                std::vector<std::string>::const_iterator includeListItr;
-                for (includeListItr = m_includeBranchList.value().begin();
-                 includeListItr != m_includeBranchList.value().end();
-                 includeListItr++ ) {
- 
-                     std::string branchName = *includeListItr;
-                     unsigned int foundFlag;
-                     ch->SetBranchStatus(branchName.c_str(),1,&foundFlag);
-                     if (foundFlag == 0)
-                         log << MSG::WARNING << "Did not find any matching"
-                             << " branch names for: " << branchName << endreq;
-                     else
-                         log << MSG::INFO << "Set BranchStatus to 1 (on) for"                                << " branch " << branchName << endreq;
-
-                 }
+        if (m_prefetcher == 0 && !m_prefetchDirectory.value().empty()) startPrefetch(chainit->second, log);
+        setupDecoders(treeName, chainit->second, log);
+
+        // encoded items are copied as strings, encoded again with a dictionary of this output
+        std::map<std::string, std::map<std::string, DictDecoder*> >::iterator decit = m_dictDecoders.find(treeName);
+        if (decit != m_dictDecoders.end()) {
+            for (std::map<std::string, DictDecoder*>::iterator it = decit->second.begin(); it != decit->second.end(); ++it) {
+                DictEncoder* d = new DictEncoder(it->first, &it->second->text[0]);
+                m_dictEncoders[treeName].push_back(d);
+                t->GetBranch(it->first.c_str())->SetAddress(&d->code);
             }
-
-            if (m_excludeBranchList.value().size() > 0) {
-                ch->SetBranchStatus("*",1);
-                std::vector<std::string>::const_iterator excludeListItr;
-                for (excludeListItr = m_excludeBranchList.value().begin();
-                 excludeListItr != m_excludeBranchList.value().end();
-                 excludeListItr++ ) {
- 
-                     std::string branchName = *excludeListItr;
-                     unsigned int foundFlag;
-                     ch->SetBranchStatus(branchName.c_str(),0,&foundFlag);
-                     if (foundFlag == 0)
-                         log << MSG::WARNING << "Did not find any matching"
-                             << " branch names for: " << branchName << endreq;
-                     else
-                         log << MSG::INFO << "Set BranchStatus to 0 (off) for"                                << " branch " << branchName << endreq;
-
-                 }
+        }
+        // and so are the delta encoded ones, from their decoded values
+        std::map<std::string, std::map<std::string, DeltaDecoder*> >::iterator deltait = m_deltaDecoders.find(treeName);
+        if (deltait != m_deltaDecoders.end()) {
+            for (std::map<std::string, DeltaDecoder*>::iterator it = deltait->second.begin(); it != deltait->second.end(); ++it) {
+                DeltaEncoder* d = new DeltaEncoder(it->first, it->second->type, it->second->value, std::max(1, m_deltaBlockRows.value()));
+                m_deltaEncoders[treeName].push_back(d);
+                t->GetBranch(it->first.c_str())->SetAddress(d->buffer());
             }
-
-            inIter = m_inChain.find(treeName);
-
-        } // end if for initialization first time 
-
-        // copy the current tree to allow access to its branches
-        // zero is the number of entries to copy - so we're just 
-        // copying the TTree structure not contents
-        t=inIter->second->CloneTree(0);
-
+        }
     } // end check for input files
 
-    // Back to regular situation, where we are setting up an output file
-    if (t == 0)
-    {
-        t = new TTree(treeName.c_str(), m_title.value().c_str());
-        t->SetAutoSave(m_autoSave);
-    }
-
-    saveDir->cd();
-    return inFileFlag;
+    attachTree(treeName, tf, log);
 }
 
 bool RootTupleSvc::makeFriends()
@@ -639,122 +1642,738 @@ bool RootTupleSvc::makeFriends()
 }
 
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-
-StatusCode RootTupleSvc::addAnyItem(const std::string & tupleName, 
-                                    const std::string& itemName0, 
-                                    const std::string type,  
-                                    const void* pval, 
-                                    const std::string& fileName,
-                                    bool write)
+void RootTupleSvc::attachTree(const std::string& treeName, TFile* tf, MsgStream& log)
 {
-    MsgStream log(msgSvc(),name());
-    //bool inFileFlag = false;
-    StatusCode status = StatusCode::SUCCESS;
-    std::string treename=tupleName.empty()? m_treename.value() : tupleName;
-    std::string rootFileName = fileName.empty() ? m_filename.value() : fileName;
-    TDirectory *saveDir = gDirectory;
-
-    // If this tuple already exists, and was set up to be memory resident
-    // For now print error message and return without setting up new entry
-    if (m_tree.find(treename) != m_tree.end() && write &&
-                                 m_tree[treename]->GetCurrentFile() == 0) {
-        log << MSG::WARNING << "Ntuple " << treename << " was previously set"
-              << " up as a memory resident tree.  Skipping this new entry"
-              <<  itemName0 << endreq;
-        return StatusCode::FAILURE;
+    const std::vector<std::string>& columnarTrees = m_columnarTrees.value();
+    if (std::find(columnarTrees.begin(), columnarTrees.end(), treeName) != columnarTrees.end() ||
+        std::find(columnarTrees.begin(), columnarTrees.end(), "*") != columnarTrees.end()) {
+        std::string dir = std::string(tf->GetName()) + ".columns/" + treeName;
+        m_export[treeName] = new ColumnarWriter(dir, treeName, m_tree[treeName], m_columnarClusterRows);
+        log << MSG::INFO << "Exporting tree \"" << treeName << "\" as columns in " << dir << endreq;
     }
 
-    // Check if this tuple already exists and we set it up to be written to
-    // a file..now client is requesting it be memory resident.  For now
-    // return with error message
-    if (m_tree.find(treename) != m_tree.end() && !write &&
-                                 m_tree[treename]->GetCurrentFile() != 0) {
-        log << MSG::WARNING << "Ntuple " << treename << " was previously set"
-            << " up to be written to file.  now requesting it to be memory "
-            << " resident.  Skipping this new entry " << itemName0 << endreq;
-        return StatusCode::FAILURE;
+#ifndef WIN32
+    const std::vector<std::string>& streamTrees = m_streamTrees.value();
+    if (m_stream != 0 && std::find(streamTrees.begin(), streamTrees.end(), treeName) != streamTrees.end()) {
+        m_tree[treeName]->SetDirectory(0);
+        m_sink[treeName] = new StreamSink(m_stream, treeName, m_tree[treeName], m_streamBatchRows.value());
+        log << MSG::INFO << "Streaming tree \"" << treeName << "\" instead of writing it to "
+            << tf->GetName() << endreq;
+        return;
     }
+#endif
 
-    if (write) {
-        // Check list of output files
-        if ( m_fileCol.find(rootFileName) == m_fileCol.end()) {
-            // create a new TFile
-            TFile *tf = new TFile(rootFileName.c_str(), "RECREATE");
-            if (!tf->IsOpen()) {
-                log << MSG::ERROR 
-                    << "cannot open ROOT file: " << rootFileName << endreq;
-                delete tf;
-                saveDir->cd();
-                return StatusCode::FAILURE;
+    const std::vector<std::string>& rntupleTrees = m_rntupleTrees.value();
+    if (RNTupleSink::available() &&
+        std::find(rntupleTrees.begin(), rntupleTrees.end(), treeName) != rntupleTrees.end()) {
+        // the TTree only holds the branches: keep it out of the file
+        m_tree[treeName]->SetDirectory(0);
+        m_sink[treeName] = new RNTupleSink(treeName, m_tree[treeName], tf);
+        log << MSG::INFO << "Creating new RNTuple \"" << treeName << "\"" 
+            << " in file: " << tf->GetName() << endreq;
+        return;
+    }
+    if (m_resuming) {
+        // look for the tree in the file, not at the one just made
+        TTree* fresh = m_tree[treeName];
+        fresh->SetDirectory(0);
+        TTree* old = resumeTree(treeName, tf, log);
+        if (old != 0) {
+            // keep any addresses set up by setupTree for the input branches
+            std::vector<TupleColumn> cols;
+            describeColumns(fresh, cols);
+            for (unsigned int i = 0; i<cols.size(); ++i) {
+                if (cols[i].address != 0) old->SetBranchAddress(cols[i].name.c_str(), cols[i].address);
             }
-            m_fileCol[rootFileName] = tf;
-            getTree(treename,m_tree[treename]);
-            m_tree[treename]->SetDirectory(tf);
-            log << MSG::INFO << "Creating new tree \"" << treename << "\"" 
-                << " in file: " << rootFileName << endreq;
-        } else if( m_tree.find(treename)==m_tree.end()){
-            // create new tree
-            m_fileCol[rootFileName]->cd();
-            getTree(treename,m_tree[treename]);
-            m_tree[treename]->SetDirectory(m_fileCol[rootFileName]);
-            log << MSG::INFO << "Creating new tree \"" << treename << "\"" 
-                << " in file: " << rootFileName << endreq;
-        }
-    } else  { // memory resident
-        gDirectory->cd(0);
-        if (m_tree.find(treename) == m_tree.end())
-        {
-            m_tree[treename] = new TTree(treename.c_str(), m_title.value().c_str());
-            m_tree[treename]->SetDirectory(0);
+            delete fresh;
+            m_tree[treeName] = old;
+            resumeEncoders(treeName, log);
         }
     }
+    m_tree[treeName]->SetDirectory(tf);
+    const std::vector<std::string>& zoneTrees = m_zoneMapTrees.value();
+    if (std::find(zoneTrees.begin(), zoneTrees.end(), treeName) != zoneTrees.end()) m_zoneMaps[treeName];
+    if ((m_compressionTuneEvents > 0 && !m_candidateSettings.empty())
+        || m_compressionTable.find(treeName) != m_compressionTable.end()) m_compressionTuning[treeName];
+    log << MSG::INFO << "Creating new tree \"" << treeName << "\"" 
+        << " in file: " << tf->GetName() << endreq;
+    // with checkpoints, the tree header on the file is only saved at a checkpoint
+    if (m_checkpointInterval > 0) m_tree[treeName]->SetAutoSave(0);
+
+    // a byte count for the first cluster: ROOT then fixes the cluster size to the entries it held
+    std::map<std::string, long long>::const_iterator bytesit = m_treeFlushBytesMap.find(treeName);
+    long long flushBytes = bytesit != m_treeFlushBytesMap.end() ? bytesit->second : m_flushBytes.value();
+    if (flushBytes > 0) m_tree[treeName]->SetAutoFlush(-flushBytes);
+}
 
-    // Searches list of branches, and returns NULL if itemName0 is not found
-    TBranch* thisBranch = m_tree[treename]->GetBranch(itemName0.c_str());
-    if(thisBranch==NULL) {
-        log << MSG::DEBUG << "Creating new branch in AddAny for " << itemName0
-            << endreq;
-        // This is a new branch
-        m_tree[treename]->Branch(itemName0.c_str(), 
-            const_cast<void*>(pval), (itemName0+type).c_str(),m_bufferSize);
+bool RootTupleSvc::isMemoryResident(const std::string& treeName)
+{
+    return m_tree[treeName]->GetCurrentFile() == 0 && m_sink.find(treeName) == m_sink.end();
+}
+
+void RootTupleSvc::fillTree(const std::string& treeName, TTree* t)
+{
+#ifndef WIN32
+    // as the client sees the row, before any encoding
+    std::map<std::string, LiveRowRing*>::iterator liveit = m_liveRings.find(treeName);
+    if (liveit != m_liveRings.end()) {
+        if (liveit->second == 0) liveit->second = openLive(treeName, t);
+        liveit->second->publish();
+    }
+#endif
+    std::map<std::string, std::vector<DictEncoder*> >::iterator dictit = m_dictEncoders.find(treeName);
+    if (dictit != m_dictEncoders.end()) {
+        for (unsigned int i = 0; i<dictit->second.size(); ++i) dictit->second[i]->encode();
+    }
+    std::map<std::string, std::vector<DeltaEncoder*> >::iterator deltait = m_deltaEncoders.find(treeName);
+    if (deltait != m_deltaEncoders.end()) {
+        for (unsigned int i = 0; i<deltait->second.size(); ++i) deltait->second[i]->encode();
+    }
+    std::map<std::string, TupleSink*>::iterator sinkit = m_sink.find(treeName);
+    if (sinkit != m_sink.end()) {
+        sinkit->second->fill();
     } else {
-        log << MSG::DEBUG << "Found branch in TTree: " << itemName0
-            << endreq;
-        thisBranch->SetAddress(const_cast<void*>(pval));
+        t->Fill();
+        std::map<std::string, ZoneMap>::iterator zoneit = m_zoneMaps.find(treeName);
+        if (zoneit != m_zoneMaps.end()) {
+            ZoneMap& zones = zoneit->second;
+            if (!zones.described) {
+                // numeric items, as the client sees them: not the encoded ones
+                std::vector<TupleColumn> cols;
+                describeColumns(t, cols);
+                for (unsigned int i = 0; i<cols.size(); ++i) {
+                    if (cols[i].type != 0 && cols[i].type != 'C' && findEncoder(treeName, cols[i].name) == 0
+                        && findDeltaEncoder(treeName, cols[i].name) == 0) zones.cols.push_back(cols[i]);
+                }
+                zones.described = true;
+            }
+            zones.add();
+            // a zone per cluster, once its size is chosen
+            long long zoneRows = t->GetAutoFlush() > 0 ? t->GetAutoFlush() : m_zoneMapRows.value();
+            if (zones.rows >= zoneRows) zones.close(t->GetEntries());
+        }
+        std::map<std::string, CompressionTuning>::iterator compit = m_compressionTuning.find(treeName);
+        if (compit != m_compressionTuning.end() && !compit->second.done)
+            sampleCompression(treeName, t, compit->second);
     }
-    saveDir->cd();
-    return status;
+    std::map<std::string, ColumnarWriter*>::iterator exportit = m_export.find(treeName);
+    if (exportit != m_export.end()) exportit->second->fill();
+    std::map<std::string, KeyIndex>::iterator indexit = m_keyIndex.find(treeName);
+    if (indexit != m_keyIndex.end())
+        indexit->second.entries[currentKey(indexit->second.keys)] = t->GetEntries()-1;
 }
-/* about these codes:
-
-            - C : a character string terminated by the 0 character
-            - B : an 8 bit signed integer (Char_t)
-            - b : an 8 bit unsigned integer (UChar_t)
-            - S : a 16 bit signed integer (Short_t)
-            - s : a 16 bit unsigned integer (UShort_t)
-            - I : a 32 bit signed integer (Int_t)
-            - i : a 32 bit unsigned integer (UInt_t)
-            - F : a 32 bit floating point (Float_t)
-            - D : a 64 bit floating point (Double_t)
-            - L : a 64 bit signed integer (Long64_t)
-            - l : a 64 bit unsigned integer (ULong64_t)
-            - O : a boolean (Bool_t)
-
-  */
 
-//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-StatusCode RootTupleSvc::addItem(const std::string & tupleName, 
-                                 const std::string& itemName, 
-                                 const double* pval, 
-                                 const std::string& fileName, bool write)
+void RootTupleSvc::checkMemoryBudget()
 {
-    return addAnyItem(tupleName, itemName, "/D", (void*)pval, fileName, write);
+    // only trees in files count: memory resident trees must keep all their baskets
+    long long total = 0;
+    long long totBytes = 0;
+    std::map<std::string, long long> memory;
+    for( std::map<std::string, TTree*>::iterator it = m_tree.begin(); it!=m_tree.end(); ++it){
+        TTree* t = it->second;
+        if (t->GetCurrentFile() == 0) continue;
+        long long m = basketMemory(t);
+        memory[it->first] = m;
+        total += m;
+        totBytes += t->GetTotBytes();
+        if (m > m_peakBasketMemory[it->first]) m_peakBasketMemory[it->first] = m;
+    }
 
+    long long budget = (long long)m_memoryBudget.value()*1024*1024;
+    if (budget <= 0 || totBytes <= 0) return;
+    // rebalance when above the budget, or when well below it so that busy trees can grow,
+    // and only if the memory has moved by a tenth of the budget since the last time:
+    // otherwise the sizes could not do better
+    if (total <= budget && 2*total >= budget) return;
+    if (m_rebalancedMemory >= 0 && std::abs(total-m_rebalancedMemory) < budget/10) return;
 
-}
-//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-StatusCode RootTupleSvc::addItem(const std::string & tupleName, 
-                                 const std::string& itemName, 
+    MsgStream log(msgSvc(),name());
+    log << MSG::DEBUG << "Basket memory " << total << " bytes, budget " << budget
+        << ": redistributing basket sizes" << endreq;
+    TDirectory *saveDir = gDirectory;
+    m_rebalancedMemory = 0;
+    for( std::map<std::string, long long>::const_iterator it = memory.begin(); it!=memory.end(); ++it){
+        TTree* t = m_tree[it->first];
+        if (t->GetEntries() == 0) { m_rebalancedMemory += it->second; continue; }
+        // each tree gets a share of the budget in proportion to the uncompressed data it has written;
+        // the new sizes apply as the current baskets are written, at the tree's own AutoFlush
+        long long share = (long long)(double(budget)*t->GetTotBytes()/totBytes);
+        t->GetCurrentFile()->cd();
+        t->OptimizeBaskets(share, 1.1, "");
+        long long m = basketMemory(t);
+        m_rebalancedMemory += m;
+        log << MSG::DEBUG << "    " << it->first << ": " << t->GetTotBytes() << " bytes written, "
+            << t->GetZipBytes() << " compressed, baskets " << it->second << " -> " << m << " bytes" << endreq;
+    }
+
+    // the new sizes only apply to the next baskets: still above the budget, write the baskets of the
+    // largest trees now. FlushBaskets ends a cluster with every branch of the tree at the same entry
+    if (m_rebalancedMemory > budget) {
+        std::vector<std::pair<long long, std::string> > largest;
+        for( std::map<std::string, long long>::const_iterator it = memory.begin(); it!=memory.end(); ++it)
+            largest.push_back(std::make_pair(basketMemory(m_tree[it->first]), it->first));
+        std::sort(largest.rbegin(), largest.rend());
+        for( unsigned int i = 0; i<largest.size() && m_rebalancedMemory > budget; ++i){
+            TTree* t = m_tree[largest[i].second];
+            if (t->GetEntries() == 0) continue;
+            t->GetCurrentFile()->cd();
+            t->FlushBaskets();
+            long long m = basketMemory(t);
+            m_rebalancedMemory += m - largest[i].first;
+            ++m_earlyFlushes[largest[i].second];
+            log << MSG::DEBUG << "    " << largest[i].second << ": flushed, baskets " << largest[i].first
+                << " -> " << m << " bytes" << endreq;
+        }
+    }
+    saveDir->cd();
+}
+
+void RootTupleSvc::writeCheckpoint()
+{
+    MsgStream log(msgSvc(),name());
+    TDirectory *saveDir = gDirectory;
+
+    // the dictionaries as they are now, which a resumed job continues
+    for (std::map<std::string, std::vector<DictEncoder*> >::iterator it = m_dictEncoders.begin();
+         it != m_dictEncoders.end(); ++it) {
+        TFile* f = m_tree[it->first]->GetCurrentFile();
+        if (f == 0) continue;
+        for (unsigned int i = 0; i<it->second.size(); ++i) writeDictionary(it->first, *it->second[i], f);
+    }
+    for (std::map<std::string, std::vector<DeltaEncoder*> >::iterator it = m_deltaEncoders.begin();
+         it != m_deltaEncoders.end(); ++it) {
+        TFile* f = m_tree[it->first]->GetCurrentFile();
+        if (f == 0) continue;
+        for (unsigned int i = 0; i<it->second.size(); ++i) writeDeltaBlock(it->first, *it->second[i], f);
+    }
+
+    // flush all baskets, ending the current clusters, and save the tree headers:
+    // a file recovered after a crash then ends at this checkpoint
+    for( std::map<std::string, TTree*>::iterator it = m_tree.begin(); it!=m_tree.end(); ++it){
+        TTree* t = it->second;
+        if (t->GetCurrentFile() == 0) continue;
+        t->GetCurrentFile()->cd();
+        t->AutoSave("SaveSelf;FlushBaskets");
+    }
+    saveDir->cd();
+
+    // write the state to a new file, then rename it over the old one
+    std::string file = m_checkpointFile.value();
+    std::string temp = file + ".tmp";
+    {
+        std::ofstream out(temp.c_str());
+        out << "nextEvent " << m_nextEvent << "\n"
+            << "trials " << m_trials << "\n"
+            << "badEventCount " << m_badEventCount << "\n";
+        for( std::map<std::string, TTree*>::iterator it = m_tree.begin(); it!=m_tree.end(); ++it){
+            if (it->second->GetCurrentFile() == 0) continue;
+            out << "entries " << it->first << " " << it->second->GetEntries() << "\n";
+        }
+        for( std::map<std::string,int>::const_iterator it=m_badMap.begin(); it !=m_badMap.end(); ++it)
+            out << "bad " << it->first << " " << it->second << "\n";
+        for( std::map<std::string,int*>::const_iterator it=m_counters.begin(); it !=m_counters.end(); ++it)
+            out << "counter " << it->first << " " << *(it->second) << "\n";
+        out.flush();
+        if (!out) {
+            log << MSG::ERROR << "Failed to write checkpoint " << temp << endreq;
+            return;
+        }
+    }
+    if (gSystem->Rename(temp.c_str(), file.c_str()) != 0) {
+        log << MSG::ERROR << "Failed to rename checkpoint " << temp << " to " << file << endreq;
+        return;
+    }
+    log << MSG::DEBUG << "Checkpoint after " << m_trials << " events, next input event "
+        << m_nextEvent << endreq;
+}
+
+bool RootTupleSvc::readCheckpoint(MsgStream& log)
+{
+    std::ifstream in(m_checkpointFile.value().c_str());
+    if (!in) return false;
+    std::string key;
+    while (in >> key) {
+        if (key == "nextEvent") in >> m_nextEvent;
+        else if (key == "trials") in >> m_trials;
+        else if (key == "badEventCount") in >> m_badEventCount;
+        else if (key == "entries") { std::string n; long long v; in >> n >> v; m_resumeEntries[n] = v; }
+        else if (key == "bad")     { std::string n; int v; in >> n >> v; m_badMap[n] = v; }
+        else if (key == "counter") { std::string n; int v; in >> n >> v; m_resumeCounters[n] = v; }
+        else {
+            log << MSG::WARNING << "Unknown entry " << key << " in checkpoint "
+                << m_checkpointFile.value() << endreq;
+            std::getline(in, key);
+        }
+    }
+    log << MSG::INFO << "Resuming from checkpoint " << m_checkpointFile.value() << " after "
+        << m_trials << " events, next input event " << m_nextEvent << endreq;
+    return true;
+}
+
+TTree* RootTupleSvc::resumeTree(const std::string& treeName, TFile* tf, MsgStream& log)
+{
+    TDirectory *saveDir = gDirectory;
+    tf->cd();
+    TTree* t = dynamic_cast<TTree*>(tf->Get(treeName.c_str()));
+    if (t == 0) {
+        saveDir->cd();
+        return 0;
+    }
+    long long n = 0;
+    std::map<std::string, long long>::const_iterator nit = m_resumeEntries.find(treeName);
+    if (nit != m_resumeEntries.end()) n = nit->second;
+
+    if (t->GetEntries() > n) {
+        // entries written after the checkpoint: copy the first n to a new tree, and drop the old one
+        log << MSG::INFO << "Truncating tree " << treeName << " from " << t->GetEntries()
+            << " to " << n << " entries, by copying them" << endreq;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        TTree* copy = t->CloneTree(0);
+        copy->SetName((treeName+"__resume").c_str());
+        copy->CopyEntries(t, n);
+        tf->Delete((treeName+";*").c_str()); // also deletes t
+        copy->SetName(treeName.c_str());
+        t = copy;
+        log << MSG::INFO << "Copied " << n << " entries of tree " << treeName << " in "
+            << secondsSince(start) << " s" << endreq;
+    } else if (t->GetEntries() < n) {
+        log << MSG::WARNING << "Tree " << treeName << " has " << t->GetEntries()
+            << " entries, fewer than the " << n << " of the checkpoint" << endreq;
+    }
+    log << MSG::INFO << "Resuming tree " << treeName << " with " << t->GetEntries()
+        << " entries" << endreq;
+    saveDir->cd();
+    return t;
+}
+
+const char* RootTupleSvc::outputMode(const std::string& fileName)
+{
+    return (m_resuming && fileExists(fileName)) ? "UPDATE" : "RECREATE";
+}
+
+StatusCode RootTupleSvc::parseTreeValues(const std::string& property, const std::string& value,
+                                         std::map<std::string, long long>& values, MsgStream& log)
+{
+    values.clear();
+    if (value.empty()) return StatusCode::SUCCESS;
+    std::map<std::string, std::string> parmap;
+    facilities::Util::keyValueTokenize(value, ",", parmap);
+    for (std::map<std::string, std::string>::const_iterator mip = parmap.begin(); mip!=parmap.end(); ++mip) {
+        try {
+            values[mip->first] = facilities::Util::stringToInt(mip->second);
+        } catch(...) {
+            log << MSG::ERROR << property << ": bad value for tree " << mip->first
+                << ", check string is in form: tree1=30000000,tree2=1000000" << endreq;
+            return StatusCode::FAILURE;
+        }
+    }
+    return StatusCode::SUCCESS;
+}
+
+void RootTupleSvc::captureRow(const std::string& treeName, bool saved)
+{
+    // a copy of an input tree has the input items the client did not add, at addresses that
+    // change with the input file
+    std::map<std::string, TChain*>::const_iterator chainit = m_inChain.find(treeName);
+    if (chainit != m_inChain.end()) {
+        int number = chainit->second->GetTreeNumber();
+        std::map<std::string, int>::iterator numberit = m_captureInput.find(treeName);
+        if (numberit == m_captureInput.end() || numberit->second != number) {
+            std::vector<TupleColumn> cols;
+            describeColumns(m_tree[treeName], cols);
+            for (unsigned int i = 0; i<cols.size(); ++i) {
+                if (cols[i].type != 0 && cols[i].address != 0)
+                    m_capture->copied(treeName, cols[i].name, std::string("/") + cols[i].type, cols[i].address);
+            }
+            m_captureInput[treeName] = number;
+        }
+    }
+    if (saved) m_capture->saved(treeName);
+    else m_capture->row(treeName);
+}
+
+#ifndef WIN32
+LiveRowRing* RootTupleSvc::openLive(const std::string& treeName, TTree* t)
+{
+    MsgStream log(msgSvc(), name());
+    std::vector<TupleColumn> all, cols;
+    describeColumns(t, all);
+    for (unsigned int i = 0; i<all.size(); ++i) {
+        if (all[i].type != 0 && findEncoder(treeName, all[i].name) == 0
+            && findDeltaEncoder(treeName, all[i].name) == 0) cols.push_back(all[i]);
+    }
+    std::string segment = m_liveSegment.value().empty()
+        ? "/RootTupleSvc_" + std::to_string(gSystem->GetPid()) : m_liveSegment.value();
+    if (segment[0] != '/') segment = "/" + segment;
+    LiveRowRing* ring = new LiveRowRing(segment + "_" + treeName, treeName, cols, m_liveRows.value());
+    if (ring->ok()) {
+        log << MSG::INFO << "Publishing the latest " << m_liveRows.value() << " rows of " << treeName
+            << " (" << cols.size() << " items) in shared memory " << ring->segment()
+            << ", " << ring->bytes() << " bytes" << endreq;
+    } else {
+        log << MSG::WARNING << "Cannot create shared memory " << ring->segment() << " for " << treeName
+            << ": " << ring->error() << endreq;
+    }
+    return ring;
+}
+#endif
+
+bool RootTupleSvc::passesFilter(const std::string& treeName, TTree* t, MsgStream& log)
+{
+    std::map<std::string, RowFilter>::iterator fit = m_rowFilters.find(treeName);
+    if (fit == m_rowFilters.end()) return true;
+    RowFilter& filter = fit->second;
+    if (!filter.bound) {
+        filter.bound = true;
+        std::vector<TupleColumn> cols;
+        describeColumns(t, cols);
+        const std::vector<std::string>& names = filter.cut.names();
+        for (unsigned int i = 0; i<names.size(); ++i) {
+            unsigned int c = 0;
+            while (c<cols.size() && cols[c].leafName != names[i]) ++c;
+            // a dictionary encoded item is a string
+            if (c == cols.size() || cols[c].length != 1 || cols[c].type == 'C' || findEncoder(treeName, cols[c].name) != 0) {
+                log << MSG::ERROR << "TreeFilters: " << names[i] << " is not a numeric item of " << treeName
+                    << ", all its rows are kept" << endreq;
+                filter.cols.clear();
+                break;
+            }
+            filter.cols.push_back(cols[c]);
+            filter.deltas.push_back(findDeltaEncoder(treeName, cols[c].name));
+        }
+        filter.values.resize(filter.cols.size());
+    }
+    // unresolved: keep everything
+    if (filter.cols.size() != filter.cut.names().size()) return true;
+    for (unsigned int i = 0; i<filter.cols.size(); ++i) {
+        // where the row is now: the client variable or a staging row, not yet encoded
+        TupleColumn& col = filter.cols[i];
+        col.address = filter.deltas[i] != 0 ? const_cast<void*>(filter.deltas[i]->source) : col.branch->GetAddress();
+        filter.values[i] = columnValue(col);
+    }
+    bool pass = filter.cut.matches(filter.values);
+    ++(pass ? filter.passed : filter.failed);
+    return pass;
+}
+
+bool RootTupleSvc::keepPrescaled(const std::string& treeName)
+{
+    std::map<std::string, long long>::const_iterator it = m_prescaleMap.find(treeName);
+    if (it == m_prescaleMap.end()) return true;
+    // the first row, then every Nth
+    return (m_prescaleCount[treeName]++ % it->second) == 0;
+}
+
+void RootTupleSvc::storeRow(const std::string& treeName, TTree* t)
+{
+    std::map<std::string, Reservoir>::iterator resit = m_reservoirs.find(treeName);
+    if (resit == m_reservoirs.end()) {
+        fillTree(treeName, t);
+        return;
+    }
+    // algorithm R: row i replaces a random one of the sample with probability size/(i+1)
+    Reservoir& r = resit->second;
+    long long i = r.candidates++;
+    long long slot = i < r.size ? i : std::uniform_int_distribution<long long>(0, i)(m_random);
+    if (slot >= r.size) return;
+    if (r.cols.empty()) describeColumns(t, r.cols);
+    std::vector<const void*> addresses;
+    for (unsigned int c = 0; c<r.cols.size(); ++c) addresses.push_back(r.cols[c].branch->GetAddress());
+    std::string row;
+    packRow(r.cols, addresses, row);
+    if (i < r.size) r.rows.push_back(std::make_pair(i, row));
+    else r.rows[slot] = std::make_pair(i, row);
+}
+
+void RootTupleSvc::fillReservoirs(MsgStream& log)
+{
+    TDirectory* saveDir = gDirectory;
+    for (std::map<std::string, Reservoir>::iterator it = m_reservoirs.begin(); it != m_reservoirs.end(); ++it) {
+        Reservoir& r = it->second;
+        std::map<std::string, TTree*>::iterator treeit = m_tree.find(it->first);
+        if (treeit == m_tree.end() || r.rows.empty()) continue;
+        TTree* t = treeit->second;
+        if (t->GetCurrentFile() != 0) t->GetCurrentFile()->cd();
+        else gDirectory->cd(0);
+        // in the order they were stored
+        std::sort(r.rows.begin(), r.rows.end());
+        RowStaging staging(t);
+        staging.attach();
+        bindOutputs(it->first);
+        for (unsigned int i = 0; i<r.rows.size(); ++i) {
+            // a longer string moves its buffer
+            if (staging.unpack(r.rows[i].second.data())) bindOutputs(it->first);
+            fillTree(it->first, t);
+        }
+        staging.detach();
+        bindOutputs(it->first);
+        log << MSG::INFO << "Reservoir of " << it->first << ": " << r.rows.size() << " rows of "
+            << r.candidates << endreq;
+    }
+    saveDir->cd();
+}
+
+void RootTupleSvc::addSelectionInfo()
+{
+    for (std::map<std::string, long long>::const_iterator it = m_prescaleMap.begin(); it != m_prescaleMap.end(); ++it) {
+        if (m_tree.find(it->first) == m_tree.end()) continue;
+        m_sampleWeights[it->first + "_weight"] = it->second;
+    }
+    for (std::map<std::string, Reservoir>::const_iterator it = m_reservoirs.begin(); it != m_reservoirs.end(); ++it) {
+        if (it->second.rows.empty()) continue;
+        // a prescale before the reservoir multiplies
+        double& weight = m_sampleWeights[it->first + "_weight"];
+        weight = (weight > 0 ? weight : 1) * double(it->second.candidates)/it->second.rows.size();
+    }
+    for (std::map<std::string, double>::iterator it = m_sampleWeights.begin(); it != m_sampleWeights.end(); ++it)
+        addItem(m_jobInfoTreeName, it->first, &it->second);
+    for (std::map<std::string, RowFilter>::const_iterator it = m_rowFilters.begin(); it != m_rowFilters.end(); ++it) {
+        if (!it->second.bound) continue;
+        addItem(m_jobInfoTreeName, it->first + "_filterPassed", &it->second.passed);
+        addItem(m_jobInfoTreeName, it->first + "_filterFailed", &it->second.failed);
+    }
+    m_reservoirs.clear();
+}
+
+void RootTupleSvc::startPrefetch(TChain* ch, MsgStream& log)
+{
+    std::string dir(m_prefetchDirectory.value());
+    facilities::Util::expandEnvVar(&dir);
+    TObjArray* files = ch->GetListOfFiles();
+    for (int i = 0; i<files->GetEntries(); ++i)
+        m_prefetchOriginal.push_back(((TChainElement*)files->At(i))->GetTitle());
+    m_prefetchSwapped.assign(m_prefetchOriginal.size(), false);
+    m_prefetcher = new InputPrefetcher(dir, m_prefetchOriginal, std::max(1, m_prefetchFiles.value()),
+                                       (long long)m_prefetchLimitMB.value()*1024*1024);
+    log << MSG::INFO << "Copying the next " << m_prefetchFiles.value() << " input files to " << dir
+        << ", at most " << m_prefetchLimitMB.value() << " MB" << endreq;
+}
+
+void RootTupleSvc::usePrefetched(long long entry)
+{
+    if (m_prefetcher == 0) return;
+    TChain* first = m_inChain.begin()->second;
+    Long64_t* offsets = first->GetTreeOffset();
+    int n = first->GetNtrees();
+    int file = std::upper_bound(offsets, offsets+n, entry) - offsets - 1;
+    if (file == m_prefetchFile || file < 0) return;
+    m_prefetchFile = file;
+
+    // chains that point at a copy about to be removed go back to the file itself.
+    // An open file keeps being read: the chain opens files by name only when it moves to them
+    for (unsigned int i = 0; i<m_prefetchSwapped.size(); ++i) {
+        if (!m_prefetchSwapped[i] || ((int)i >= file && (int)i <= file + m_prefetchFiles)) continue;
+        for (std::map<std::string, TChain*>::iterator it = m_inChain.begin(); it != m_inChain.end(); ++it)
+            ((TChainElement*)it->second->GetListOfFiles()->At(i))->SetTitle(m_prefetchOriginal[i].c_str());
+        m_prefetchSwapped[i] = false;
+    }
+    m_prefetcher->setCurrent(file);
+    std::string local = m_prefetcher->localPath(file);
+    if (local.empty() || m_prefetchSwapped[file]) return;
+    for (std::map<std::string, TChain*>::iterator it = m_inChain.begin(); it != m_inChain.end(); ++it) {
+        // the chains of the other trees are made from the same list
+        TObjArray* files = it->second->GetListOfFiles();
+        if (file < files->GetEntries()) ((TChainElement*)files->At(file))->SetTitle(local.c_str());
+    }
+    m_prefetchSwapped[file] = true;
+}
+
+void RootTupleSvc::stopPrefetch(MsgStream& log)
+{
+    if (m_prefetcher == 0) return;
+    log << MSG::INFO << "Prefetched " << m_prefetcher->copied() << " input files, "
+        << m_prefetcher->copiedBytes()/(1024*1024) << " MB in " << m_prefetcher->copySeconds() << " s";
+    if (m_prefetcher->failed() > 0) log << "; " << m_prefetcher->failed() << " read where they are";
+    log << endreq;
+    // the copies are removed: the chains must not open them again
+    for (unsigned int i = 0; i<m_prefetchSwapped.size(); ++i) {
+        if (!m_prefetchSwapped[i]) continue;
+        for (std::map<std::string, TChain*>::iterator it = m_inChain.begin(); it != m_inChain.end(); ++it)
+            ((TChainElement*)it->second->GetListOfFiles()->At(i))->SetTitle(m_prefetchOriginal[i].c_str());
+    }
+    delete m_prefetcher;
+    m_prefetcher = 0;
+}
+
+TFile* RootTupleSvc::openOutput(const std::string& fileName)
+{
+    if (m_stagingDirectory.value().empty()) return new TFile(fileName.c_str(), outputMode(fileName));
+    std::string dir(m_stagingDirectory.value());
+    facilities::Util::expandEnvVar(&dir);
+    // jobs may share the directory, and files of this job may have the same name
+    std::string staged = dir + "/" + std::to_string(gSystem->GetPid()) + "_"
+        + std::to_string(m_stagedPath.size()) + "_" + gSystem->BaseName(fileName.c_str());
+    m_stagedPath[fileName] = staged;
+    MsgStream log(msgSvc(),name());
+    log << MSG::INFO << "Output file " << fileName << " staged as " << staged << endreq;
+    return new TFile(staged.c_str(), "RECREATE");
+}
+
+long long RootTupleSvc::treeEntries(const std::string& treeName, TTree* t)
+{
+    std::map<std::string, TupleSink*>::iterator sinkit = m_sink.find(treeName);
+    if (sinkit != m_sink.end()) return sinkit->second->entries();
+    return t->GetEntries();
+}
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+StatusCode RootTupleSvc::addAnyItem(const std::string & tupleName, 
+                                    const std::string& itemName0, 
+                                    const std::string type,  
+                                    const void* pval, 
+                                    const std::string& fileName,
+                                    bool write)
+{
+    MsgStream log(msgSvc(),name());
+    //bool inFileFlag = false;
+    StatusCode status = StatusCode::SUCCESS;
+    std::string treename=tupleName.empty()? m_treename.value() : tupleName;
+    std::string rootFileName = fileName.empty() ? m_filename.value() : fileName;
+
+    // the other slots only say where they keep the items of slot 0
+    if (m_concurrentSlots > 0 && t_currentSlot > 0)
+        return addSlotItem(t_currentSlot, treename, itemName0, pval);
+
+    TDirectory *saveDir = gDirectory;
+
+    // If this tuple already exists, and was set up to be memory resident
+    // For now print error message and return without setting up new entry
+    if (m_tree.find(treename) != m_tree.end() && write &&
+                                 isMemoryResident(treename)) {
+        log << MSG::WARNING << "Ntuple " << treename << " was previously set"
+              << " up as a memory resident tree.  Skipping this new entry"
+              <<  itemName0 << endreq;
+        return StatusCode::FAILURE;
+    }
+
+    // Check if this tuple already exists and we set it up to be written to
+    // a file..now client is requesting it be memory resident.  For now
+    // return with error message
+    if (m_tree.find(treename) != m_tree.end() && !write &&
+                                 !isMemoryResident(treename)) {
+        log << MSG::WARNING << "Ntuple " << treename << " was previously set"
+            << " up to be written to file.  now requesting it to be memory "
+            << " resident.  Skipping this new entry " << itemName0 << endreq;
+        return StatusCode::FAILURE;
+    }
+
+    // the engine makes the tree the first time, opening its file and calling setupTree,
+    // or keeps it in memory
+    TTree* tree = m_engine.itemTree(treename, rootFileName, write);
+    if (tree == 0) {
+        saveDir->cd();
+        return StatusCode::FAILURE;
+    }
+
+    // the decoders are those of slot 0, reading its own entries
+    if (m_concurrentSlots > 0 && (m_dictDecoders.find(treename) != m_dictDecoders.end()
+                                  || m_deltaDecoders.find(treename) != m_deltaDecoders.end())) {
+        log << MSG::ERROR << "Input tree " << treename << " has encoded items, "
+            << "which cannot be read in concurrent mode" << endreq;
+        saveDir->cd();
+        return StatusCode::FAILURE;
+    }
+
+    // the branch, and where it takes its values: the client variable, or its encoder
+    std::string branchType = type;
+    const void* branchAddress = pval;
+    bool setBranch = true;
+    // Searches list of branches, and returns NULL if itemName0 is not found
+    TBranch* thisBranch = tree->GetBranch(itemName0.c_str());
+    if(thisBranch==NULL) {
+        log << MSG::DEBUG << "Creating new branch in AddAny for " << itemName0
+            << endreq;
+        // This is a new branch
+        bool encode = write && m_concurrentSlots == 0;
+        if (encode && type == "/C" && listedItem(m_dictionaryItems.value(), treename, itemName0)) {
+            // the branch holds the code of the string, set when the row is stored
+            DictEncoder* d = new DictEncoder(itemName0, static_cast<const char*>(pval));
+            m_dictEncoders[treename].push_back(d);
+            branchType = "/I";
+            branchAddress = &d->code;
+        } else if (encode && (type == "/I" || type == "/i" || type == "/l")
+                   && listedItem(m_deltaItems.value(), treename, itemName0)) {
+            // the branch holds the difference to the previous row, set when the row is stored
+            DeltaEncoder* d = new DeltaEncoder(itemName0, type[1], pval, std::max(1, m_deltaBlockRows.value()));
+            m_deltaEncoders[treename].push_back(d);
+            branchAddress = d->buffer();
+        }
+    } else {
+        log << MSG::DEBUG << "Found branch in TTree: " << itemName0
+            << endreq;
+        DictEncoder* d = findEncoder(treename, itemName0);
+        DeltaEncoder* delta = findDeltaEncoder(treename, itemName0);
+        TLeaf* leaf = thisBranch->GetLeaf(itemName0.c_str());
+        std::string leafType = leaf != 0 ? leaf->GetTypeName() : "";
+        if (d == 0 && delta == 0 && m_resuming && write && m_concurrentSlots == 0 && type == "/C"
+            && leafType == "Int_t" && listedItem(m_dictionaryItems.value(), treename, itemName0)) {
+            // a tree resumed from its file: the branch holds codes, continued from the checkpoint
+            d = new DictEncoder(itemName0, static_cast<const char*>(pval));
+            m_dictEncoders[treename].push_back(d);
+            resumeEncoder(treename, *d, log);
+            branchType = "/I";
+            branchAddress = &d->code;
+        } else if (d == 0 && delta == 0 && m_resuming && write && m_concurrentSlots == 0
+                   && (type == "/I" || type == "/i" || type == "/l") && columnTypeCode(leafType) == type[1]
+                   && listedItem(m_deltaItems.value(), treename, itemName0)) {
+            // and this one differences, continued from the last row kept
+            delta = new DeltaEncoder(itemName0, type[1], pval, std::max(1, m_deltaBlockRows.value()));
+            m_deltaEncoders[treename].push_back(delta);
+            resumeEncoder(treename, *delta, log);
+        }
+        if (d != 0) d->source = static_cast<const char*>(pval);
+        else if (delta != 0) delta->source = pval;
+        // an encoded branch keeps its address, unless its encoder was just resumed
+        setBranch = (d == 0 && delta == 0) || branchAddress != pval;
+    }
+    if (setBranch && !m_engine.addItem(treename, itemName0, branchType, branchAddress, rootFileName, write)) {
+        log << MSG::ERROR << "Cannot add item " << itemName0 << " to " << treename << endreq;
+        saveDir->cd();
+        return StatusCode::FAILURE;
+    }
+    // and the items encoded in every tree, or copied from an encoded input
+    if (m_reservoirs.find(treename) != m_reservoirs.end()
+        && (m_dictEncoders.find(treename) != m_dictEncoders.end() || m_deltaEncoders.find(treename) != m_deltaEncoders.end())) {
+        log << MSG::ERROR << "Reservoir tree " << treename << " cannot have encoded items "
+            << "(DictionaryItems, DeltaItems or an encoded input)" << endreq;
+        saveDir->cd();
+        return StatusCode::FAILURE;
+    }
+    if (m_capture != 0) m_capture->item(treename, itemName0, type, pval, rootFileName, write);
+    saveDir->cd();
+    return status;
+}
+/* about these codes:
+
+            - C : a character string terminated by the 0 character
+            - B : an 8 bit signed integer (Char_t)
+            - b : an 8 bit unsigned integer (UChar_t)
+            - S : a 16 bit signed integer (Short_t)
+            - s : a 16 bit unsigned integer (UShort_t)
+            - I : a 32 bit signed integer (Int_t)
+            - i : a 32 bit unsigned integer (UInt_t)
+            - F : a 32 bit floating point (Float_t)
+            - D : a 64 bit floating point (Double_t)
+            - L : a 64 bit signed integer (Long64_t)
+            - l : a 64 bit unsigned integer (ULong64_t)
+            - O : a boolean (Bool_t)
+
+  */
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+StatusCode RootTupleSvc::addItem(const std::string & tupleName, 
+                                 const std::string& itemName, 
+                                 const double* pval, 
+                                 const std::string& fileName, bool write)
+{
+    return addAnyItem(tupleName, itemName, "/D", (void*)pval, fileName, write);
+
+
+}
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+StatusCode RootTupleSvc::addItem(const std::string & tupleName, 
+                                 const std::string& itemName, 
                                  const float* pval, 
                                  const std::string& fileName, bool write)
 {
@@ -801,6 +2420,9 @@ void RootTupleSvc::handle(const Incident &inc)
     //   will take in response to a particular event.  Currently, we handle
     //   BeginEvent and EndEvent events.
 
+    // in concurrent mode, events are delimited by beginSlotEvent and endSlotEvent instead
+    if (m_concurrentSlots > 0) return;
+
     if(inc.type()=="BeginEvent") beginEvent();
     if(inc.type()=="EndEvent") endEvent();
 }
@@ -808,30 +2430,27 @@ void RootTupleSvc::handle(const Incident &inc)
 void RootTupleSvc::beginEvent()
 {
     TDirectory *saveDir = gDirectory;
-    /// If we have an input ntuple then read the branches...
-    for(std::map<std::string, TChain*>::iterator inIter = m_inChain.begin(); inIter != m_inChain.end(); inIter++)
-    {
-        MsgStream log(msgSvc(),name());
-        std::string treeName = inIter->first;
-        //inIter->second->LoadTree(m_nextEvent);
-        log << MSG::DEBUG << "event: " << m_nextEvent << " TreeNum: "
-            << inIter->second->GetTreeNumber() << endreq;
 
-        
-        int numBytes = inIter->second->GetEntry(m_nextEvent++);
-        if (numBytes <= 0){
-            MsgStream log(msgSvc(),name());
-            log << MSG::ERROR << "Failed to load event " << m_nextEvent-1
-                << " from the input chain, terminating job" << endreq;
-            exit(1);
+    // with a cut or an end on the input, the job stops when no entry is left. The entry is
+    // normally chosen at the end of the previous event, which stops the run before this one
+    if (selectiveInput()) {
+        MsgStream log(msgSvc(),name());
+        if (m_inputDone || (!m_entrySelected && !skipToSelected(log))) {
+            if (!m_inputDone) stopInput(log);
+            storeRowFlag(false);
+            saveDir->cd();
+            return;
         }
-
     }
-
-    /// Assume that we will NOT write out the row
-    storeRowFlag(m_defaultStoreFlag);
-    for(std::map<std::string, bool>::iterator it=m_storeTree.begin(); it!=m_storeTree.end(); ++it){
-        it->second=false;
+    m_entrySelected = false;
+    usePrefetched(m_nextEvent);
+    /// If we have an input ntuple then read the branches, and assume that we will NOT write out the row
+    long long entry = m_nextEvent;
+    if (!m_engine.beginEvent(std::bind(&RootTupleSvc::decodeInputs, this, std::placeholders::_1, std::placeholders::_2))) {
+        MsgStream log(msgSvc(),name());
+        log << MSG::ERROR << "Failed to load event " << entry
+            << " from the input chain, terminating job" << endreq;
+        exit(1);
     }
 
     saveDir->cd();
@@ -840,61 +2459,43 @@ void RootTupleSvc::beginEvent()
 StatusCode RootTupleSvc::endEvent()
     // must be called at the end of an event to update, allow pause
 {         
-    MsgStream log(msgSvc(),name());
     StatusCode sc = SUCCESS;
     TDirectory *saveDir = gDirectory;
 
     ++m_trials;
-    for( std::map<std::string, TTree*>::iterator it = m_tree.begin();
-         it!=m_tree.end(); ++it){
-        if( m_storeAll || m_storeTree[it->first]  ) {
-            TTree* t = it->second;
-            if (t->GetCurrentFile() != 0)
-                t->GetCurrentFile()->cd();
-            else
-                gDirectory->cd(0);
-            sc = checkForNAN(t, log);
-            // check the tuple for non-finite entries, do not fill the tuple if found (unless overriden)
-            if( sc.isFailure() ){ 
-                m_badEventCount++; 
-                if (!m_rejectIfBad) t->Fill();
-            }else{
-                t->Fill();
-            }
-            m_storeTree[it->first]=false;
+    // the event that stopped the run has no input
+    if (m_inputDone) {
+        saveDir->cd();
+        return sc;
+    }
+    if (m_capture != 0) {
+        // what the client asked for, before anything decides otherwise
+        m_capture->beginEvent();
+        for (std::map<std::string, TTree*>::const_iterator it = m_tree.begin(); it != m_tree.end(); ++it) {
+            if (m_storeAll || m_storeTree[it->first]) captureRow(it->first, false);
         }
+        m_capture->endEvent();
+    }
+    // the engine fills the flagged trees, through the filters and prescales set up in initialize
+    if (m_engine.endEvent() > 0) sc = StatusCode::FAILURE;
+
+    if (m_memoryCheckInterval > 0 && (m_trials % m_memoryCheckInterval) == 0) checkMemoryBudget();
+    if (m_checkpointInterval > 0 && (m_trials % m_checkpointInterval) == 0) writeCheckpoint();
+
+    // the next entry, now: without one, no event runs on the input variables of this one
+    if (selectiveInput()) {
+        MsgStream log(msgSvc(),name());
+        m_entrySelected = skipToSelected(log);
+        if (!m_entrySelected) stopInput(log);
     }
         
     saveDir->cd();
     return sc;
 
 }
-StatusCode RootTupleSvc::checkForNAN( TTree* t, MsgStream& log)
+StatusCode RootTupleSvc::checkForNAN( TTree* t, MsgStream& )
 {
-    TDirectory *saveDir = gDirectory;
-
-    if (t->GetCurrentFile() != 0)
-        t->GetCurrentFile()->cd();
-   
-    TObjArray* ta = t->GetListOfBranches();
-    StatusCode sc = SUCCESS;
-
-    // now iterate.
-    int entries = ta->GetEntries();
-    for( int i = 0; i<entries; ++i) { // should try a TIter
-        TBranch * b = (TBranch*)(*ta)[i];
-        TLeaf* leaf = (TLeaf*)(*b->GetListOfLeaves())[0]; 
-        double val = leaf->GetValue();
-        log << MSG::DEBUG << leaf->GetName() << " val: " << val << endreq;
-        // HMK Unused? void* valpointer = leaf->GetValuePointer();
-        if( ! isFinite(val) ){
-            log << MSG::DEBUG  << "Tuple item " << leaf->GetName() << " is not finite!" << endreq;
-            m_badMap[leaf->GetName()]++;
-            sc = StatusCode::FAILURE;
-        }
-    }
-    saveDir->cd();
-    return sc;
+    return m_engine.checkFinite(t) ? StatusCode::SUCCESS : StatusCode::FAILURE;
 }
 
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -915,6 +2516,20 @@ StatusCode RootTupleSvc::finalize ()
     // open the message log
     MsgStream log( msgSvc(), name() );
 
+    stopSlots(log);
+    stopPrefetch(log);
+
+    // clients must not be called back after this
+    for (std::map<std::string, ChainNotify*>::iterator it = m_chainNotify.begin(); it != m_chainNotify.end(); ++it) {
+        m_inChain[it->first]->SetNotify(0);
+        delete it->second;
+    }
+    m_chainNotify.clear();
+    m_itemRefs.clear();
+
+    fillReservoirs(log);
+    addSelectionInfo();
+
     // -- set up job info TTree if requested to add values, or the tree exists already
 
     TTree * jobinfotree(0);
@@ -942,19 +2557,25 @@ StatusCode RootTupleSvc::finalize ()
         }
         // process this row
         saveRow(m_jobInfoTreeName); 
-        log << MSG::INFO << "jobinfo scan: "<< endreq;
-        if( jobinfotree!=0) jobinfotree->Scan();
+        if( jobinfotree!=0 && m_scanJobInfo) {
+            log << MSG::INFO << "jobinfo scan: "<< endreq;
+            jobinfotree->Scan();
+        }
     }
 
     for( std::map<std::string, TTree*>::iterator it = m_tree.begin(); it!=m_tree.end(); ++it){
         TTree* t = it->second; 
         if (t->GetCurrentFile() != 0)
             t->GetCurrentFile()->cd();
-        if( m_storeTree[it->first] ) t->Fill(); // In case the algorithm did an entry during its finalize
+        if( m_storeTree[it->first] ) fillTree(it->first, t); // In case the algorithm did an entry during its finalize
 
-        if( t->GetEntries() ==0 ) {
+        std::map<std::string, TupleSink*>::iterator sinkit = m_sink.find(it->first);
+        if( treeEntries(it->first, t) ==0 ) {
 
             log << MSG::INFO << "No entries added to the TTree \"" << it->first <<"\" : not writing it" << endreq;
+        } else if (sinkit != m_sink.end()) {
+            log << MSG::INFO << "Writing the " << sinkit->second->type() << " \"" << it->first 
+                << "\" with " << sinkit->second->entries() << " rows (" << m_trials << " total events)"<< endreq;
         } else if (t->GetCurrentFile() == 0) {
             log << MSG::INFO << "Memory Resident TTree " << it->first << endreq;
 
@@ -962,13 +2583,30 @@ StatusCode RootTupleSvc::finalize ()
             log << MSG::INFO << "Writing the TTree \"" << it->first<< "\" in file "<< t->GetCurrentFile()->GetName() //m_filename.value() 
                 << " with " 
                 << t->GetEntries() << " rows (" << m_trials << " total events)"<< endreq;
-            log << MSG::DEBUG;
-            if( log.isActive() ){
+            long long clusterEntries = t->GetAutoFlush();
+            if (clusterEntries > 0) {
+                log << MSG::INFO << "    clusters of " << clusterEntries << " entries: "
+                    << (t->GetEntries()+clusterEntries-1)/clusterEntries << " clusters" << endreq;
+            } else {
+                log << MSG::INFO << "    AutoFlush " << clusterEntries << endreq;
+            }
+            if( m_printTrees ){
                 t->Print(); // make a summary (too bad ROOT doesn't allow you to specify a stream
             }
-            log << endreq;
         }
     }
+    if (!m_peakBasketMemory.empty()) {
+        log << MSG::INFO << "Peak basket memory and early flushes per tree:\n";
+        if( log.isActive()) {
+            for( std::map<std::string,long long>::const_iterator it=m_peakBasketMemory.begin(); it !=m_peakBasketMemory.end(); ++it){
+                log.stream() << "\t\t\t"<< std::setw(20) << std::left << it->first 
+                    << std::setw(12)<<  std::right << it->second
+                    << std::setw(8) << m_earlyFlushes[it->first] << std::endl;
+            }
+        }
+        log << endreq;
+    }
+
     if (m_badEventCount>0){
         log << MSG::WARNING << "==================================================================" << endreq;
         log << MSG::WARNING << "Found " << m_badEventCount << " bad events: table of bad values follows\n" ;
@@ -993,31 +2631,139 @@ StatusCode RootTupleSvc::finalize ()
         }            
     }
 
-    for( std::map<std::string, TFile*>::iterator it = m_fileCol.begin(); it!=m_fileCol.end(); ++it){
-        TFile* f = it->second; 
-        if ((!f) || (!f->IsOpen())) {
-            log << MSG::WARNING << "ROOT File: " << f->GetName() 
-                << " is not open - skipping write" << endreq;
-        } else {
-            f->cd();
-            f->Write(0,TObject::kOverwrite);
-            f->Close();
-        }
-        if (f) {
-            delete f;
-            f=0;
-        }
+    writeZoneMaps(log);
+    writeCompressionTables(log);
+    writeEncodings(log);
+    if (m_zonesSkipped > 0)
+        log << MSG::INFO << "InputCut: skipped " << m_zonesSkipped << " zones, "
+            << m_entriesSkipped << " input entries" << endreq;
+
+    // the sinks must finish before their files are written
+    for( std::map<std::string, TupleSink*>::iterator it = m_sink.begin(); it!=m_sink.end(); ++it){
+        it->second->close();
+        delete it->second;
     }
-    return StatusCode::SUCCESS;
+    m_sink.clear();
+    if (m_capture != 0) {
+        m_capture->close();
+        if (m_capture->ok())
+            log << MSG::INFO << "Captured " << m_capture->events() << " events, " << m_capture->bytes()
+                << " bytes, to " << m_captureFile.value() << endreq;
+        else
+            log << MSG::ERROR << "Write to capture file " << m_captureFile.value() << " failed" << endreq;
+        delete m_capture;
+        m_capture = 0;
+    }
+#ifndef WIN32
+    if (m_stream != 0) {
+        // the consumer has everything once it acknowledges
+        m_stream->finish();
+        log << MSG::INFO << "Streamed " << m_stream->batches() << " batches, " << m_stream->bytes()
+            << " bytes; waited " << m_stream->waitSeconds() << " s for the consumer" << endreq;
+        delete m_stream;
+        m_stream = 0;
+    }
+
+    for (std::map<std::string, LiveRowRing*>::iterator it = m_liveRings.begin(); it != m_liveRings.end(); ++it)
+        delete it->second;
+    m_liveRings.clear();
+#endif
+
+    for( std::map<std::string, ColumnarWriter*>::iterator it = m_export.begin(); it!=m_export.end(); ++it){
+        it->second->close();
+        log << MSG::INFO << "Exported " << it->second->entries() << " rows of \"" << it->first
+            << "\" to " << it->second->directory() << endreq;
+        delete it->second;
+    }
+    m_export.clear();
+
+    // the files are independent: the engine writes and closes them each on its own thread,
+    // so that the time taken is that of the largest file
+    std::chrono::steady_clock::time_point writeStart = std::chrono::steady_clock::now();
+    std::vector<FileWrite> writes;
+    writes.reserve(m_fileCol.size());
+    m_engine.setClose(
+        [this, &writes](const std::string& fileName, TFile* f) {
+            // so that tools combining files, such as mergeTuples, can check they agree
+            TParameter<int> meritVersion("MeritVersion", m_meritVersion);
+            f->WriteTObject(&meritVersion, 0, "Overwrite");
+            FileWrite w;
+            w.fileName = fileName;
+            std::map<std::string, std::string>::const_iterator stagedit = m_stagedPath.find(fileName);
+            if (stagedit != m_stagedPath.end()) {
+                w.transfer = new FileTransfer;
+                w.transfer->source = stagedit->second;
+                w.transfer->destination = fileName;
+            }
+            writes.push_back(w);
+        },
+        [&writes](const std::string& fileName, TFile*) {
+            // while the other files are written; each thread has its own entry
+            for (unsigned int i = 0; i<writes.size(); ++i) {
+                if (writes[i].fileName == fileName && writes[i].transfer != 0)
+                    writes[i].mover = new std::thread(transferFile, writes[i].transfer);
+            }
+        });
+    TDirectory* saveDir = gDirectory;
+    m_engine.close(m_parallelFinalize);
+    saveDir->cd();
+    log << MSG::INFO << "Wrote " << writes.size() << " output files in "
+        << secondsSince(writeStart) << " s" << endreq;
+
+    // the staged files are on their way: wait for them
+    std::chrono::steady_clock::time_point writeEnd = std::chrono::steady_clock::now();
+    double moving = 0, overlap = 0;
+    int moved = 0;
+    for (unsigned int i = 0; i<writes.size(); ++i) {
+        if (writes[i].mover == 0) continue;
+        writes[i].mover->join();
+        delete writes[i].mover;
+        FileTransfer* t = writes[i].transfer;
+        if (t->ok) {
+            ++moved;
+            log << MSG::DEBUG << (t->copied ? "Copied " : "Renamed ") << t->source << " to " << t->destination
+                << " in " << t->seconds() << " s" << endreq;
+            if (t->copied) log << MSG::DEBUG << t->bytes << " bytes, Adler-32 " << std::hex << t->checksum
+                << std::dec << " checked" << endreq;
+        } else {
+            log << MSG::ERROR << "Output file " << t->destination << " is still " << t->source
+                << ": " << t->error << endreq;
+        }
+        moving += t->seconds();
+        if (t->start < writeEnd) overlap += std::chrono::duration<double>(std::min(t->end, writeEnd) - t->start).count();
+    }
+    if (!m_stagedPath.empty()) {
+        log << MSG::INFO << "Moved " << moved << " of " << m_stagedPath.size() << " staged files in "
+            << moving << " s, " << overlap << " s of it while other files were written; waited "
+            << secondsSince(writeEnd) << " s" << endreq;
+    }
+    for (unsigned int i = 0; i<writes.size(); ++i) delete writes[i].transfer;
+
+    // the job is complete: a later resume must not start from its last checkpoint
+    if (m_checkpointInterval > 0 || m_resuming) gSystem->Unlink(m_checkpointFile.value().c_str());
+    return StatusCode::SUCCESS;
 }
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 bool RootTupleSvc::storeRowFlag(const std::string& tupleName, bool flag)
 {
-    bool t = m_storeTree[tupleName];
-    m_storeTree[tupleName] = flag;
+    std::map<std::string, bool>& store = m_concurrentSlots > 0 ? m_slotStore[t_currentSlot] : m_storeTree;
+    bool t = store[tupleName];
+    store[tupleName] = flag;
     return t;
 }
 
+void RootTupleSvc::storeRowFlag(bool flag)
+{
+    if (m_concurrentSlots > 0) m_slotStoreAll[t_currentSlot] = flag;
+    else m_storeAll = flag;
+}
+
+bool RootTupleSvc::storeRowFlag()
+{
+    if (m_concurrentSlots > 0) return m_slotStoreAll[t_currentSlot] != 0;
+    return m_storeAll;
+}
+
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 long long RootTupleSvc::getInputTreePtr(void*& pval, const std::string & tupleName)
 {
@@ -1058,6 +2804,13 @@ long long RootTupleSvc::getOutputTreePtr(void*& pval, const std::string & tupleN
     if (treeit != m_tree.end()) {
         // Found the TChain, now return
         TTree* t = treeit->second;
+        std::map<std::string, TupleSink*>::iterator sinkit = m_sink.find(treename);
+        if (sinkit != m_sink.end()) {
+            // not a TTree: see getOutputTreeType
+            pval = 0;
+            saveDir->cd();
+            return sinkit->second->entries();
+        }
         if (t->GetCurrentFile() != 0) 
             t->GetCurrentFile()->cd();
 
@@ -1073,6 +2826,16 @@ long long RootTupleSvc::getOutputTreePtr(void*& pval, const std::string & tupleN
     return -1;
 }
 
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+std::string RootTupleSvc::getOutputTreeType(const std::string & tupleName)
+{
+    std::string treename=tupleName.empty()? m_treename.value() : tupleName;
+    if (m_tree.find(treename) == m_tree.end()) return "";
+    std::map<std::string, TupleSink*>::const_iterator sinkit = m_sink.find(treename);
+    if (sinkit != m_sink.end()) return sinkit->second->type();
+    return "TTree";
+}
+
 
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 std::string RootTupleSvc::getItem(const std::string & tupleName, 
@@ -1102,6 +2865,25 @@ std::string RootTupleSvc::getItem(const std::string & tupleName,
         return itemName;
     }
 
+    // an encoded input item is seen as the string it stands for
+    std::map<std::string, std::map<std::string, DictDecoder*> >::const_iterator decit = m_dictDecoders.find(treename);
+    if (decit != m_dictDecoders.end() && treePtr == 0) {
+        std::map<std::string, DictDecoder*>::const_iterator itemit = decit->second.find(itemName);
+        if (itemit != decit->second.end()) {
+            pval = &itemit->second->text[0];
+            saveDir->cd();
+            return "Char_t";
+        }
+    }
+
+    if (m_concurrentSlots > 0 && t_currentSlot > 0 && treePtr == 0) {
+        std::string type_name;
+        if (slotItem(t_currentSlot, treename, itemName, pval, type_name)) {
+            saveDir->cd();
+            return type_name;
+        }
+    }
+
     TLeaf *leaf = 0;
     bool foundInChain = false;
     std::map<std::string, TChain*>::const_iterator inputChain = m_inChain.find(treename);
@@ -1137,42 +2919,17 @@ std::string RootTupleSvc::getItem(const std::string & tupleName,
     std::string type_name(leaf->GetTypeName());
 
     if (foundInChain) {
-        std::map<std::string, void*>::iterator itemIt = m_itemPool.find(itemName);
+        std::map<std::string, void*>& pool = m_itemPool[treename];
+        std::map<std::string, void*>::iterator itemIt = pool.find(itemName);
         // Create a new object to store this leaf pointer
         // This is necessary when we move to a new TTree in the TChain, otherwise, this address will be lost
         // and unusable by the clients that are relying on a stable address
         log << MSG::DEBUG << "item: " << itemName << " type: " << type_name 
             << " dim: " << leaf->GetNdata() << endreq;
-        if (itemIt == m_itemPool.end()) {
-            if (type_name == "Float_t")
-            {
-                m_itemPool[itemName] = new Float_t[leaf->GetNdata()];
-            }
-            else if (type_name == "Int_t")
-            {
-                m_itemPool[itemName]= new Int_t[leaf->GetNdata()];
-            }
-            else if (type_name == "UInt_t")
-            {
-                m_itemPool[itemName]= new UInt_t[leaf->GetNdata()];
-            }        
-            else if (type_name == "ULong64_t")
-            {
-                m_itemPool[itemName]= new ULong64_t[leaf->GetNdata()];
-            }
-            else if (type_name == "Double_t")
-            {
-                m_itemPool[itemName] = new Double_t[leaf->GetNdata()];
-            }
-            else if (type_name == "Char_t")
-            {
-                m_itemPool[itemName] = new Char_t[leaf->GetNdata()];
-            }
-            else
-            {
-                log << MSG::WARNING << "type: " << type_name <<" not found" << endreq;
-            }
-            inputChain->second->SetBranchAddress(itemName.c_str(), m_itemPool[itemName]);
+        if (itemIt == pool.end()) {
+            m_engine.poolItem(treename, inputChain->second, itemName, leaf);
+            // the copy of the input tree may have moved too
+            m_captureInput.erase(treename);
             leaf = inputChain->second->GetLeaf(itemName.c_str());
             pval = leaf->GetValuePointer();
         }
@@ -1192,10 +2949,129 @@ void RootTupleSvc::saveRow(const std::string& tupleName)
     }
 
     TTree* t= treeit->second;
-    t->Fill();
+    if (m_capture != 0) captureRow(treeit->first, true);
+    fillTree(treeit->first, t);
     m_storeTree[treeit->first]=false;
 }
 
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+long long RootTupleSvc::fillRows(const std::string& tupleName, long long nRows,
+                                 const std::vector<std::string>& itemNames,
+                                 const std::vector<const void*>& columns)
+{
+    MsgStream log(msgSvc(),name());
+    std::map<std::string, TTree*>::iterator treeit=m_tree.find(tupleName);
+    if( treeit==m_tree.end()){
+        log << MSG::ERROR << "Did not find tree " << tupleName << endreq;
+        throw std::invalid_argument("RootTupleSvc::fillRows: did not find tupleName");
+    }
+    if( nRows<0 ){
+        log << MSG::ERROR << "fillRows: negative number of rows, " << nRows
+            << ", for tree " << tupleName << endreq;
+        return -1;
+    }
+    if( itemNames.size()!=columns.size() ){
+        log << MSG::ERROR << "fillRows: " << itemNames.size() << " item names but "
+            << columns.size() << " columns" << endreq;
+        return -1;
+    }
+    TTree* t = treeit->second;
+
+    // match the supplied columns to the branches of the tree
+    std::vector<TupleColumn> cols;
+    describeColumns(t, cols);
+    std::vector<const char*> source(cols.size(), 0);
+    for( unsigned int i = 0; i<cols.size(); ++i){
+        const TupleColumn& col = cols[i];
+        if( col.type=='C' || col.type==0 ){
+            log << MSG::ERROR << "fillRows: item " << col.name << " in tree " << tupleName
+                << " has a type that cannot be filled from a column" << endreq;
+            return -1;
+        }
+        if( findEncoder(tupleName, col.name)!=0 ){
+            log << MSG::ERROR << "fillRows: item " << col.name << " in tree " << tupleName
+                << " is dictionary encoded, and its strings cannot be filled from a column" << endreq;
+            return -1;
+        }
+        for( unsigned int j = 0; j<itemNames.size(); ++j){
+            if( itemNames[j]==col.name ) { source[i] = static_cast<const char*>(columns[j]); break; }
+        }
+        if( source[i]==0 ){
+            log << MSG::ERROR << "fillRows: no column supplied for item " << col.name
+                << " of tree " << tupleName << endreq;
+            return -1;
+        }
+    }
+
+    // non-finite check, one pass down each floating point column for the whole batch.
+    // As in checkForNAN, only the first element of an array item is tested.
+    std::vector<char> bad(nRows, 0);
+    for( unsigned int i = 0; i<cols.size(); ++i){
+        const TupleColumn& col = cols[i];
+        if( !col.isFloat() ) continue;
+        int count = 0;
+        if( col.type=='F' ){
+            const float* v = reinterpret_cast<const float*>(source[i]);
+            for( long long row = 0; row<nRows; ++row){
+                if( !isFinite(v[row*col.length]) ) { bad[row] = 1; ++count; }
+            }
+        }else{
+            const double* v = reinterpret_cast<const double*>(source[i]);
+            for( long long row = 0; row<nRows; ++row){
+                if( !isFinite(v[row*col.length]) ) { bad[row] = 1; ++count; }
+            }
+        }
+        if( count>0 ) m_badMap[col.leafName] += count;
+    }
+
+    TDirectory *saveDir = gDirectory;
+    if (t->GetCurrentFile() != 0)
+        t->GetCurrentFile()->cd();
+    else
+        gDirectory->cd(0);
+
+    // point the branches at a staging row for the duration of the batch
+    RowStaging staging(t);
+    staging.attach();
+    bindOutputs(tupleName);
+    // except the delta encoded ones, which keep the encoder buffer: the encoder reads the staging row
+    std::vector<std::pair<DeltaEncoder*, const void*> > deltas;
+    for( unsigned int i = 0; i<cols.size(); ++i){
+        DeltaEncoder* d = findDeltaEncoder(tupleName, cols[i].name);
+        if( d==0 ) continue;
+        deltas.push_back(std::make_pair(d, d->source));
+        d->source = staging.column(i);
+        cols[i].branch->SetAddress(d->buffer());
+    }
+
+    bool filtered = m_rowFilters.find(tupleName)!=m_rowFilters.end();
+    long long written = 0;
+    for( long long row = 0; row<nRows; ++row){
+        for( unsigned int i = 0; i<cols.size(); ++i){
+            int n = cols[i].bytes();
+            memcpy(staging.column(i), source[i]+row*n, n);
+        }
+        // as at the end of an event: the filter first, then the non-finite check
+        if( filtered && !passesFilter(tupleName, t, log) ) continue;
+        if( bad[row] ){
+            m_badEventCount++;
+            if (m_rejectIfBad) continue;
+        }
+        fillTree(tupleName, t);
+        ++written;
+    }
+
+    // and back to the client variables
+    for( unsigned int i = 0; i<deltas.size(); ++i) deltas[i].first->source = deltas[i].second;
+    staging.detach();
+    bindOutputs(tupleName);
+    log << MSG::DEBUG << "fillRows: wrote " << written << " of " << nRows
+        << " rows to tree " << tupleName << endreq;
+
+    saveDir->cd();
+    return written;
+}
+
 void RootTupleSvc::setBufferSize(const std::string& tupleName, int bufSize,
                                  const std::string& bname) {
 
@@ -1242,9 +3118,1272 @@ bool RootTupleSvc::fileExists( const std::string & filename )
 
  Long64_t RootTupleSvc::index() { return m_nextEvent ; }
 
+ void RootTupleSvc::addCounter(const std::string& counterName, int* counter) {
+     m_counters[counterName] = counter;
+     std::map<std::string, int>::const_iterator it = m_resumeCounters.find(counterName);
+     if (it != m_resumeCounters.end()) *counter = it->second;
+ }
+
  Long64_t RootTupleSvc::getNumberOfEvents() { 
      return m_nevents; 
  }
  
 
+ void RootTupleSvc::bindOutputs(const std::string& treeName) {
+     std::map<std::string, TupleSink*>::iterator sinkit = m_sink.find(treeName);
+     if (sinkit != m_sink.end()) sinkit->second->bind();
+     std::map<std::string, ColumnarWriter*>::iterator exportit = m_export.find(treeName);
+     if (exportit != m_export.end()) exportit->second->bind();
+ }
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+//         Concurrent mode
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+bool RootTupleSvc::checkSlot(unsigned int slot)
+{
+    if (slot < (unsigned int)m_concurrentSlots.value()) return true;
+    MsgStream log(msgSvc(),name());
+    log << MSG::ERROR << "Event slot " << slot << " used, but ConcurrentSlots is "
+        << m_concurrentSlots.value() << endreq;
+    return false;
+}
+
+void RootTupleSvc::selectSlot(unsigned int slot)
+{
+    if (!checkSlot(slot))
+        throw std::invalid_argument("RootTupleSvc::selectSlot: no such event slot");
+    t_currentSlot = slot;
+}
+
+StatusCode RootTupleSvc::addSlotItem(unsigned int slot, const std::string& treeName,
+                                     const std::string& itemName, const void* pval)
+{
+    std::lock_guard<std::mutex> lock(m_slotMutex);
+    std::map<std::string, TTree*>::const_iterator treeit = m_tree.find(treeName);
+    if (treeit == m_tree.end() || treeit->second->GetBranch(itemName.c_str()) == 0) {
+        MsgStream log(msgSvc(),name());
+        log << MSG::ERROR << "Slot " << slot << ": item " << itemName << " of tuple " << treeName
+            << " must be added for slot 0 first" << endreq;
+        return StatusCode::FAILURE;
+    }
+    m_slotItems[slot][treeName][itemName] = pval;
+    return StatusCode::SUCCESS;
+}
+
+TChain* RootTupleSvc::slotChain(unsigned int slot, const std::string& treeName)
+{
+    std::lock_guard<std::mutex> lock(m_slotMutex);
+    std::map<std::string, TChain*>::iterator chainit = m_slotChain[slot].find(treeName);
+    if (chainit != m_slotChain[slot].end()) return chainit->second;
+    std::map<std::string, TChain*>::iterator inIter = m_inChain.find(treeName);
+    if (inIter == m_inChain.end()) return 0;
+
+    // same files, branches and branch status as the chain of slot 0, with buffers of its own
+    TDirectory* saveDir = gDirectory;
+    TChain* ch0 = inIter->second;
+    TChain* ch = new TChain(treeName.c_str());
+    for (std::vector<std::string>::const_iterator fileListItr = m_inFileList.begin();
+         fileListItr != m_inFileList.end(); ++fileListItr) {
+        ch->Add(fileListItr->c_str());
+    }
+    std::map<std::string, void*>& pool = m_slotPool[slot][treeName];
+    TObjArray* brCol = ch0->GetListOfBranches();
+    int numBranches = brCol->GetEntries();
+    for (int iBranch = 0; iBranch<numBranches; ++iBranch) {
+        TBranch* b = (TBranch*)brCol->At(iBranch);
+        std::string branchName(b->GetName());
+        void* buffer = newItemBuffer((TLeaf*)(*b->GetListOfLeaves())[0]);
+        if (buffer == 0) continue;
+        pool[branchName] = buffer;
+        ch->SetBranchAddress(branchName.c_str(), buffer);
+        ch->SetBranchStatus(branchName.c_str(), ch0->GetBranchStatus(branchName.c_str()));
+    }
+    m_slotChain[slot][treeName] = ch;
+    saveDir->cd();
+    return ch;
+}
+
+void RootTupleSvc::openSlotInputs()
+{
+    for (unsigned int slot = 1; slot < m_slotChain.size(); ++slot) {
+        for (std::map<std::string, TChain*>::const_iterator inIter = m_inChain.begin();
+             inIter != m_inChain.end(); ++inIter) {
+            slotChain(slot, inIter->first);
+        }
+    }
+}
+
+bool RootTupleSvc::slotItem(unsigned int slot, const std::string& treeName, const std::string& itemName,
+                            void*& pval, std::string& type_name)
+{
+    TChain* ch = slotChain(slot, treeName);
+    if (ch != 0 && ch->GetBranchStatus(itemName.c_str())) {
+        std::map<std::string, void*>& pool = m_slotPool[slot][treeName];
+        std::map<std::string, void*>::const_iterator poolit = pool.find(itemName);
+        TLeaf* leaf = m_inChain[treeName]->GetLeaf(itemName.c_str());
+        if (poolit != pool.end() && leaf != 0) {
+            pval = poolit->second;
+            type_name = leaf->GetTypeName();
+            return true;
+        }
+    }
+    std::lock_guard<std::mutex> lock(m_slotMutex);
+    std::map<std::string, const void*>& items = m_slotItems[slot][treeName];
+    std::map<std::string, const void*>::const_iterator itemit = items.find(itemName);
+    if (itemit == items.end()) return false;
+    TLeaf* leaf = m_tree[treeName]->GetLeaf(itemName.c_str());
+    if (leaf == 0) return false;
+    pval = const_cast<void*>(itemit->second);
+    type_name = leaf->GetTypeName();
+    return true;
+}
+
+StatusCode RootTupleSvc::beginSlotEvent(unsigned int slot, long long eventIndex)
+{
+    if (!checkSlot(slot)) return StatusCode::FAILURE;
+    t_currentSlot = slot;
+    // another chain switching files while a slot chain copies its branches would not be safe
+    std::call_once(m_slotInputOnce, &RootTupleSvc::openSlotInputs, this);
+
+    std::map<std::string, TChain*>& chains = slot == 0 ? m_inChain : m_slotChain[slot];
+    for (std::map<std::string, TChain*>::iterator inIter = chains.begin(); inIter != chains.end(); ++inIter) {
+        if (inIter->second->GetEntry(eventIndex) <= 0) {
+            MsgStream log(msgSvc(),name());
+            log << MSG::ERROR << "Slot " << slot << ": failed to load event " << eventIndex
+                << " from the input chain " << inIter->first << endreq;
+            return StatusCode::FAILURE;
+        }
+    }
+
+    /// Assume that we will NOT write out the row
+    m_slotStoreAll[slot] = m_defaultStoreFlag;
+    std::map<std::string, bool>& store = m_slotStore[slot];
+    for (std::map<std::string, bool>::iterator it = store.begin(); it != store.end(); ++it) it->second = false;
+    m_slotEvent[slot] = eventIndex;
+    return StatusCode::SUCCESS;
+}
+
+RootTupleSvc::SlotTree& RootTupleSvc::slotTree(unsigned int slot, const std::string& treeName, TTree* t)
+{
+    std::map<std::string, SlotTree>::iterator it = m_slotTrees[slot].find(treeName);
+    if (it != m_slotTrees[slot].end()) return it->second;
+
+    std::lock_guard<std::mutex> lock(m_slotMutex);
+    ConcurrentTree*& ct = m_concurrentTrees[treeName];
+    if (ct == 0) ct = new ConcurrentTree(treeName, t);
+    SlotTree& st = m_slotTrees[slot][treeName];
+    st.tree = ct;
+
+    // a slot uses the variables it registered, then its own input buffers, then those of slot 0
+    const std::vector<TupleColumn>& cols = ct->staging.columns();
+    const std::map<std::string, const void*>& items = m_slotItems[slot][treeName];
+    const std::map<std::string, void*>& pool = m_slotPool[slot][treeName];
+    st.addresses.resize(cols.size());
+    for (unsigned int i = 0; i<cols.size(); ++i) {
+        std::map<std::string, const void*>::const_iterator itemit = items.find(cols[i].name);
+        std::map<std::string, void*>::const_iterator poolit = pool.find(cols[i].name);
+        if (itemit != items.end())     st.addresses[i] = itemit->second;
+        else if (poolit != pool.end()) st.addresses[i] = poolit->second;
+        else {
+            st.addresses[i] = cols[i].address;
+            if (slot > 0) {
+                MsgStream log(msgSvc(),name());
+                log << MSG::WARNING << "Slot " << slot << " has no variable for item " << cols[i].name
+                    << " of tuple " << treeName << ": using that of slot 0" << endreq;
+            }
+        }
+    }
+    return st;
+}
+
+StatusCode RootTupleSvc::endSlotEvent(unsigned int slot)
+{
+    if (!checkSlot(slot)) return StatusCode::FAILURE;
+
+    // copy the rows now: the slot may start its next event as soon as this returns
+    SlotRecord* record = new SlotRecord;
+    record->eventIndex = m_slotEvent[slot];
+    std::map<std::string, bool>& store = m_slotStore[slot];
+    for (std::map<std::string, TTree*>::const_iterator it = m_tree.begin(); it != m_tree.end(); ++it) {
+        std::map<std::string, bool>::iterator flag = store.find(it->first);
+        bool flagged = flag != store.end() && flag->second;
+        if (!flagged && !m_slotStoreAll[slot]) continue;
+        if (flagged) flag->second = false;
+        SlotTree& st = slotTree(slot, it->first, it->second);
+        record->rows.push_back(std::make_pair(st.tree, std::string()));
+        packRow(st.tree->staging.columns(), st.addresses, record->rows.back().second);
+    }
+    ++m_submitted;
+    m_slotQueue.push(record);
+    // the lock makes sure a writer about to wait has seen the count, or gets the notification
+    { std::lock_guard<std::mutex> lock(m_writerMutex); }
+    m_writerWake.notify_one();
+    return StatusCode::SUCCESS;
+}
+
+void RootTupleSvc::drainSlots()
+{
+    if (!m_writer.joinable()) return;
+    std::unique_lock<std::mutex> lock(m_writerMutex);
+    m_drained.wait(lock, [this]() { return m_written.load() >= m_submitted.load(); });
+}
+
+void RootTupleSvc::writeSlots()
+{
+    long long taken = 0;
+    for (;;) {
+        SlotRecord* record = m_slotQueue.pop();
+        if (record == 0) {
+            if (taken < m_submitted.load()) {
+                // counted, but its push is not finished: a matter of instructions
+                std::this_thread::yield();
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(m_writerMutex);
+            m_writerWake.wait(lock, [this, taken]() { return m_stopWriter.load() || taken < m_submitted.load(); });
+            if (taken == m_submitted.load()) break;
+            continue;
+        }
+        ++taken;
+        if (!m_orderedOutput) {
+            writeRecord(record);
+            continue;
+        }
+        m_reorder[record->eventIndex] = record;
+        if (m_reorder.size() > m_maxReorder) m_maxReorder = m_reorder.size();
+        while (!m_reorder.empty() && m_reorder.begin()->first == m_nextOrdered) {
+            SlotRecord* next = m_reorder.begin()->second;
+            m_reorder.erase(m_reorder.begin());
+            writeRecord(next);
+            ++m_nextOrdered;
+        }
+    }
+}
+
+void RootTupleSvc::writeRecord(SlotRecord* record)
+{
+    MsgStream log(msgSvc(),name());
+    for (unsigned int i = 0; i<record->rows.size(); ++i) {
+        ConcurrentTree* ct = record->rows[i].first;
+        bool moved = ct->staging.unpack(record->rows[i].second.data());
+        if (!ct->staging.attached()) {
+            ct->staging.attach();
+            moved = true;
+        }
+        if (moved) bindOutputs(ct->name);
+
+        // as in endEvent: the filter on the staging row and the prescale, the non-finite check,
+        // then the tree or its reservoir
+        if (m_rowFilters.find(ct->name) != m_rowFilters.end() && !passesFilter(ct->name, ct->tree, log)) continue;
+        if (!keepPrescaled(ct->name)) continue;
+        if (checkForNAN(ct->tree, log).isFailure()) {
+            m_badEventCount++;
+            if (!m_rejectIfBad) storeRow(ct->name, ct->tree);
+        } else {
+            storeRow(ct->name, ct->tree);
+        }
+    }
+    ++m_trials;
+    if (m_memoryCheckInterval > 0 && (m_trials % m_memoryCheckInterval) == 0) checkMemoryBudget();
+    delete record;
+    ++m_written;
+    { std::lock_guard<std::mutex> lock(m_writerMutex); }
+    m_drained.notify_all();
+}
+
+void RootTupleSvc::stopSlots(MsgStream& log)
+{
+    if (!m_writer.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lock(m_writerMutex);
+        m_stopWriter = true;
+    }
+    m_writerWake.notify_one();
+    m_writer.join();
+
+    if (!m_reorder.empty()) {
+        log << MSG::WARNING << "Event " << m_nextOrdered << " never ended: the "
+            << m_reorder.size() << " events after it are written out of order" << endreq;
+        for (std::map<long long, SlotRecord*>::iterator it = m_reorder.begin(); it != m_reorder.end(); ++it)
+            writeRecord(it->second);
+        m_reorder.clear();
+    }
+    log << MSG::INFO << "Concurrent mode: " << m_written.load() << " events from "
+        << m_concurrentSlots.value() << " slots";
+    if (m_orderedOutput) log << ", at most " << m_maxReorder << " waiting for an earlier event";
+    log << endreq;
+
+    // back to the client variables of slot 0, for any rows stored in finalize
+    for (std::map<std::string, ConcurrentTree*>::iterator it = m_concurrentTrees.begin();
+         it != m_concurrentTrees.end(); ++it) {
+        it->second->staging.detach();
+        bindOutputs(it->first);
+        delete it->second;
+    }
+    m_concurrentTrees.clear();
+    for (unsigned int slot = 0; slot < m_slotTrees.size(); ++slot) m_slotTrees[slot].clear();
+    t_currentSlot = 0;
+}
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+std::string RootTupleSvc::bindItemRef(const std::string& tupleName, const std::string& itemName,
+                                      void** ref)
+{
+    std::string treename = tupleName.empty()? m_treename.value() : tupleName;
+    std::string type_name = getItem(treename, itemName, *ref);
+    m_itemRefs[ref] = ItemRefName(treename, itemName);
+
+    // one notification per input chain, for all the ItemRefs of its tree
+    std::map<std::string, TChain*>::iterator chainit = m_inChain.find(treename);
+    if (chainit != m_inChain.end() && m_chainNotify.find(treename) == m_chainNotify.end()) {
+        ChainNotify* notify = new ChainNotify(std::bind(&RootTupleSvc::rebindItemRefs, this, treename));
+        chainit->second->SetNotify(notify);
+        m_chainNotify[treename] = notify;
+    }
+    return type_name;
+}
+
+void RootTupleSvc::unbindItemRef(void** ref)
+{
+    m_itemRefs.erase(ref);
+}
+
+void RootTupleSvc::rebindItemRefs(const std::string& treeName)
+{
+    for (std::map<void**, ItemRefName>::iterator it = m_itemRefs.begin(); it != m_itemRefs.end(); ++it) {
+        if (it->second.first == treeName) getItem(treeName, it->second.second, *it->first);
+    }
+}
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+StatusCode RootTupleSvc::declareKey(const std::string& tupleName,
+                                    const std::vector<std::string>& keyItems)
+{
+    MsgStream log(msgSvc(),name());
+    if (m_inChain.find(tupleName) != m_inChain.end()) return declareInputKey(tupleName, keyItems, log);
+    std::map<std::string, TTree*>::iterator treeit = m_tree.find(tupleName);
+    if (treeit == m_tree.end() || !isMemoryResident(tupleName)) {
+        log << MSG::ERROR << "declareKey: " << tupleName << " is neither a memory resident nor an input tree" << endreq;
+        return StatusCode::FAILURE;
+    }
+    TTree* t = treeit->second;
+    std::vector<TupleColumn> cols;
+    describeColumns(t, cols);
+    KeyIndex index;
+    for (unsigned int k = 0; k<keyItems.size(); ++k) {
+        unsigned int i = 0;
+        while (i<cols.size() && cols[i].name != keyItems[k]) ++i;
+        if (i == cols.size() || cols[i].type == 0) {
+            log << MSG::ERROR << "declareKey: no item " << keyItems[k] << " of a supported type in "
+                << tupleName << endreq;
+            return StatusCode::FAILURE;
+        }
+        index.keys.push_back(cols[i]);
+    }
+
+    // rows stored already: read their key items only, then restore the client values
+    std::string saved = currentKey(index.keys);
+    for (long long entry = 0; entry<t->GetEntries(); ++entry) {
+        for (unsigned int k = 0; k<index.keys.size(); ++k) index.keys[k].branch->GetEntry(entry);
+        index.entries[currentKey(index.keys)] = entry;
+    }
+    const char* p = saved.data();
+    for (unsigned int k = 0; k<index.keys.size(); ++k) {
+        size_t n = index.keys[k].type=='C' ? strlen(p)+1 : index.keys[k].bytes();
+        memcpy(index.keys[k].branch->GetAddress(), p, n);
+        p += n;
+    }
+
+    log << MSG::INFO << "Tree " << tupleName << " indexed by " << keyItems.size() << " items, "
+        << index.entries.size() << " keys so far" << endreq;
+    m_keyIndex[tupleName] = index;
+    return StatusCode::SUCCESS;
+}
+
+long long RootTupleSvc::findEntry(const std::string& tupleName,
+                                  const std::vector<const void*>& keyValues, bool load)
+{
+    std::map<std::string, KeyIndex>::const_iterator indexit = m_keyIndex.find(tupleName);
+    if (indexit == m_keyIndex.end() && tupleName == m_keyTree && !m_keyItems.empty())
+        return findInputEntry(keyValues, load);
+    if (indexit == m_keyIndex.end() || keyValues.size() != indexit->second.keys.size()) {
+        MsgStream log(msgSvc(),name());
+        log << MSG::ERROR << "findEntry: tree " << tupleName << " has no key of "
+            << keyValues.size() << " items: see declareKey" << endreq;
+        throw std::invalid_argument("RootTupleSvc::findEntry: no such key");
+    }
+    const std::vector<TupleColumn>& keys = indexit->second.keys;
+    std::string key;
+    for (unsigned int k = 0; k<keys.size(); ++k) {
+        const char* p = static_cast<const char*>(keyValues[k]);
+        if (keys[k].type=='C') key.append(p, strlen(p)+1);
+        else                   key.append(p, keys[k].bytes());
+    }
+    std::unordered_map<std::string, long long>::const_iterator it = indexit->second.entries.find(key);
+    if (it == indexit->second.entries.end()) return -1;
+    if (load) m_tree[tupleName]->GetEntry(it->second);
+    return it->second;
+}
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+std::string RootTupleSvc::keyIndexInputs(TChain* ch)
+{
+    // the files, with the entries and the UUID of each: a file rewritten since has a new UUID,
+    // even with the same name and number of entries
+    std::ostringstream inputs;
+    TDirectory* saveDir = gDirectory;
+    TObjArray* files = ch->GetListOfFiles();
+    for (int i = 0; i<files->GetEntries(); ++i) {
+        TChainElement* element = (TChainElement*)files->At(i);
+        TFile* f = TFile::Open(element->GetTitle(), "READ");
+        inputs << element->GetTitle() << " " << element->GetEntries() << " "
+               << (f != 0 && !f->IsZombie() ? f->GetUUID().AsString() : "") << "\n";
+        delete f;
+    }
+    saveDir->cd();
+    for (unsigned int k = 0; k<m_keyItems.size(); ++k) inputs << m_keyItems[k] << " ";
+    return inputs.str();
+}
+
+bool RootTupleSvc::buildKeyIndex(MsgStream& log)
+{
+    if (!m_keyEntries.empty()) return true;
+    std::map<std::string, TChain*>::iterator chit = m_inChain.find(m_keyTree);
+    if (m_keyItems.empty() || chit == m_inChain.end()) {
+        log << MSG::ERROR << "No input key: set InputKey to items of an input tree" << endreq;
+        return false;
+    }
+    TChain* ch = chit->second;
+    TDirectory* saveDir = gDirectory;
+    std::string inputs = keyIndexInputs(ch);
+    std::string cacheName(m_inputKeyCache.value());
+    facilities::Util::expandEnvVar(&cacheName);
+
+    // an index saved by a job on the same input
+    if (!cacheName.empty() && !gSystem->AccessPathName(cacheName.c_str())) {
+        TFile cache(cacheName.c_str(), "READ");
+        TTree* index = 0;
+        TNamed* valid = 0;
+        if (cache.IsOpen()) {
+            cache.GetObject("keyindex", index);
+            cache.GetObject("inputs", valid);
+        }
+        if (index != 0 && valid != 0 && inputs == valid->GetTitle()) {
+            KeyEntry e;
+            index->SetBranchAddress("key0", &e.key[0]);
+            index->SetBranchAddress("key1", &e.key[1]);
+            index->SetBranchAddress("entry", &e.entry);
+            m_keyEntries.reserve(index->GetEntries());
+            for (long long i = 0; i<index->GetEntries(); ++i) {
+                index->GetEntry(i);
+                m_keyEntries.push_back(e);
+            }
+            log << MSG::INFO << "Read the index of " << m_keyEntries.size() << " input entries from "
+                << cacheName << endreq;
+        } else {
+            log << MSG::INFO << "Index in " << cacheName << " is not for this input, building it again" << endreq;
+        }
+        delete valid;
+        cache.Close();
+    }
+
+    if (m_keyEntries.empty()) {
+        // read the key branches only, on a chain of its own
+        TChain scan(m_keyTree.c_str());
+        scan.Add(ch);
+        long long entries = scan.GetEntries();
+        m_keyEntries.reserve(entries);
+        std::vector<TLeaf*> leaves(m_keyItems.size(), (TLeaf*)0);
+        // delta encoded key items are decoded as the scan goes, to the values getItem sees
+        std::vector<ULong64_t> stored(m_keyItems.size(), 0);
+        std::vector<DeltaDecoder> deltas;
+        for (unsigned int k = 0; k<m_keyItems.size(); ++k) deltas.push_back(DeltaDecoder('l', &stored[k]));
+        int treeNumber = -1;
+        for (long long entry = 0; entry<entries; ++entry) {
+            long long local = scan.LoadTree(entry);
+            if (local < 0) break;
+            if (scan.GetTreeNumber() != treeNumber) {
+                treeNumber = scan.GetTreeNumber();
+                for (unsigned int k = 0; k<m_keyItems.size(); ++k) {
+                    leaves[k] = scan.GetTree()->GetLeaf(m_keyItems[k].c_str());
+                    if (leaves[k] == 0) {
+                        log << MSG::ERROR << "InputKey: no item " << m_keyItems[k] << " in " << m_keyTree
+                            << " of " << scan.GetFile()->GetName() << endreq;
+                        m_keyEntries.clear();
+                        saveDir->cd();
+                        return false;
+                    }
+                    deltas[k].type = columnTypeCode(leaves[k]->GetTypeName());
+                    if (deltas[k].type != 'I' && deltas[k].type != 'i' && deltas[k].type != 'l') {
+                        log << MSG::ERROR << "InputKey: item " << m_keyItems[k] << " of " << m_keyTree
+                            << " is not an integer item" << endreq;
+                        m_keyEntries.clear();
+                        saveDir->cd();
+                        return false;
+                    }
+                    deltas[k].block = (deltas[k].type == 'I' || deltas[k].type == 'i' || deltas[k].type == 'l')
+                        ? deltaBlock(m_keyTree, m_keyItems[k], &scan) : 0;
+                }
+            }
+            KeyEntry e;
+            e.key[1] = 0;
+            for (unsigned int k = 0; k<leaves.size(); ++k) {
+                leaves[k]->GetBranch()->GetEntry(local);
+                e.key[k] = (ULong64_t)leaves[k]->GetValueLong64();
+                DeltaDecoder& d = deltas[k];
+                if (d.block <= 0) continue;
+                stored[k] = d.type == 'l' ? e.key[k] : (UInt_t)e.key[k];
+                d.previous = local % d.block == 0 ? d.read() : d.undo(d.read());
+                e.key[k] = d.type == 'I' ? (ULong64_t)(Long64_t)(Int_t)(UInt_t)d.previous : d.previous;
+            }
+            e.entry = entry;
+            m_keyEntries.push_back(e);
+        }
+        std::sort(m_keyEntries.begin(), m_keyEntries.end());
+        log << MSG::INFO << "Indexed " << m_keyEntries.size() << " input entries by " << m_inputKey.value() << endreq;
+
+        if (!cacheName.empty()) {
+            TFile cache(cacheName.c_str(), "RECREATE");
+            if (cache.IsOpen()) {
+                TTree* index = new TTree("keyindex", ("input entries by " + m_inputKey.value()).c_str());
+                KeyEntry e;
+                index->Branch("key0", &e.key[0], "key0/l");
+                index->Branch("key1", &e.key[1], "key1/l");
+                index->Branch("entry", &e.entry, "entry/L");
+                for (unsigned int i = 0; i<m_keyEntries.size(); ++i) {
+                    e = m_keyEntries[i];
+                    index->Fill();
+                }
+                TNamed valid("inputs", inputs.c_str());
+                valid.Write();
+                cache.Write();
+                cache.Close();
+            } else {
+                log << MSG::WARNING << "Cannot write the input index to " << cacheName << endreq;
+            }
+        }
+    }
+    // entries sharing a key are all kept, next to each other
+    long long shared = 0;
+    for (unsigned int i = 1; i<m_keyEntries.size(); ++i) {
+        if (m_keyEntries[i].key[0] == m_keyEntries[i-1].key[0] && m_keyEntries[i].key[1] == m_keyEntries[i-1].key[1])
+            ++shared;
+    }
+    if (shared > 0)
+        log << MSG::WARNING << shared << " input entries have the same key as an earlier one: findEntry "
+            << "returns the first entry of a key, and reads them all" << endreq;
+    saveDir->cd();
+    return !m_keyEntries.empty();
+}
+
+StatusCode RootTupleSvc::declareInputKey(const std::string& tupleName, const std::vector<std::string>& keyItems,
+                                         MsgStream& log)
+{
+    if (keyItems.empty() || keyItems.size() > 2) {
+        log << MSG::ERROR << "declareKey: the key of input tree " << tupleName << " has one or two items, not "
+            << keyItems.size() << endreq;
+        return StatusCode::FAILURE;
+    }
+    // another key than InputKey, or an earlier declareKey: indexed again
+    if (tupleName != m_keyTree || keyItems != m_keyItems) {
+        m_keyTree = tupleName;
+        m_keyItems = keyItems;
+        m_keyEntries.clear();
+    }
+    return buildKeyIndex(log) ? StatusCode::SUCCESS : StatusCode::FAILURE;
+}
+
+KeyEntry RootTupleSvc::inputKey(const std::vector<const void*>& keyValues, MsgStream& log)
+{
+    if (!buildKeyIndex(log) || keyValues.size() != m_keyItems.size()) {
+        log << MSG::ERROR << "findEntry: input tree " << m_keyTree << " has no key of "
+            << keyValues.size() << " items: see declareKey" << endreq;
+        throw std::invalid_argument("RootTupleSvc::findEntry: no such key");
+    }
+    // the values as the index keeps them, whatever the integer type of the item
+    TChain* ch = m_inChain[m_keyTree];
+    KeyEntry e;
+    e.key[1] = 0;
+    e.entry = -1;
+    for (unsigned int k = 0; k<m_keyItems.size(); ++k) {
+        TLeaf* leaf = ch->GetLeaf(m_keyItems[k].c_str());
+        char type = leaf != 0 ? columnTypeCode(leaf->GetTypeName()) : 0;
+        const void* p = keyValues[k];
+        if (type == 'I')      e.key[k] = (ULong64_t)(Long64_t)*static_cast<const Int_t*>(p);
+        else if (type == 'i') e.key[k] = *static_cast<const UInt_t*>(p);
+        else if (type == 'l') e.key[k] = *static_cast<const ULong64_t*>(p);
+        else {
+            log << MSG::ERROR << "findEntry: key item " << m_keyItems[k] << " of " << m_keyTree
+                << " is not an integer item" << endreq;
+            throw std::invalid_argument("RootTupleSvc::findEntry: no such key");
+        }
+    }
+    return e;
+}
+
+long long RootTupleSvc::findInputEntry(const std::vector<const void*>& keyValues, bool load)
+{
+    MsgStream log(msgSvc(),name());
+    KeyEntry e = inputKey(keyValues, log);
+    // the first entry with the key, and the others after it
+    std::vector<KeyEntry>::const_iterator it = std::lower_bound(m_keyEntries.begin(), m_keyEntries.end(), e);
+    if (it == m_keyEntries.end() || it->key[0] != e.key[0] || it->key[1] != e.key[1]) return -1;
+    long long first = it->entry;
+    if (load) {
+        std::vector<long long> entries;
+        for (; it != m_keyEntries.end() && it->key[0] == e.key[0] && it->key[1] == e.key[1]; ++it)
+            entries.push_back(it->entry);
+        scheduleEntries(entries, log);
+    }
+    return first;
+}
+
+long long RootTupleSvc::findEntries(const std::string& tupleName,
+                                    const std::vector<std::vector<const void*> >& keyList)
+{
+    MsgStream log(msgSvc(),name());
+    if (tupleName != m_keyTree || m_keyItems.empty()) {
+        log << MSG::ERROR << "findEntries: tree " << tupleName << " is not an input tree with a key: "
+            << "see declareKey and InputKey" << endreq;
+        throw std::invalid_argument("RootTupleSvc::findEntries: no such key");
+    }
+    // every entry of every key first, then one schedule in entry order
+    std::vector<long long> entries;
+    long long missing = 0;
+    for (unsigned int i = 0; i<keyList.size(); ++i) {
+        KeyEntry e = inputKey(keyList[i], log);
+        std::vector<KeyEntry>::const_iterator it = std::lower_bound(m_keyEntries.begin(), m_keyEntries.end(), e);
+        if (it == m_keyEntries.end() || it->key[0] != e.key[0] || it->key[1] != e.key[1]) ++missing;
+        for (; it != m_keyEntries.end() && it->key[0] == e.key[0] && it->key[1] == e.key[1]; ++it)
+            entries.push_back(it->entry);
+    }
+    if (missing > 0)
+        log << MSG::WARNING << "findEntries: " << missing << " of " << keyList.size() << " keys are not in the input"
+            << endreq;
+    scheduleEntries(entries, log);
+    return entries.size();
+}
+
+void RootTupleSvc::scheduleEntries(const std::vector<long long>& entries, MsgStream& log)
+{
+    if (!m_scheduled) {
+        m_schedule.clear();
+        m_schedulePos = 0;
+        m_scheduled = true;
+    }
+    // the entries already read go; those left are merged with the new ones
+    m_schedule.erase(m_schedule.begin(), m_schedule.begin() + m_schedulePos);
+    m_schedulePos = 0;
+    m_schedule.insert(m_schedule.end(), entries.begin(), entries.end());
+    std::sort(m_schedule.begin(), m_schedule.end());
+    m_schedule.erase(std::unique(m_schedule.begin(), m_schedule.end()), m_schedule.end());
+    log << MSG::DEBUG << "findEntry: " << m_schedule.size() << " input entries left to read" << endreq;
+}
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+DictEncoder* RootTupleSvc::findEncoder(const std::string& treeName, const std::string& itemName)
+{
+    std::map<std::string, std::vector<DictEncoder*> >::iterator dictit = m_dictEncoders.find(treeName);
+    if (dictit == m_dictEncoders.end()) return 0;
+    for (unsigned int i = 0; i<dictit->second.size(); ++i) {
+        if (dictit->second[i]->item == itemName) return dictit->second[i];
+    }
+    return 0;
+}
+
+DeltaEncoder* RootTupleSvc::findDeltaEncoder(const std::string& treeName, const std::string& itemName)
+{
+    std::map<std::string, std::vector<DeltaEncoder*> >::iterator deltait = m_deltaEncoders.find(treeName);
+    if (deltait == m_deltaEncoders.end()) return 0;
+    for (unsigned int i = 0; i<deltait->second.size(); ++i) {
+        if (deltait->second[i]->item == itemName) return deltait->second[i];
+    }
+    return 0;
+}
+
+int RootTupleSvc::deltaBlock(const std::string& treeName, const std::string& item, TChain* ch)
+{
+    TFile* f = ch->GetFile();
+    TParameter<int>* block = 0;
+    if (f != 0) f->GetObject(deltaName(treeName, item).c_str(), block);
+    if (block == 0) return 0;
+    int rows = block->GetVal();
+    delete block;
+    return rows;
+}
+
+bool RootTupleSvc::loadDictionary(const std::string& treeName, const std::string& item, TChain* ch, DictDecoder& d)
+{
+    TFile* f = ch->GetFile();
+    TTree* dict = 0;
+    if (f != 0) f->GetObject(dictionaryName(treeName, item).c_str(), dict);
+    if (dict == 0) return false;
+    readDictionary(dict, d.values);
+    delete dict;
+    d.treeNumber = ch->GetTreeNumber();
+    return true;
+}
+
+size_t RootTupleSvc::longestDictionaryValue(const std::string& treeName, const std::string& item, TChain* ch)
+{
+    size_t longest = 0;
+    TObjArray* files = ch->GetListOfFiles();
+    for (int i = 0; i<files->GetEntries(); ++i) {
+        TFile* f = TFile::Open(((TChainElement*)files->At(i))->GetTitle(), "READ");
+        if (f == 0) continue;
+        TTree* dict = 0;
+        if (!f->IsZombie()) f->GetObject(dictionaryName(treeName, item).c_str(), dict);
+        TLeaf* leaf = dict == 0 ? 0 : dict->GetLeaf("value");
+        if (leaf != 0) longest = std::max(longest, (size_t)std::max(leaf->GetMaximum(), 0));
+        delete f; // and the dictionary tree with it
+    }
+    return longest;
+}
+
+void RootTupleSvc::setupDecoders(const std::string& treeName, TChain* ch, MsgStream& log)
+{
+    TDirectory* saveDir = gDirectory;
+    std::map<std::string, void*>& pool = m_itemPool[treeName];
+    TObjArray* brCol = ch->GetListOfBranches();
+    int numBranches = brCol->GetEntries();
+    for (int iBranch = 0; iBranch<numBranches; ++iBranch) {
+        std::string branchName(((TBranch*)brCol->At(iBranch))->GetName());
+        std::map<std::string, void*>::iterator poolit = pool.find(branchName);
+        TLeaf* leaf = ch->GetLeaf(branchName.c_str());
+        if (poolit == pool.end() || leaf == 0) continue;
+        std::string typeName(leaf->GetTypeName());
+        if (typeName == "Int_t" || typeName == "UInt_t" || typeName == "ULong64_t") {
+            int block = deltaBlock(treeName, branchName, ch);
+            if (block > 0) {
+                DeltaDecoder* d = new DeltaDecoder(typeName == "Int_t" ? 'I' : typeName == "UInt_t" ? 'i' : 'l', poolit->second);
+                d->block = block;
+                d->treeNumber = ch->GetTreeNumber();
+                m_deltaDecoders[treeName][branchName] = d;
+                log << MSG::INFO << "Input item " << branchName << " of " << treeName
+                    << " is delta encoded, blocks of " << block << " rows" << endreq;
+                continue;
+            }
+        }
+        if (typeName != "Int_t") continue;
+        DictDecoder* d = new DictDecoder;
+        if (!loadDictionary(treeName, branchName, ch, *d)) {
+            delete d;
+            continue;
+        }
+        d->code = static_cast<Int_t*>(poolit->second);
+        // fixed size, since clients keep the pointer: enough for the longest value of any input file
+        d->text.assign(std::max<size_t>(256, longestDictionaryValue(treeName, branchName, ch)+1), 0);
+        d->decode();
+        m_dictDecoders[treeName][branchName] = d;
+        log << MSG::INFO << "Input item " << branchName << " of " << treeName << " is dictionary encoded, "
+            << d->values.size() << " values" << endreq;
+    }
+    saveDir->cd();
+}
+
+void RootTupleSvc::decodeInputs(const std::string& treeName, TChain* ch)
+{
+    std::map<std::string, std::map<std::string, DeltaDecoder*> >::iterator deltait = m_deltaDecoders.find(treeName);
+    if (deltait != m_deltaDecoders.end()) {
+        TTree* tree = ch->GetTree();
+        for (std::map<std::string, DeltaDecoder*>::iterator it = deltait->second.begin(); it != deltait->second.end(); ++it) {
+            DeltaDecoder* d = it->second;
+            if (d->treeNumber != ch->GetTreeNumber()) {
+                TDirectory* saveDir = gDirectory;
+                d->block = deltaBlock(treeName, it->first, ch);
+                saveDir->cd();
+                // a file written without encoding: its values are whole
+                if (d->block <= 0) d->block = 1;
+            }
+            d->decode(tree, it->first, tree->GetReadEntry(), ch->GetTreeNumber());
+        }
+    }
+
+    std::map<std::string, std::map<std::string, DictDecoder*> >::iterator decit = m_dictDecoders.find(treeName);
+    if (decit == m_dictDecoders.end()) return;
+    for (std::map<std::string, DictDecoder*>::iterator it = decit->second.begin(); it != decit->second.end(); ++it) {
+        DictDecoder* d = it->second;
+        // each file has its own dictionary
+        if (d->treeNumber != ch->GetTreeNumber()) {
+            TDirectory* saveDir = gDirectory;
+            if (!loadDictionary(treeName, it->first, ch, *d)) d->values.clear();
+            d->treeNumber = ch->GetTreeNumber();
+            saveDir->cd();
+        }
+        d->decode();
+    }
+}
+
+TFile* RootTupleSvc::encodingFile(const std::string& treeName)
+{
+    // a tree given to a TupleSink is in memory: its dictionaries go to the main file
+    TFile* f = m_tree[treeName]->GetCurrentFile();
+    if (f == 0 && m_sink.find(treeName) != m_sink.end()) f = m_fileCol[m_filename.value()];
+    return f;
+}
+
+void RootTupleSvc::writeEncodings(MsgStream& log)
+{
+    TDirectory* saveDir = gDirectory;
+    for (std::map<std::string, std::vector<DeltaEncoder*> >::iterator it = m_deltaEncoders.begin();
+         it != m_deltaEncoders.end(); ++it) {
+        TFile* f = encodingFile(it->first);
+        for (unsigned int i = 0; i<it->second.size(); ++i) {
+            DeltaEncoder* d = it->second[i];
+            if (f != 0) {
+                writeDeltaBlock(it->first, *d, f);
+                // the gain: what the column took whole, and what it takes now
+                TBranch* b = m_tree[it->first]->GetBranch(d->item.c_str());
+                b->FlushBaskets();
+                int width = d->type == 'l' ? 8 : 4;
+                long long deltas = d->rows - (d->rows + d->block - 1)/d->block;
+                log << MSG::INFO << "Item " << d->item << " of " << it->first << ": " << d->rows << " rows of "
+                    << width << " bytes, differences of " << (deltas > 0 ? d->bits/deltas : 0.)
+                    << " bits on average, " << b->GetZipBytes() << " bytes compressed" << endreq;
+            }
+            delete d;
+        }
+    }
+    m_deltaEncoders.clear();
+
+    for (std::map<std::string, std::vector<DictEncoder*> >::iterator it = m_dictEncoders.begin();
+         it != m_dictEncoders.end(); ++it) {
+        TFile* f = encodingFile(it->first);
+        for (unsigned int i = 0; i<it->second.size(); ++i) {
+            DictEncoder* d = it->second[i];
+            if (f != 0) {
+                writeDictionary(it->first, *d, f);
+                log << MSG::INFO << "Item " << d->item << " of " << it->first << ": "
+                    << d->values.size() << " distinct values, in " << dictionaryName(it->first, d->item) << endreq;
+            }
+            delete d;
+        }
+    }
+    m_dictEncoders.clear();
+    saveDir->cd();
+}
+
+void RootTupleSvc::writeDictionary(const std::string& treeName, const DictEncoder& d, TFile* f)
+{
+    TDirectory* saveDir = gDirectory;
+    f->cd();
+    std::string dictName = dictionaryName(treeName, d.item);
+    f->Delete((dictName+";*").c_str());
+    TTree* dict = new TTree(dictName.c_str(), ("values of "+treeName+"."+d.item).c_str());
+    Int_t code = 0;
+    size_t longest = 0;
+    for (unsigned int k = 0; k<d.values.size(); ++k) longest = std::max(longest, d.values[k].size());
+    std::vector<char> value(longest+1, 0);
+    dict->Branch("code", &code, "code/I");
+    dict->Branch("value", &value[0], "value/C");
+    for (code = 0; code<(Int_t)d.values.size(); ++code) {
+        strcpy(&value[0], d.values[code].c_str());
+        dict->Fill();
+    }
+    dict->Write(0, TObject::kOverwrite);
+    delete dict;
+    saveDir->cd();
+}
+
+void RootTupleSvc::writeDeltaBlock(const std::string& treeName, const DeltaEncoder& d, TFile* f)
+{
+    TDirectory* saveDir = gDirectory;
+    f->cd();
+    TParameter<int> block(deltaName(treeName, d.item).c_str(), d.block);
+    f->WriteTObject(&block, 0, "Overwrite");
+    saveDir->cd();
+}
+
+void RootTupleSvc::resumeEncoders(const std::string& treeName, MsgStream& log)
+{
+    std::map<std::string, std::vector<DictEncoder*> >::iterator dictit = m_dictEncoders.find(treeName);
+    if (dictit != m_dictEncoders.end()) {
+        for (unsigned int i = 0; i<dictit->second.size(); ++i) resumeEncoder(treeName, *dictit->second[i], log);
+    }
+    std::map<std::string, std::vector<DeltaEncoder*> >::iterator deltait = m_deltaEncoders.find(treeName);
+    if (deltait != m_deltaEncoders.end()) {
+        for (unsigned int i = 0; i<deltait->second.size(); ++i) resumeEncoder(treeName, *deltait->second[i], log);
+    }
+}
+
+void RootTupleSvc::resumeEncoder(const std::string& treeName, DictEncoder& d, MsgStream& log)
+{
+    TTree* t = m_tree[treeName];
+    TFile* f = t->GetCurrentFile();
+    TDirectory* saveDir = gDirectory;
+    TTree* dict = 0;
+    if (f != 0) f->GetObject(dictionaryName(treeName, d.item).c_str(), dict);
+    saveDir->cd();
+    if (dict == 0) {
+        if (t->GetEntries() > 0)
+            log << MSG::WARNING << "No dictionary saved for item " << d.item << " of resumed tree " << treeName
+                << ": the codes of its first " << t->GetEntries() << " entries are lost" << endreq;
+        return;
+    }
+    readDictionary(dict, d.values);
+    delete dict;
+    d.codes.clear();
+    for (unsigned int code = 0; code<d.values.size(); ++code) d.codes[d.values[code]] = code;
+    log << MSG::DEBUG << "Item " << d.item << " of " << treeName << ": " << d.values.size()
+        << " values from the checkpoint" << endreq;
+}
+
+void RootTupleSvc::resumeEncoder(const std::string& treeName, DeltaEncoder& d, MsgStream& log)
+{
+    TTree* t = m_tree[treeName];
+    TBranch* b = t->GetBranch(d.item.c_str());
+    TFile* f = t->GetCurrentFile();
+    TDirectory* saveDir = gDirectory;
+    TParameter<int>* block = 0;
+    if (f != 0) f->GetObject(deltaName(treeName, d.item).c_str(), block);
+    saveDir->cd();
+    // the blocks go on where the checkpoint left them: same size, counted from the first entry
+    if (block != 0) {
+        if (block->GetVal() > 0) d.block = block->GetVal();
+        delete block;
+    }
+    d.rows = t->GetEntries();
+    d.previous = 0;
+    if (b == 0 || d.rows == 0) return;
+    // the last value written: summed from the start of its block
+    ULong64_t value = 0;
+    DeltaDecoder decoder(d.type, &value);
+    decoder.block = d.block;
+    b->SetAddress(&value);
+    b->GetEntry(d.rows-1);
+    decoder.decode(t, d.item, d.rows-1, 0);
+    b->SetAddress(d.buffer());
+    d.previous = decoder.previous;
+    log << MSG::DEBUG << "Item " << d.item << " of " << treeName << ": delta encoding continues at row "
+        << d.rows << endreq;
+}
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void RootTupleSvc::writeZoneMaps(MsgStream& log)
+{
+    TDirectory* saveDir = gDirectory;
+    for (std::map<std::string, ZoneMap>::iterator it = m_zoneMaps.begin(); it != m_zoneMaps.end(); ++it) {
+        TTree* t = m_tree[it->first];
+        ZoneMap& zones = it->second;
+        zones.close(t->GetEntries());
+        TFile* f = t->GetCurrentFile();
+        if (f == 0 || zones.cols.empty()) continue;
+        f->cd();
+        std::string zoneName = zoneMapName(it->first);
+        int n = zones.cols.size();
+        TTree* zt = new TTree(zoneName.c_str(), ("zone map of "+it->first).c_str());
+        Long64_t first = 0, size = 0;
+        std::vector<double> mins(n), maxs(n);
+        std::vector<Int_t> nonFinite(n);
+        std::string dim = "[" + std::to_string(n) + "]";
+        zt->Branch("first", &first, "first/L");
+        zt->Branch("entries", &size, "entries/L");
+        zt->Branch("min", &mins[0], ("min"+dim+"/D").c_str());
+        zt->Branch("max", &maxs[0], ("max"+dim+"/D").c_str());
+        zt->Branch("nonFinite", &nonFinite[0], ("nonFinite"+dim+"/I").c_str());
+        for (unsigned int zone = 0; zone<zones.firsts.size(); ++zone) {
+            first = zones.firsts[zone];
+            size = zones.sizes[zone];
+            std::copy(zones.mins.begin()+zone*n, zones.mins.begin()+(zone+1)*n, mins.begin());
+            std::copy(zones.maxs.begin()+zone*n, zones.maxs.begin()+(zone+1)*n, maxs.begin());
+            std::copy(zones.nonFinites.begin()+zone*n, zones.nonFinites.begin()+(zone+1)*n, nonFinite.begin());
+            zt->Fill();
+        }
+        zt->ResetBranchAddresses();
+        // the items of the min, max and nonFinite arrays
+        std::string names;
+        for (int i = 0; i<n; ++i) names += (i == 0 ? "" : ",") + zones.cols[i].name;
+        TNamed columns((zoneName+"_columns").c_str(), names.c_str());
+        f->WriteTObject(&columns, 0, "Overwrite");
+        log << MSG::INFO << "Tree " << it->first << ": " << zones.firsts.size() << " zones of "
+            << n << " items in " << zoneName << endreq;
+    }
+    m_zoneMaps.clear();
+    saveDir->cd();
+}
 
+void RootTupleSvc::loadZones(TChain* ch, MsgStream& log)
+{
+    m_inputZones = InputZones();
+    m_inputZones.treeNumber = ch->GetTreeNumber();
+    TDirectory* saveDir = gDirectory;
+    TFile* f = ch->GetFile();
+    std::string zoneName = zoneMapName(m_cutTree);
+    TTree* zones = 0;
+    TNamed* columns = 0;
+    if (f != 0) {
+        f->GetObject(zoneName.c_str(), zones);
+        f->GetObject((zoneName+"_columns").c_str(), columns);
+    }
+    if (zones == 0 || columns == 0) {
+        log << MSG::INFO << "No zone map of " << m_cutTree << " in input file "
+            << (f != 0 ? f->GetName() : "") << ": all its entries are read" << endreq;
+        delete zones;
+        delete columns;
+        saveDir->cd();
+        return;
+    }
+
+    std::vector<std::string> names;
+    std::string list(columns->GetTitle());
+    for (std::string::size_type start = 0, comma; start <= list.size(); start = comma+1) {
+        comma = list.find(',', start);
+        if (comma == std::string::npos) comma = list.size();
+        names.push_back(list.substr(start, comma-start));
+    }
+    delete columns;
+
+    // the cut items, in the zone map arrays
+    const std::vector<std::string>& cutNames = m_cut.names();
+    std::vector<int> index;
+    for (unsigned int i = 0; i<cutNames.size(); ++i) {
+        std::vector<std::string>::const_iterator it = std::find(names.begin(), names.end(), cutNames[i]);
+        if (it == names.end()) {
+            log << MSG::WARNING << "No zone map of item " << cutNames[i] << " of " << m_cutTree
+                << " in input file " << f->GetName() << ": all its entries are read" << endreq;
+            delete zones;
+            saveDir->cd();
+            return;
+        }
+        index.push_back(it - names.begin());
+    }
+
+    Long64_t first = 0, size = 0;
+    std::vector<double> mins(names.size()), maxs(names.size());
+    std::vector<Int_t> nonFinite(names.size());
+    zones->SetBranchAddress("first", &first);
+    zones->SetBranchAddress("entries", &size);
+    zones->SetBranchAddress("min", &mins[0]);
+    zones->SetBranchAddress("max", &maxs[0]);
+    zones->SetBranchAddress("nonFinite", &nonFinite[0]);
+    for (long long entry = 0; entry<zones->GetEntries(); ++entry) {
+        zones->GetEntry(entry);
+        m_inputZones.firsts.push_back(first);
+        m_inputZones.sizes.push_back(size);
+        m_inputZones.mins.push_back(std::vector<double>(index.size()));
+        m_inputZones.maxs.push_back(std::vector<double>(index.size()));
+        m_inputZones.nonFinites.push_back(std::vector<int>(index.size()));
+        for (unsigned int i = 0; i<index.size(); ++i) {
+            m_inputZones.mins.back()[i] = mins[index[i]];
+            m_inputZones.maxs.back()[i] = maxs[index[i]];
+            m_inputZones.nonFinites.back()[i] = nonFinite[index[i]];
+        }
+    }
+    delete zones;
+    log << MSG::DEBUG << "Input file " << f->GetName() << ": " << m_inputZones.firsts.size()
+        << " zones of " << m_cutTree << endreq;
+    saveDir->cd();
+}
+
+bool RootTupleSvc::selectiveInput() const
+{
+    return !m_inChain.empty() && (!m_cut.empty() || m_endingIndex >= 0 || m_scheduled);
+}
+
+void RootTupleSvc::stopInput(MsgStream& log)
+{
+    log << MSG::INFO << "No input entry left to read, stopping the run" << endreq;
+    IEventProcessor* eventProcessor = 0;
+    if (service("ApplicationMgr", eventProcessor).isSuccess()) eventProcessor->stopRun();
+    m_inputDone = true;
+}
+
+bool RootTupleSvc::skipToSelected(MsgStream& log)
+{
+    // a list of keys decides alone
+    if (m_scheduled) {
+        if (m_schedulePos >= m_schedule.size()) return false;
+        m_nextEvent = m_schedule[m_schedulePos++];
+        return true;
+    }
+    long long end = m_endingIndex >= 0 ? std::min(m_endingIndex, m_nevents) : m_nevents;
+    if (m_cut.empty() || m_cutTree.empty()) return m_nextEvent < end;
+    std::map<std::string, TChain*>::iterator chit = m_inChain.find(m_cutTree);
+    if (chit == m_inChain.end()) {
+        log << MSG::WARNING << "InputCut: no input tree " << m_cutTree << ", no entry is skipped" << endreq;
+        m_cutTree.clear();
+        return m_nextEvent < end;
+    }
+    TChain* ch = chit->second;
+    while (m_nextEvent < end) {
+        usePrefetched(m_nextEvent);
+        long long local = ch->LoadTree(m_nextEvent);
+        if (local < 0) break;
+        if (m_inputZones.treeNumber != ch->GetTreeNumber()) loadZones(ch, log);
+        int zone = m_inputZones.find(local);
+        if (zone < 0 || m_cut.mayMatch(m_inputZones.mins[zone], m_inputZones.maxs[zone],
+                                         m_inputZones.nonFinites[zone])) break;
+        // no entry of this zone can pass
+        long long skip = m_inputZones.firsts[zone] + m_inputZones.sizes[zone] - local;
+        m_nextEvent += skip;
+        m_entriesSkipped += skip;
+        ++m_zonesSkipped;
+    }
+    return m_nextEvent < end;
+}
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void RootTupleSvc::sampleCompression(const std::string& treeName, TTree* t, CompressionTuning& tuning)
+{
+    if (tuning.cols.empty()) {
+        // the items are all added by the first row
+        describeColumns(t, tuning.cols);
+        tuning.samples.resize(tuning.cols.size());
+        std::map<std::string, std::map<std::string, int> >::const_iterator tableit = m_compressionTable.find(treeName);
+        if (tableit != m_compressionTable.end()) {
+            // chosen by an earlier job: branches it did not see keep the file's setting
+            for (unsigned int i = 0; i<tuning.cols.size(); ++i) {
+                std::map<std::string, int>::const_iterator it = tableit->second.find(tuning.cols[i].name);
+                CompressionTrial trial;
+                if (it != tableit->second.end()) {
+                    tuning.cols[i].branch->SetCompressionSettings(it->second);
+                    trial.settings = it->second;
+                } else {
+                    trial.settings = tuning.cols[i].branch->GetCompressionSettings();
+                }
+                tuning.chosen.push_back(trial);
+            }
+            tuning.done = true;
+            MsgStream log(msgSvc(),name());
+            log << MSG::INFO << "Tree " << treeName << ": compression of " << tableit->second.size()
+                << " branches from " << m_compressionTableFile.value() << endreq;
+            return;
+        }
+    }
+    for (unsigned int i = 0; i<tuning.cols.size(); ++i) {
+        const char* p = tuning.cols[i].branch->GetAddress();
+        if (p == 0) continue;
+        tuning.samples[i].append(p, tuning.cols[i].type=='C' ? strlen(p)+1 : tuning.cols[i].bytes());
+    }
+    if (++tuning.rows >= m_compressionTuneEvents) chooseCompression(treeName, tuning);
+}
+
+void RootTupleSvc::chooseCompression(const std::string& treeName, CompressionTuning& tuning)
+{
+    const std::string& objective = m_compressionObjective.value();
+    std::map<int, int> count; // branches per setting
+    long long before = 0, after = 0;
+    for (unsigned int i = 0; i<tuning.cols.size(); ++i) {
+        std::vector<CompressionTrial> trials;
+        long long smallest = 0;
+        for (unsigned int c = 0; c<m_candidateSettings.size(); ++c) {
+            trials.push_back(trialCompress(tuning.samples[i], m_candidateSettings[c], m_bufferSize));
+            if (c == 0 || trials[c].compressedBytes < smallest) smallest = trials[c].compressedBytes;
+        }
+        // the fastest of those small enough, or the smallest
+        unsigned int best = 0;
+        for (unsigned int c = 1; c<trials.size(); ++c) {
+            const CompressionTrial& a = trials[c];
+            const CompressionTrial& b = trials[best];
+            bool better;
+            if (objective == "size") {
+                better = a.compressedBytes < b.compressedBytes
+                    || (a.compressedBytes == b.compressedBytes && a.decompressSeconds < b.decompressSeconds);
+            } else {
+                bool small = a.compressedBytes <= m_compressionSizeTolerance*smallest;
+                bool bestSmall = b.compressedBytes <= m_compressionSizeTolerance*smallest;
+                double ta = objective == "write" ? a.compressSeconds : a.decompressSeconds;
+                double tb = objective == "write" ? b.compressSeconds : b.decompressSeconds;
+                better = small && (!bestSmall || ta < tb);
+            }
+            if (better) best = c;
+        }
+        tuning.cols[i].branch->SetCompressionSettings(trials[best].settings);
+        tuning.chosen.push_back(trials[best]);
+        ++count[trials[best].settings];
+        before += trials[best].bytes;
+        after += trials[best].compressedBytes;
+        std::string().swap(tuning.samples[i]);
+    }
+    tuning.done = true;
+
+    MsgStream log(msgSvc(),name());
+    log << MSG::INFO << "Tree " << treeName << ": compression chosen for " << tuning.cols.size()
+        << " branches from " << tuning.rows << " rows, objective " << objective << ", sample ratio "
+        << (after > 0 ? double(before)/after : 1.) << ":";
+    for (std::map<int, int>::const_iterator it = count.begin(); it != count.end(); ++it)
+        log << " " << compressionName(it->first) << " " << it->second;
+    log << endreq;
+}
+
+StatusCode RootTupleSvc::readCompressionTables(MsgStream& log)
+{
+    m_compressionTable.clear();
+    std::string fileName(m_compressionTableFile.value());
+    if (fileName.empty()) return StatusCode::SUCCESS;
+    facilities::Util::expandEnvVar(&fileName);
+    TDirectory* saveDir = gDirectory;
+    TFile f(fileName.c_str(), "READ");
+    if (!f.IsOpen()) {
+        log << MSG::ERROR << "CompressionTable: cannot open " << fileName << endreq;
+        saveDir->cd();
+        return StatusCode::FAILURE;
+    }
+    std::string suffix = compressionTableName("");
+    TIter next(f.GetListOfKeys());
+    while (TKey* key = (TKey*)next()) {
+        std::string keyName(key->GetName());
+        if (std::string(key->GetClassName()) != "TTree" || keyName.size() <= suffix.size()
+            || keyName.compare(keyName.size()-suffix.size(), suffix.size(), suffix) != 0) continue;
+        TTree* table = (TTree*)key->ReadObj();
+        // as for a dictionary: the leaf knows the size of its longest name
+        TLeaf* leaf = table->GetLeaf("branch");
+        std::vector<char> branch((leaf != 0 ? std::max(leaf->GetMaximum(), 0) : 0) + 1, 0);
+        Int_t settings = 0;
+        table->SetBranchAddress("branch", &branch[0]);
+        table->SetBranchAddress("settings", &settings);
+        std::map<std::string, int>& tree = m_compressionTable[keyName.substr(0, keyName.size()-suffix.size())];
+        for (long long entry = 0; entry<table->GetEntries(); ++entry) {
+            table->GetEntry(entry);
+            tree[&branch[0]] = settings;
+        }
+        delete table;
+    }
+    log << MSG::INFO << "CompressionTable: settings of " << m_compressionTable.size() << " trees from "
+        << fileName << endreq;
+    f.Close();
+    saveDir->cd();
+    return StatusCode::SUCCESS;
+}
+
+void RootTupleSvc::writeCompressionTables(MsgStream& log)
+{
+    TDirectory* saveDir = gDirectory;
+    for (std::map<std::string, CompressionTuning>::iterator it = m_compressionTuning.begin();
+         it != m_compressionTuning.end(); ++it) {
+        CompressionTuning& tuning = it->second;
+        // too few rows to choose: choose from those
+        if (!tuning.done && tuning.rows > 0) chooseCompression(it->first, tuning);
+        TFile* f = m_tree[it->first]->GetCurrentFile();
+        if (f == 0 || tuning.chosen.empty()) continue;
+        f->cd();
+        TTree* table = new TTree(compressionTableName(it->first).c_str(),
+                                 ("compression of the branches of "+it->first).c_str());
+        size_t longest = 0;
+        for (unsigned int i = 0; i<tuning.cols.size(); ++i) longest = std::max(longest, tuning.cols[i].name.size());
+        std::vector<char> branch(longest+1), setting(16);
+        Int_t settings = 0;
+        Double_t ratio = 0, compressMBs = 0, decompressMBs = 0;
+        table->Branch("branch", &branch[0], "branch/C");
+        table->Branch("settings", &settings, "settings/I");
+        table->Branch("setting", &setting[0], "setting/C");
+        table->Branch("ratio", &ratio, "ratio/D");
+        table->Branch("compressMBs", &compressMBs, "compressMBs/D");
+        table->Branch("decompressMBs", &decompressMBs, "decompressMBs/D");
+        for (unsigned int i = 0; i<tuning.chosen.size(); ++i) {
+            const CompressionTrial& trial = tuning.chosen[i];
+            strcpy(&branch[0], tuning.cols[i].name.c_str());
+            strncpy(&setting[0], compressionName(trial.settings).c_str(), setting.size()-1);
+            settings = trial.settings;
+            ratio = trial.ratio();
+            compressMBs = trial.compressSpeed();
+            decompressMBs = trial.decompressSpeed();
+            table->Fill();
+        }
+        table->ResetBranchAddresses();
+        log << MSG::DEBUG << "Compression settings of " << it->first << " written to "
+            << compressionTableName(it->first) << endreq;
+    }
+    m_compressionTuning.clear();
+    saveDir->cd();
+}
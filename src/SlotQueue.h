@@ -0,0 +1,75 @@
+/** @file SlotQueue.h
+    @brief declare SlotRecord and SlotQueue, the submission queue of the concurrent mode
+
+    $Header$
+*/
+#ifndef ntupleWriterSvc_SlotQueue_h
+#define ntupleWriterSvc_SlotQueue_h
+
+#include <atomic>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct ConcurrentTree;
+
+/** @class SlotRecord
+    @brief The rows stored by one event of a slot, packed by packRow
+*/
+struct SlotRecord {
+    SlotRecord() : next(0), eventIndex(0) {}
+    std::atomic<SlotRecord*> next; ///< link used by SlotQueue
+    long long eventIndex;
+    /// tree, and its packed row; empty if the event stored no rows
+    std::vector<std::pair<ConcurrentTree*, std::string> > rows;
+};
+
+/** @class SlotQueue
+    @brief Unbounded lock-free queue of SlotRecords, for many producers and one consumer
+
+    Intrusive linked list with a stub node (D. Vyukov's MPSC queue): push is one atomic
+    exchange, so a slot never waits for another slot or for the writer. pop may return 0
+    while a push is in progress, in which case the consumer tries again later.
+*/
+class SlotQueue {
+public:
+    SlotQueue() : m_head(&m_stub), m_tail(&m_stub) {}
+
+    /// called by any thread
+    void push(SlotRecord* r) {
+        r->next.store(0, std::memory_order_relaxed);
+        SlotRecord* prev = m_head.exchange(r, std::memory_order_acq_rel);
+        prev->next.store(r, std::memory_order_release);
+    }
+
+    /// called by the consumer thread only: the oldest record, or 0
+    SlotRecord* pop() {
+        SlotRecord* tail = m_tail;
+        SlotRecord* next = tail->next.load(std::memory_order_acquire);
+        if (tail == &m_stub) {
+            if (next == 0) return 0;
+            m_tail = next;
+            tail = next;
+            next = next->next.load(std::memory_order_acquire);
+        }
+        if (next != 0) {
+            m_tail = next;
+            return tail;
+        }
+        if (tail != m_head.load(std::memory_order_acquire)) return 0; // push in progress
+        push(&m_stub);
+        next = tail->next.load(std::memory_order_acquire);
+        if (next != 0) {
+            m_tail = next;
+            return tail;
+        }
+        return 0;
+    }
+
+private:
+    std::atomic<SlotRecord*> m_head;
+    SlotRecord* m_tail;
+    SlotRecord  m_stub;
+};
+
+#endif
@@ -0,0 +1,179 @@
+/** @file StreamSink.cxx
+    @brief implement StreamSink and StreamConnection
+
+    $Header$
+*/
+// Unix sockets, not built on Windows (see SConscript)
+#ifndef WIN32
+#include "StreamSink.h"
+#include "ntupleWriterSvc/TupleStream.h"
+
+#include "TBranch.h"
+
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <sys/un.h>
+#include <unistd.h>
+
+StreamConnection::StreamConnection()
+: m_fd(-1), m_streams(0), m_credits(0), m_batches(0), m_bytes(0), m_waitSeconds(0)
+{}
+
+StreamConnection::~StreamConnection()
+{
+    if (m_fd >= 0) close(m_fd);
+}
+
+bool StreamConnection::open(const std::string& path)
+{
+    sockaddr_un address;
+    if (path.size() >= sizeof(address.sun_path)) {
+        m_error = "socket path too long";
+        return false;
+    }
+    m_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (m_fd < 0) {
+        m_error = std::string("socket: ") + strerror(errno);
+        return false;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path)-1);
+    if (connect(m_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        m_error = std::string("connect: ") + strerror(errno);
+        close(m_fd);
+        m_fd = -1;
+        return false;
+    }
+    return true;
+}
+
+void StreamConnection::send(int type, const std::string& payload)
+{
+    if (m_fd < 0 || !TupleStream::sendFrame(m_fd, TupleStream::FrameType(type), payload))
+        throw std::runtime_error("StreamConnection: the consumer is gone");
+    m_bytes += sizeof(TupleStream::FrameHeader) + payload.size();
+}
+
+void StreamConnection::receive(bool ack)
+{
+    std::uint32_t type = 0;
+    std::string payload;
+    while (true) {
+        if (!TupleStream::recvFrame(m_fd, type, payload))
+            throw std::runtime_error("StreamConnection: the consumer is gone");
+        if (type == TupleStream::Credit) {
+            TupleStream::Reader in(payload);
+            m_credits += in.get<std::uint32_t>();
+            if (!ack) return;
+        } else if (type == TupleStream::Ack && ack) {
+            return;
+        } else {
+            throw std::runtime_error("StreamConnection: unexpected frame from the consumer");
+        }
+    }
+}
+
+void StreamConnection::sendSchema(const std::string& payload)
+{
+    send(TupleStream::Schema, payload);
+}
+
+void StreamConnection::sendBatch(const std::string& payload)
+{
+    if (m_credits == 0) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        while (m_credits == 0) receive(false);
+        m_waitSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    --m_credits;
+    send(TupleStream::Batch, payload);
+    ++m_batches;
+}
+
+void StreamConnection::finish()
+{
+    if (m_fd < 0) return;
+    send(TupleStream::End, std::string());
+    receive(true);
+    close(m_fd);
+    m_fd = -1;
+}
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+StreamSink::StreamSink(StreamConnection* connection, const std::string& name, TTree* schema,
+                       unsigned int batchRows)
+: m_connection(connection), m_name(name), m_schema(schema), m_stream(connection->newStream())
+, m_batchRows(batchRows > 0 ? batchRows : 1), m_entries(0), m_started(false), m_closed(false), m_rows(0)
+{}
+
+StreamSink::~StreamSink()
+{}
+
+void StreamSink::bind()
+{
+    // the addresses are read from the branches at each row
+    if (m_started) return;
+    m_cols.clear();
+    describeColumns(m_schema, m_cols);
+}
+
+void StreamSink::start()
+{
+    bind();
+    std::string schema;
+    TupleStream::put<std::uint32_t>(schema, m_stream);
+    TupleStream::putString(schema, m_name);
+    TupleStream::put<std::uint32_t>(schema, m_cols.size());
+    for (unsigned int i = 0; i<m_cols.size(); ++i) {
+        if (m_cols[i].type == 0)
+            throw std::invalid_argument("StreamSink: unsupported type for item "+m_cols[i].name);
+        TupleStream::putString(schema, m_cols[i].leafName);
+        TupleStream::put<char>(schema, m_cols[i].type);
+        TupleStream::put<std::uint32_t>(schema, m_cols[i].size);
+        TupleStream::put<std::uint32_t>(schema, m_cols[i].length);
+    }
+    m_connection->sendSchema(schema);
+    m_values.resize(m_cols.size());
+    for (unsigned int i = 0; i<m_cols.size(); ++i) {
+        if (m_cols[i].type != 'C') m_values[i].reserve(size_t(m_batchRows)*m_cols[i].bytes());
+    }
+    m_started = true;
+}
+
+void StreamSink::fill()
+{
+    if (!m_started) start();
+    for (unsigned int i = 0; i<m_cols.size(); ++i) {
+        const char* value = m_cols[i].branch->GetAddress();
+        if (m_cols[i].type == 'C') TupleStream::putString(m_values[i], value);
+        else m_values[i].append(value, m_cols[i].bytes());
+    }
+    ++m_entries;
+    if (++m_rows == m_batchRows) sendBatch();
+}
+
+void StreamSink::sendBatch()
+{
+    std::string batch;
+    TupleStream::put<std::uint32_t>(batch, m_stream);
+    TupleStream::put<std::uint32_t>(batch, m_rows);
+    for (unsigned int i = 0; i<m_values.size(); ++i) {
+        batch.append(m_values[i]);
+        m_values[i].clear();
+    }
+    m_rows = 0;
+    m_connection->sendBatch(batch);
+}
+
+void StreamSink::close()
+{
+    if (m_closed) return;
+    m_closed = true;
+    // the consumer gets the schema of an empty tuple too
+    if (!m_started) start();
+    if (m_rows > 0) sendBatch();
+}
+
+#endif // WIN32
@@ -0,0 +1,91 @@
+/** @file StreamSink.h
+    @brief declare StreamSink, which sends a tuple over a Unix socket, and its connection
+
+    $Header$
+*/
+#ifndef ntupleWriterSvc_StreamSink_h
+#define ntupleWriterSvc_StreamSink_h
+
+#include "TupleSink.h"
+#include "TupleColumn.h"
+
+#include <string>
+#include <vector>
+
+/** @class StreamConnection
+    @brief The connection to a consumer, shared by the StreamSinks of a job: see ntupleWriterSvc/TupleStream.h
+
+    Sending a batch takes a credit; without one it waits for the consumer to grant more.
+    A failure of the connection throws std::runtime_error: rows are never dropped silently.
+*/
+class StreamConnection {
+public:
+    StreamConnection();
+    ~StreamConnection();
+
+    /// connect to the socket, false with a message in error() if it cannot
+    bool open(const std::string& path);
+    const std::string& error() const { return m_error; }
+
+    /// a number for each stream
+    unsigned int newStream() { return m_streams++; }
+
+    void sendSchema(const std::string& payload);
+    void sendBatch(const std::string& payload);
+    /// send End, and wait until the consumer has acknowledged everything
+    void finish();
+
+    long long batches() const { return m_batches; }
+    long long bytes() const { return m_bytes; }
+    /// time spent waiting for credits
+    double waitSeconds() const { return m_waitSeconds; }
+
+private:
+    void send(int type, const std::string& payload);
+    /// read frames until a credit (or, after End, the Ack) arrives
+    void receive(bool ack);
+
+    int m_fd;
+    std::string m_error;
+    unsigned int m_streams;
+    unsigned int m_credits;
+    long long m_batches, m_bytes;
+    double m_waitSeconds;
+};
+
+/** @class StreamSink
+    @brief TupleSink that sends the rows of a tuple to a consumer, in batches of columns
+
+    The schema is taken from the branches when the first row is written, so all items must be
+    added before then. Rows are kept, column by column, until there are batchRows of them.
+*/
+class StreamSink : public TupleSink {
+public:
+    StreamSink(StreamConnection* connection, const std::string& name, TTree* schema, unsigned int batchRows);
+    virtual ~StreamSink();
+
+    virtual std::string type() const { return "stream"; }
+    virtual void bind();
+    virtual void fill();
+    virtual long long entries() const { return m_entries; }
+    /// send the last batch
+    virtual void close();
+
+private:
+    /// send the schema
+    void start();
+    void sendBatch();
+
+    StreamConnection* m_connection;
+    std::string  m_name;
+    TTree*       m_schema;
+    unsigned int m_stream;
+    unsigned int m_batchRows;
+    long long    m_entries;
+    bool         m_started, m_closed;
+    std::vector<TupleColumn> m_cols;
+    std::vector<std::string> m_values; ///< per column, the rows of the batch so far
+    unsigned int m_rows;
+};
+
+#endif
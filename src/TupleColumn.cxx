@@ -0,0 +1,102 @@
+/** @file TupleColumn.cxx
+    @brief implement describeColumns
+
+    $Header$
+*/
+#include "TupleColumn.h"
+
+#include "TTree.h"
+#include "TBranch.h"
+#include "TLeaf.h"
+#include "TObjArray.h"
+
+#include <cstring>
+
+char columnTypeCode(const std::string& typeName)
+{
+    if (typeName == "Float_t")   return 'F';
+    if (typeName == "Double_t")  return 'D';
+    if (typeName == "Int_t")     return 'I';
+    if (typeName == "UInt_t")    return 'i';
+    if (typeName == "ULong64_t") return 'l';
+    if (typeName == "Char_t")    return 'C';
+    return 0;
+}
+
+void describeColumns(TTree* t, std::vector<TupleColumn>& cols)
+{
+    cols.clear();
+    TObjArray* ta = t->GetListOfBranches();
+    int entries = ta->GetEntries();
+    cols.reserve(entries);
+    for( int i = 0; i<entries; ++i) {
+        TBranch* b = (TBranch*)(*ta)[i];
+        TLeaf* leaf = (TLeaf*)(*b->GetListOfLeaves())[0];
+        TupleColumn col;
+        col.name     = b->GetName();
+        col.leafName = leaf->GetName();
+        col.type     = columnTypeCode(leaf->GetTypeName());
+        col.size     = leaf->GetLenType();
+        col.length   = leaf->GetLenStatic();
+        col.branch   = b;
+        col.leaf     = leaf;
+        col.address  = b->GetAddress();
+        cols.push_back(col);
+    }
+}
+
+void packRow(const std::vector<TupleColumn>& cols, const std::vector<const void*>& addresses,
+             std::string& out)
+{
+    for (unsigned int i = 0; i<cols.size(); ++i) {
+        const char* p = static_cast<const char*>(addresses[i]);
+        if (cols[i].type=='C') out.append(p, strlen(p)+1);
+        else                   out.append(p, cols[i].bytes());
+    }
+}
+
+RowStaging::RowStaging(TTree* t)
+: m_tree(t), m_attached(false)
+{
+    describeColumns(t, m_cols);
+    m_buffers.resize(m_cols.size());
+    for (unsigned int i = 0; i<m_cols.size(); ++i) {
+        int bytes = m_cols[i].type=='C' ? 64 : m_cols[i].bytes();
+        m_buffers[i].assign(bytes/sizeof(double)+1, 0);
+    }
+}
+
+RowStaging::~RowStaging()
+{
+    detach();
+}
+
+void RowStaging::attach()
+{
+    for (unsigned int i = 0; i<m_cols.size(); ++i) m_cols[i].branch->SetAddress(column(i));
+    m_attached = true;
+}
+
+void RowStaging::detach()
+{
+    if (!m_attached) return;
+    for (unsigned int i = 0; i<m_cols.size(); ++i) m_cols[i].branch->SetAddress(m_cols[i].address);
+    m_attached = false;
+}
+
+bool RowStaging::unpack(const char* row)
+{
+    bool moved = false;
+    const char* p = row;
+    for (unsigned int i = 0; i<m_cols.size(); ++i) {
+        size_t n = m_cols[i].type=='C' ? strlen(p)+1 : m_cols[i].bytes();
+        if (n > m_buffers[i].size()*sizeof(double)) {
+            m_buffers[i].assign(n/sizeof(double)+1, 0);
+            if (m_attached) m_cols[i].branch->SetAddress(column(i));
+            moved = true;
+        }
+        memcpy(column(i), p, n);
+        p += n;
+    }
+    return moved;
+}
@@ -0,0 +1,88 @@
+/** @file TupleColumn.h
+    @brief declare TupleColumn, a flat description of one tuple item
+
+    $Header$
+*/
+#ifndef ntupleWriterSvc_TupleColumn_h
+#define ntupleWriterSvc_TupleColumn_h
+
+#include <string>
+#include <vector>
+
+class TTree;
+class TBranch;
+class TLeaf;
+
+/** @class TupleColumn
+    @brief Description of an item registered with addItem, taken from its TBranch and TLeaf
+
+    The ROOT type codes are the ones used by RootTupleSvc::addAnyItem:
+    'D', 'F', 'I', 'i', 'l' and 'C'.
+*/
+struct TupleColumn {
+    std::string name;     ///< branch name, as passed to addItem (including any [n])
+    std::string leafName; ///< leaf name, without the array dimension
+    char        type;     ///< ROOT leaflist type code
+    int         size;     ///< bytes per element
+    int         length;   ///< number of elements, 1 for a scalar
+    TBranch*    branch;
+    TLeaf*      leaf;
+    void*       address;  ///< current branch address (the client's variable)
+
+    /// bytes in one row of this column (not meaningful for 'C')
+    int bytes() const { return size*length; }
+    /// true for the floating point types that are checked for non-finite values
+    bool isFloat() const { return type=='F' || type=='D'; }
+};
+
+/// describe all the branches of a tree, in branch order
+void describeColumns(TTree* t, std::vector<TupleColumn>& cols);
+
+/** @brief append the current values of the columns to a packed row
+    @param cols - the columns
+    @param addresses - where to read each column: the client variable, or a copy of it
+    @param out - packed values are appended here: the bytes of each column in turn,
+                 a string column taking its length plus the terminating zero
+*/
+void packRow(const std::vector<TupleColumn>& cols, const std::vector<const void*>& addresses,
+             std::string& out);
+
+/** @class RowStaging
+    @brief Buffers standing in for the client variables of a tree, for rows copied from elsewhere
+
+    While attached, the branches of the tree point at the staging buffers, so that TTree::Fill
+    writes whatever was copied there, and the client variables are not touched.
+*/
+class RowStaging {
+public:
+    explicit RowStaging(TTree* t);
+    ~RowStaging();
+
+    /// point the branches at the staging buffers
+    void attach();
+    /// point the branches back at the client variables
+    void detach();
+    bool attached() const { return m_attached; }
+
+    /// the columns, with the client addresses
+    const std::vector<TupleColumn>& columns() const { return m_cols; }
+    /// the staging buffer of a column
+    char* column(unsigned int i) { return reinterpret_cast<char*>(&m_buffers[i][0]); }
+
+    /** @brief copy a row made by packRow into the staging buffers
+    @return true if a buffer moved: a string longer than its buffer makes the buffer grow,
+    and the branch is pointed at the new one
+    */
+    bool unpack(const char* row);
+
+private:
+    TTree* m_tree;
+    std::vector<TupleColumn> m_cols;
+    std::vector<std::vector<double> > m_buffers; ///< double, to keep every buffer aligned
+    bool m_attached;
+};
+
+/// ROOT leaflist type code corresponding to a TLeaf type name, 0 if not supported
+char columnTypeCode(const std::string& typeName);
+
+#endif
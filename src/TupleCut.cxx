@@ -0,0 +1,136 @@
+/** @file TupleCut.cxx
+    @brief implement TupleCut
+
+    $Header$
+*/
+#include "TupleCut.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+
+namespace {
+    /// split on a two character separator
+    std::vector<std::string> split(const std::string& s, const std::string& separator)
+    {
+        std::vector<std::string> parts;
+        std::string::size_type start = 0, pos;
+        while ((pos = s.find(separator, start)) != std::string::npos) {
+            parts.push_back(s.substr(start, pos-start));
+            start = pos + separator.size();
+        }
+        parts.push_back(s.substr(start));
+        return parts;
+    }
+
+    std::string trim(const std::string& s)
+    {
+        std::string::size_type first = s.find_first_not_of(" \t");
+        if (first == std::string::npos) return "";
+        return s.substr(first, s.find_last_not_of(" \t") - first + 1);
+    }
+}
+
+bool TupleCut::parse(const std::string& expression, std::string& error)
+{
+    m_terms.clear();
+    m_names.clear();
+    m_expression = expression;
+    if (trim(expression).empty()) return true;
+
+    std::vector<std::string> ors = split(expression, "||");
+    for (unsigned int i = 0; i<ors.size(); ++i) {
+        std::vector<Term> ands;
+        std::vector<std::string> terms = split(ors[i], "&&");
+        for (unsigned int j = 0; j<terms.size(); ++j) {
+            std::string term = trim(terms[j]);
+            // the item name
+            std::string::size_type pos = 0;
+            while (pos<term.size() && (isalnum(term[pos]) || term[pos]=='_')) ++pos;
+            std::string name = term.substr(0, pos);
+            if (name.empty() || isdigit(name[0])) {
+                error = "expected an item name in \"" + term + "\"";
+                return false;
+            }
+            while (pos<term.size() && term[pos]==' ') ++pos;
+            // the comparison
+            std::string rest = term.substr(pos);
+            Term t;
+            std::string::size_type opLength = 2;
+            if      (rest.compare(0, 2, "<=") == 0) t.op = LE;
+            else if (rest.compare(0, 2, ">=") == 0) t.op = GE;
+            else if (rest.compare(0, 2, "==") == 0) t.op = EQ;
+            else if (rest.compare(0, 2, "!=") == 0) t.op = NE;
+            else if (rest.compare(0, 1, "<") == 0)  { t.op = LT; opLength = 1; }
+            else if (rest.compare(0, 1, ">") == 0)  { t.op = GT; opLength = 1; }
+            else {
+                error = "expected a comparison after " + name + " in \"" + term + "\"";
+                return false;
+            }
+            // the number
+            std::string number = trim(rest.substr(opLength));
+            char* end = 0;
+            t.value = strtod(number.c_str(), &end);
+            if (number.empty() || *end != 0) {
+                error = "expected a number after the comparison in \"" + term + "\"";
+                return false;
+            }
+            std::vector<std::string>::iterator it = std::find(m_names.begin(), m_names.end(), name);
+            t.var = it - m_names.begin();
+            if (it == m_names.end()) m_names.push_back(name);
+            ands.push_back(t);
+        }
+        m_terms.push_back(ands);
+    }
+    return true;
+}
+
+bool TupleCut::matches(const std::vector<double>& values) const
+{
+    if (m_terms.empty()) return true;
+    for (unsigned int i = 0; i<m_terms.size(); ++i) {
+        bool pass = true;
+        for (unsigned int j = 0; pass && j<m_terms[i].size(); ++j) {
+            const Term& t = m_terms[i][j];
+            double v = values[t.var];
+            switch (t.op) {
+            case LT: pass = v <  t.value; break;
+            case LE: pass = v <= t.value; break;
+            case GT: pass = v >  t.value; break;
+            case GE: pass = v >= t.value; break;
+            case EQ: pass = v == t.value; break;
+            case NE: pass = v != t.value; break;
+            }
+        }
+        if (pass) return true;
+    }
+    return false;
+}
+
+bool TupleCut::mayMatch(const std::vector<double>& mins, const std::vector<double>& maxs,
+                        const std::vector<int>& nonFinite) const
+{
+    if (m_terms.empty()) return true;
+    for (unsigned int i = 0; i<m_terms.size(); ++i) {
+        bool may = true;
+        for (unsigned int j = 0; may && j<m_terms[i].size(); ++j) {
+            const Term& t = m_terms[i][j];
+            double lo = mins[t.var], hi = maxs[t.var];
+            if (nonFinite[t.var] > 0 && t.op != EQ) continue;
+            if (lo > hi) {
+                may = false;
+                continue;
+            }
+            switch (t.op) {
+            case LT: may = lo <  t.value; break;
+            case LE: may = lo <= t.value; break;
+            case GT: may = hi >  t.value; break;
+            case GE: may = hi >= t.value; break;
+            case EQ: may = lo <= t.value && t.value <= hi; break;
+            case NE: may = !(lo == t.value && hi == t.value); break;
+            }
+        }
+        if (may) return true;
+    }
+    return false;
+}
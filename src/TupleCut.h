@@ -0,0 +1,57 @@
+/** @file TupleCut.h
+    @brief declare TupleCut, a selection on the items of a tuple
+
+    $Header$
+*/
+#ifndef ntupleWriterSvc_TupleCut_h
+#define ntupleWriterSvc_TupleCut_h
+
+#include <string>
+#include <vector>
+
+/** @class TupleCut
+    @brief A cut such as "EvtEnergyCorr > 100 && EvtRun >= 5 || CTBBestEnergy > 1000"
+
+    Comparisons of an item with a number (<, <=, >, >=, ==, !=), joined by && and ||,
+    && binding first; no parentheses. It can be tested on the values of a row, or on the
+    range of values of a set of rows, to find out whether any of them may pass.
+*/
+class TupleCut {
+public:
+    TupleCut() {}
+
+    /** @brief parse an expression
+        @return false, with a message in error, if it is not valid
+    */
+    bool parse(const std::string& expression, std::string& error);
+
+    bool empty() const { return m_terms.empty(); }
+    const std::string& expression() const { return m_expression; }
+    /// the items the cut uses, each once: values are passed in this order
+    const std::vector<std::string>& names() const { return m_names; }
+
+    /// true if a row with these values passes
+    bool matches(const std::vector<double>& values) const;
+
+    /** @brief false if no row with values in the given ranges can pass
+        @param mins, maxs - the range of the finite values of each item; empty (min>max) if none
+        @param nonFinite - the number of non-finite values of each item: a NaN passes !=, and an
+                           infinity <, <=, > or >=, so with any of them only == can be ruled out
+    */
+    bool mayMatch(const std::vector<double>& mins, const std::vector<double>& maxs,
+                  const std::vector<int>& nonFinite) const;
+
+private:
+    enum Op { LT, LE, GT, GE, EQ, NE };
+    struct Term {
+        unsigned int var; ///< index in m_names
+        Op op;
+        double value;
+    };
+    /// the cut is the or of these ands
+    std::vector<std::vector<Term> > m_terms;
+    std::vector<std::string> m_names;
+    std::string m_expression;
+};
+
+#endif
@@ -0,0 +1,41 @@
+/** @file TupleSink.h
+    @brief declare TupleSink, an output backend other than TTree
+
+    $Header$
+*/
+#ifndef ntupleWriterSvc_TupleSink_h
+#define ntupleWriterSvc_TupleSink_h
+
+#include <string>
+
+class TTree;
+
+/** @class TupleSink
+    @brief Abstract output backend for a tuple that is not written as a TTree
+
+    RootTupleSvc always keeps a TTree per tuple: it holds the branches created by addItem,
+    and so the client addresses, and is what checkForNAN and getItem look at.
+    For a tuple routed to a sink, that TTree stays in memory and is never filled;
+    at the end of an event the sink reads the same addresses and writes the row its own way.
+*/
+class TupleSink {
+public:
+    virtual ~TupleSink(){}
+
+    /// name of the output format, as returned by INTupleWriterSvc::getOutputTreeType
+    virtual std::string type() const = 0;
+
+    /// (re)read the branch addresses of the schema tree: call whenever they change
+    virtual void bind() = 0;
+
+    /// write one row from the current values at the branch addresses
+    virtual void fill() = 0;
+
+    /// number of rows written so far
+    virtual long long entries() const = 0;
+
+    /// finish writing: must be called before the output file is written and closed
+    virtual void close() = 0;
+};
+
+#endif
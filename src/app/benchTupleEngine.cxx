@@ -0,0 +1,123 @@
+/** @file benchTupleEngine.cxx
+    @brief measure the rows per second TupleEngine writes, from one or several engines at once
+
+    usage: benchTupleEngine [-j engines] [-n events] [-i items] [-o prefix]
+
+    - each engine runs on its own thread and writes its own file, prefix_<engine>.root
+      (default prefix bench), with one tree of -i Float_t items (default 100) and an array of 16
+    - every event stores a row: -n events per engine (default 1000000)
+    - the rate of each engine is printed, then the total: with several engines, how close it
+      is to their number times the rate of one is the measure of what they share
+
+    $Header$
+*/
+#include "engine/TupleEngine.h"
+
+#include "TROOT.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+    void usage() {
+        std::cerr << "usage: benchTupleEngine [-j engines] [-n events] [-i items] [-o prefix]" << std::endl;
+        exit(2);
+    }
+
+    struct Run {
+        Run() : events(0), items(0), rows(0), seconds(0), ok(false) {}
+        std::string fileName;
+        long long events;
+        int items;
+        long long rows;
+        double seconds;
+        bool ok;
+    };
+
+    /// one engine, from the first item to the file closed
+    void runEngine(Run* run) {
+        StreamTupleLog log(TupleLog::Warning);
+        TupleEngineOptions options;
+        options.fileName = run->fileName;
+        options.treeName = "bench";
+        TupleEngine engine(options, &log);
+
+        std::vector<float> values(run->items);
+        float array[16];
+        int event = 0;
+        for (int i = 0; i<run->items; ++i) {
+            std::ostringstream name;
+            name << "Item" << i;
+            if (!engine.addItem("", name.str(), "/F", &values[i])) return;
+        }
+        if (!engine.addItem("", "Array[16]", "/F", array) || !engine.addItem("", "Event", "/I", &event)) return;
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (long long n = 0; n<run->events; ++n) {
+            engine.beginEvent();
+            event = int(n);
+            for (int i = 0; i<run->items; ++i) values[i] = float(n % 1000) + i;
+            for (int i = 0; i<16; ++i) array[i] = float(i*n % 97);
+            engine.storeRow("bench", true);
+            engine.endEvent();
+        }
+        engine.close();
+        run->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+        run->rows = run->events - engine.badRows();
+        run->ok = true;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    int engines = 1, items = 100;
+    long long events = 1000000;
+    std::string prefix("bench");
+    for (int i = 1; i<argc; ++i) {
+        std::string arg(argv[i]);
+        if (i+1 == argc) usage();
+        if (arg == "-j")      engines = atoi(argv[++i]);
+        else if (arg == "-n") events = atoll(argv[++i]);
+        else if (arg == "-i") items = atoi(argv[++i]);
+        else if (arg == "-o") prefix = argv[++i];
+        else usage();
+    }
+    if (engines < 1 || events < 1 || items < 0) usage();
+
+    // each engine has its own files and trees, but ROOT has its global lists
+    if (engines > 1) ROOT::EnableThreadSafety();
+
+    std::vector<Run> runs(engines);
+    for (int e = 0; e<engines; ++e) {
+        std::ostringstream fileName;
+        fileName << prefix << "_" << e << ".root";
+        runs[e].fileName = fileName.str();
+        runs[e].events = events;
+        runs[e].items = items;
+    }
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int e = 0; e<engines; ++e) threads.push_back(std::thread(runEngine, &runs[e]));
+    for (int e = 0; e<engines; ++e) threads[e].join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+
+    long long rows = 0;
+    for (int e = 0; e<engines; ++e) {
+        if (!runs[e].ok) {
+            std::cerr << "benchTupleEngine: engine " << e << " could not write " << runs[e].fileName << std::endl;
+            return 1;
+        }
+        std::cout << "engine " << e << ": " << runs[e].rows << " rows in " << runs[e].seconds << " s, "
+                  << runs[e].rows/runs[e].seconds << " rows/s" << std::endl;
+        rows += runs[e].rows;
+    }
+    std::cout << "total: " << rows << " rows of " << items+17 << " items in " << seconds << " s, "
+              << rows/seconds << " rows/s" << std::endl;
+    return 0;
+}
@@ -0,0 +1,350 @@
+/** @file mergeTuples.cxx
+    @brief merge the output files of RootTupleSvc jobs
+
+    usage: mergeTuples [-j threads] [-f] [-t jobinfo] output.root input1.root input2.root ...
+
+    - every tree found in any input is merged. Its baskets are copied without being
+      decompressed (TTree::CopyEntries "fast"), so the inputs must have the same items, with
+      the same types, as the first one that has the tree: the check is made before anything
+      is written. An input without one of the trees is reported, and the others merged
+    - RNTuples (RootTupleSvc.RNTupleTrees) are merged over all the inputs by ROOT's TFileMerger
+    - the jobinfo tree (-t to change its name) is reduced to a single row: integer and Double_t
+      items (the Count algorithm counts, times) are summed over all the rows of all the inputs;
+      Float_t items (RootTupleSvc.JobInfo values) and strings are taken from the first input,
+      with a warning if another input differs
+    - the MeritVersion saved by RootTupleSvc must be the same in all inputs; -f merges anyway
+    - other objects are copied from the first input; those only in later inputs are reported
+    - the inputs are opened and checked on -j threads; the copy itself, to the one output
+      file, is sequential
+
+    $Header$
+*/
+#include "TupleColumn.h"
+
+#include "TFile.h"
+#include "TFileMerger.h"
+#include "TTree.h"
+#include "TBranch.h"
+#include "TLeaf.h"
+#include "TKey.h"
+#include "TList.h"
+#include "TParameter.h"
+#include "TROOT.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+    /// an input file, with its trees and the columns of each
+    struct Input {
+        Input() : file(0), meritVersion(-1) {}
+        std::string name;
+        TFile* file;
+        int meritVersion; ///< -1 if the file has none
+        std::map<std::string, TTree*> trees;
+        std::map<std::string, std::vector<TupleColumn> > columns;
+        std::set<std::string> rntuples; ///< names of the RNTuples
+        std::set<std::string> others;   ///< names of the other objects
+        std::string error;
+    };
+
+    /// open an input and describe its trees: run on a worker thread
+    void openInput(Input* in) {
+        in->file = TFile::Open(in->name.c_str(), "READ");
+        if (in->file == 0 || in->file->IsZombie()) {
+            in->error = "cannot open";
+            return;
+        }
+        TIter next(in->file->GetListOfKeys());
+        while (TKey* key = (TKey*)next()) {
+            std::string name(key->GetName());
+            std::string className(key->GetClassName());
+            if (className.find("RNTuple") != std::string::npos) {
+                in->rntuples.insert(name);
+            } else if (className != "TTree") {
+                in->others.insert(name);
+            } else if (in->trees.find(name) == in->trees.end()) {
+                // the highest cycle, from an AutoSave or the final Write
+                TTree* t = 0;
+                in->file->GetObject(name.c_str(), t);
+                if (t == 0) continue;
+                in->trees[name] = t;
+                describeColumns(t, in->columns[name]);
+            }
+        }
+        TParameter<int>* version = 0;
+        in->file->GetObject("MeritVersion", version);
+        if (version != 0) in->meritVersion = version->GetVal();
+    }
+
+    /// the first difference between two sets of columns, empty if none
+    std::string compareColumns(const std::vector<TupleColumn>& a, const std::vector<TupleColumn>& b) {
+        std::ostringstream diff;
+        if (a.size() != b.size()) {
+            diff << a.size() << " items instead of " << b.size();
+            return diff.str();
+        }
+        for (unsigned int i = 0; i<a.size(); ++i) {
+            if (a[i].name != b[i].name)
+                diff << "item " << i << " is " << b[i].name << " instead of " << a[i].name;
+            else if (a[i].type != b[i].type || a[i].length != b[i].length)
+                diff << "item " << a[i].name << " has a different type or dimension";
+            if (!diff.str().empty()) break;
+        }
+        return diff.str();
+    }
+
+    /// one item of the merged jobinfo row
+    struct JobInfoItem {
+        JobInfoItem() : type(0), length(0), set(false) {}
+        std::string name;  ///< branch name, with any [n]
+        char type;
+        int length;
+        std::vector<long long> isum;
+        std::vector<double>    dsum;
+        std::string text;  ///< a string item
+        bool set;          ///< a Float_t or string value has been taken
+    };
+
+    /// add the rows of one jobinfo tree to the merged row
+    void addJobInfo(TTree* t, const std::string& fileName, std::map<std::string, JobInfoItem>& items,
+                    std::vector<std::string>& order) {
+        std::vector<TupleColumn> cols;
+        describeColumns(t, cols);
+        for (long long entry = 0; entry<t->GetEntries(); ++entry) {
+            t->GetEntry(entry);
+            for (unsigned int i = 0; i<cols.size(); ++i) {
+                const TupleColumn& col = cols[i];
+                if (col.type == 0) continue;
+                JobInfoItem& item = items[col.leafName];
+                if (item.type == 0) {
+                    item.name = col.name;
+                    item.type = col.type;
+                    item.length = col.length;
+                    item.isum.assign(col.length, 0);
+                    item.dsum.assign(col.length, 0);
+                    order.push_back(col.leafName);
+                } else if (item.type != col.type || item.length != col.length) {
+                    std::cerr << "mergeTuples: jobinfo item " << col.leafName << " in " << fileName
+                              << " has another type: ignored" << std::endl;
+                    continue;
+                }
+                if (col.type == 'C') {
+                    std::string text((const char*)col.leaf->GetValuePointer());
+                    if (!item.set) { item.text = text; item.set = true; }
+                    else if (text != item.text)
+                        std::cerr << "mergeTuples: jobinfo " << col.leafName << " is \"" << text << "\" in "
+                                  << fileName << ", keeping \"" << item.text << "\"" << std::endl;
+                    continue;
+                }
+                for (int k = 0; k<col.length; ++k) {
+                    if (col.type == 'D') item.dsum[k] += col.leaf->GetValue(k);
+                    else if (col.type == 'F') {
+                        double value = col.leaf->GetValue(k);
+                        if (!item.set) item.dsum[k] = value;
+                        else if (value != item.dsum[k])
+                            std::cerr << "mergeTuples: jobinfo " << col.leafName << " is " << value << " in "
+                                      << fileName << ", keeping " << item.dsum[k] << std::endl;
+                    }
+                    else item.isum[k] += col.leaf->GetValueLong64(k);
+                }
+                if (col.type == 'F') item.set = true;
+            }
+        }
+    }
+
+    /// write the merged jobinfo row as a new tree in the current directory
+    void writeJobInfo(const std::string& treeName, const std::string& title,
+                      std::map<std::string, JobInfoItem>& items, const std::vector<std::string>& order) {
+        TTree* t = new TTree(treeName.c_str(), title.c_str());
+        std::vector<std::vector<double> > buffers(order.size()); // double, for alignment
+        for (unsigned int i = 0; i<order.size(); ++i) {
+            JobInfoItem& item = items[order[i]];
+            std::vector<double>& buffer = buffers[i];
+            buffer.assign(item.length + item.text.size()/sizeof(double) + 1, 0);
+            void* p = &buffer[0];
+            for (int k = 0; k<item.length; ++k) {
+                switch (item.type) {
+                    case 'D': static_cast<Double_t*>(p)[k]  = item.dsum[k]; break;
+                    case 'F': static_cast<Float_t*>(p)[k]   = Float_t(item.dsum[k]); break;
+                    case 'I': static_cast<Int_t*>(p)[k]     = Int_t(item.isum[k]); break;
+                    case 'i': static_cast<UInt_t*>(p)[k]    = UInt_t(item.isum[k]); break;
+                    case 'l': static_cast<ULong64_t*>(p)[k] = ULong64_t(item.isum[k]); break;
+                    default: break;
+                }
+            }
+            if (item.type == 'C') strcpy(static_cast<char*>(p), item.text.c_str());
+            t->Branch(item.name.c_str(), p, (item.name+"/"+item.type).c_str());
+        }
+        t->Fill();
+        t->Write();
+    }
+
+    void usage() {
+        std::cerr << "usage: mergeTuples [-j threads] [-f] [-t jobinfo] output.root input.root ..." << std::endl;
+        exit(2);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    unsigned int threads = 4;
+    bool force = false;
+    std::string jobInfoTree("jobinfo");
+    std::vector<std::string> files;
+    for (int i = 1; i<argc; ++i) {
+        std::string arg(argv[i]);
+        if (arg == "-j" && i+1<argc)      threads = atoi(argv[++i]);
+        else if (arg == "-f")             force = true;
+        else if (arg == "-t" && i+1<argc) jobInfoTree = argv[++i];
+        else if (arg[0] == '-')           usage();
+        else files.push_back(arg);
+    }
+    if (files.size() < 2) usage();
+    if (threads < 1) threads = 1;
+
+    // open and describe the inputs, several at a time: over a network file system,
+    // opening a file and reading its headers is mostly waiting
+    std::vector<Input> inputs(files.size()-1);
+    for (unsigned int i = 0; i<inputs.size(); ++i) inputs[i].name = files[i+1];
+    if (threads > 1) ROOT::EnableThreadSafety();
+    for (unsigned int first = 0; first<inputs.size(); first += threads) {
+        std::vector<std::thread> workers;
+        for (unsigned int i = first; i<inputs.size() && i<first+threads; ++i)
+            workers.push_back(std::thread(openInput, &inputs[i]));
+        for (unsigned int i = 0; i<workers.size(); ++i) workers[i].join();
+    }
+
+    // every tree and RNTuple of any input, with the first input that has each tree as its reference
+    std::map<std::string, const Input*> trees;
+    std::set<std::string> rntuples;
+    for (unsigned int i = 0; i<inputs.size(); ++i) {
+        for (std::map<std::string, TTree*>::const_iterator it = inputs[i].trees.begin(); it != inputs[i].trees.end(); ++it)
+            trees.insert(std::make_pair(it->first, &inputs[i]));
+        rntuples.insert(inputs[i].rntuples.begin(), inputs[i].rntuples.end());
+    }
+
+    // check everything before writing anything
+    bool ok = true;
+    const Input& reference = inputs[0];
+    for (unsigned int i = 0; i<inputs.size(); ++i) {
+        const Input& in = inputs[i];
+        if (!in.error.empty()) {
+            std::cerr << "mergeTuples: " << in.name << ": " << in.error << std::endl;
+            ok = false;
+            continue;
+        }
+        if (in.meritVersion != reference.meritVersion) {
+            std::cerr << "mergeTuples: " << in.name << " has MeritVersion " << in.meritVersion << ", "
+                      << reference.name << " has " << reference.meritVersion << std::endl;
+            if (!force) ok = false;
+        }
+        for (std::map<std::string, const Input*>::const_iterator it = trees.begin(); it != trees.end(); ++it) {
+            std::map<std::string, std::vector<TupleColumn> >::const_iterator cols = in.columns.find(it->first);
+            if (cols == in.columns.end()) {
+                std::cerr << "mergeTuples: warning: " << in.name << " has no tree " << it->first << std::endl;
+                continue;
+            }
+            if (it->first == jobInfoTree) continue;
+            std::string diff = compareColumns(it->second->columns.find(it->first)->second, cols->second);
+            if (!diff.empty()) {
+                std::cerr << "mergeTuples: tree " << it->first << " in " << in.name << ": " << diff << std::endl;
+                ok = false;
+            }
+        }
+        for (std::set<std::string>::const_iterator it = rntuples.begin(); it != rntuples.end(); ++it) {
+            if (in.rntuples.find(*it) == in.rntuples.end())
+                std::cerr << "mergeTuples: warning: " << in.name << " has no RNTuple " << *it << std::endl;
+        }
+        if (i == 0) continue;
+        for (std::set<std::string>::const_iterator it = in.others.begin(); it != in.others.end(); ++it) {
+            if (reference.others.find(*it) == reference.others.end())
+                std::cerr << "mergeTuples: warning: " << *it << " of " << in.name
+                          << " is not in the first input: not copied" << std::endl;
+        }
+    }
+    if (!ok) return 1;
+
+    TFile* out = new TFile(files[0].c_str(), "RECREATE");
+    if (!out->IsOpen()) {
+        std::cerr << "mergeTuples: cannot create " << files[0] << std::endl;
+        return 1;
+    }
+
+    for (std::map<std::string, const Input*>::const_iterator it = trees.begin(); it != trees.end(); ++it) {
+        const std::string& treeName = it->first;
+        TTree* first = it->second->trees.find(treeName)->second;
+        out->cd();
+        if (treeName == jobInfoTree) {
+            std::map<std::string, JobInfoItem> items;
+            std::vector<std::string> order;
+            for (unsigned int i = 0; i<inputs.size(); ++i) {
+                std::map<std::string, TTree*>::const_iterator t = inputs[i].trees.find(treeName);
+                if (t != inputs[i].trees.end()) addJobInfo(t->second, inputs[i].name, items, order);
+            }
+            writeJobInfo(treeName, first->GetTitle(), items, order);
+            std::cout << "mergeTuples: " << treeName << ": " << order.size() << " items combined" << std::endl;
+            continue;
+        }
+        // the clone keeps the cluster size and compression of the first input with the tree
+        TTree* merged = first->CloneTree(0);
+        merged->SetDirectory(out);
+        for (unsigned int i = 0; i<inputs.size(); ++i) {
+            std::map<std::string, TTree*>::const_iterator t = inputs[i].trees.find(treeName);
+            if (t == inputs[i].trees.end()) continue;
+            merged->CopyEntries(t->second, -1, "fast");
+        }
+        merged->Write(0, TObject::kOverwrite);
+        std::cout << "mergeTuples: " << treeName << ": " << merged->GetEntries() << " entries" << std::endl;
+    }
+
+    // the rest: merit version, and any other objects of the first input
+    TIter next(reference.file->GetListOfKeys());
+    std::set<std::string> copied;
+    while (TKey* key = (TKey*)next()) {
+        std::string name(key->GetName());
+        if (reference.others.find(name) == reference.others.end() || !copied.insert(name).second) continue;
+        if (name == "MeritVersion") continue;
+        TObject* obj = key->ReadObj();
+        if (obj != 0) out->WriteTObject(obj, name.c_str());
+    }
+    TParameter<int> meritVersion("MeritVersion", reference.meritVersion);
+    if (reference.meritVersion >= 0) out->WriteTObject(&meritVersion, 0, "Overwrite");
+
+    out->Close();
+    delete out;
+    for (unsigned int i = 0; i<inputs.size(); ++i) {
+        if (inputs[i].file != 0) inputs[i].file->Close();
+    }
+
+    // RNTuples: ROOT merges them, page by page, into the file just written
+    if (!rntuples.empty()) {
+        TFileMerger merger(kFALSE);
+        merger.SetPrintLevel(0);
+        if (!merger.OutputFile(files[0].c_str(), "UPDATE")) {
+            std::cerr << "mergeTuples: cannot reopen " << files[0] << " to merge the RNTuples" << std::endl;
+            return 1;
+        }
+        std::string names;
+        for (std::set<std::string>::const_iterator it = rntuples.begin(); it != rntuples.end(); ++it)
+            names += *it + " ";
+        merger.AddObjectNames(names.c_str());
+        for (unsigned int i = 0; i<inputs.size(); ++i) {
+            if (!inputs[i].rntuples.empty()) merger.AddFile(inputs[i].name.c_str(), kFALSE);
+        }
+        if (!merger.PartialMerge(TFileMerger::kAllIncremental | TFileMerger::kOnlyListed)) {
+            std::cerr << "mergeTuples: failed to merge the RNTuples " << names << std::endl;
+            return 1;
+        }
+        std::cout << "mergeTuples: " << rntuples.size() << " RNTuples merged" << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,211 @@
+/** @file tupleConsumer.cxx
+    @brief receive the tuples a RootTupleSvc job streams to a Unix socket
+
+    usage: tupleConsumer [-c credits] socket [output.root]
+
+    - listens on the socket (RootTupleSvc.StreamSocket), then accepts one job
+    - each stream (RootTupleSvc.StreamTrees) becomes a tree of the same name and items in
+      output.root; without an output file the rows are only counted
+    - -c is the number of batches the job may send ahead of what has been processed (default 4)
+    - the job's End is acknowledged once the file is written and closed, then the program exits
+
+    The protocol is described in ntupleWriterSvc/TupleStream.h
+
+    $Header$
+*/
+#include "ntupleWriterSvc/TupleStream.h"
+
+#include "TFile.h"
+#include "TTree.h"
+#include "TBranch.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+    /// a column of a stream, and the buffer its branch reads
+    struct Column {
+        std::string name;
+        char type;
+        unsigned int size, length;
+        std::vector<char> buffer;
+        TBranch* branch;
+        unsigned int bytes() const { return size*length; }
+    };
+
+    struct Stream {
+        Stream() : tree(0), rows(0) {}
+        std::string name;
+        std::vector<Column> cols;
+        TTree* tree;
+        long long rows;
+    };
+
+    void usage() {
+        std::cerr << "usage: tupleConsumer [-c credits] socket [output.root]" << std::endl;
+        exit(2);
+    }
+
+    void fail(const std::string& message) {
+        std::cerr << "tupleConsumer: " << message << std::endl;
+        exit(1);
+    }
+
+    bool sendCredit(int fd, unsigned int credits) {
+        std::string payload;
+        TupleStream::put<std::uint32_t>(payload, credits);
+        return TupleStream::sendFrame(fd, TupleStream::Credit, payload);
+    }
+
+    /// the socket, listening
+    int listenOn(const std::string& path) {
+        sockaddr_un address;
+        if (path.size() >= sizeof(address.sun_path)) fail("socket path too long: " + path);
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) fail(std::string("socket: ") + strerror(errno));
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path)-1);
+        // left by an earlier run
+        unlink(path.c_str());
+        if (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(fd, 1) != 0)
+            fail(path + ": " + strerror(errno));
+        return fd;
+    }
+
+    void readSchema(const std::string& payload, std::map<unsigned int, Stream>& streams, TFile* out) {
+        TupleStream::Reader in(payload);
+        unsigned int id = in.get<std::uint32_t>();
+        Stream& s = streams[id];
+        s.name = in.getString();
+        s.cols.resize(in.get<std::uint32_t>());
+        for (unsigned int i = 0; i<s.cols.size() && in.ok(); ++i) {
+            Column& c = s.cols[i];
+            c.name = in.getString();
+            c.type = in.get<char>();
+            c.size = in.get<std::uint32_t>();
+            c.length = in.get<std::uint32_t>();
+            c.buffer.resize(c.type == 'C' ? 256 : c.bytes());
+            c.branch = 0;
+        }
+        if (!in.ok()) fail("bad schema frame");
+        if (out == 0) return;
+        out->cd();
+        s.tree = new TTree(s.name.c_str(), s.name.c_str());
+        for (unsigned int i = 0; i<s.cols.size(); ++i) {
+            Column& c = s.cols[i];
+            std::string leaflist = c.name;
+            if (c.type != 'C' && c.length > 1) leaflist += "[" + std::to_string(c.length) + "]";
+            leaflist += std::string("/") + c.type;
+            c.branch = s.tree->Branch(c.name.c_str(), &c.buffer[0], leaflist.c_str());
+        }
+    }
+
+    void readBatch(const std::string& payload, std::map<unsigned int, Stream>& streams) {
+        TupleStream::Reader in(payload);
+        unsigned int id = in.get<std::uint32_t>();
+        unsigned int rows = in.get<std::uint32_t>();
+        std::map<unsigned int, Stream>::iterator sit = streams.find(id);
+        if (sit == streams.end()) fail("batch of a stream without a schema");
+        Stream& s = sit->second;
+
+        // where each column's values are in the frame
+        std::vector<const char*> values(s.cols.size());
+        std::vector<std::vector<std::pair<const char*, unsigned int> > > strings(s.cols.size());
+        for (unsigned int i = 0; i<s.cols.size(); ++i) {
+            if (s.cols[i].type != 'C') {
+                values[i] = in.bytes(size_t(rows)*s.cols[i].bytes());
+                continue;
+            }
+            for (unsigned int r = 0; r<rows; ++r) {
+                unsigned int n = in.get<std::uint32_t>();
+                strings[i].push_back(std::make_pair(in.bytes(n), n));
+            }
+        }
+        if (!in.ok() || !in.atEnd()) fail("bad batch frame for " + s.name);
+        s.rows += rows;
+        if (s.tree == 0) return;
+
+        for (unsigned int r = 0; r<rows; ++r) {
+            for (unsigned int i = 0; i<s.cols.size(); ++i) {
+                Column& c = s.cols[i];
+                if (c.type != 'C') {
+                    memcpy(&c.buffer[0], values[i] + size_t(r)*c.bytes(), c.bytes());
+                    continue;
+                }
+                unsigned int n = strings[i][r].second;
+                if (n+1 > c.buffer.size()) {
+                    c.buffer.resize(2*(n+1));
+                    c.branch->SetAddress(&c.buffer[0]);
+                }
+                memcpy(&c.buffer[0], strings[i][r].first, n);
+                c.buffer[n] = 0;
+            }
+            s.tree->Fill();
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    unsigned int credits = 4;
+    std::vector<std::string> args;
+    for (int i = 1; i<argc; ++i) {
+        std::string arg(argv[i]);
+        if (arg == "-c" && i+1<argc) credits = atoi(argv[++i]);
+        else if (arg[0] == '-')      usage();
+        else args.push_back(arg);
+    }
+    if (args.empty() || args.size() > 2) usage();
+    if (credits < 1) credits = 1;
+
+    TFile* out = 0;
+    if (args.size() == 2) {
+        out = TFile::Open(args[1].c_str(), "RECREATE");
+        if (out == 0 || out->IsZombie()) fail("cannot create " + args[1]);
+    }
+
+    int listener = listenOn(args[0]);
+    std::cout << "tupleConsumer: listening on " << args[0] << std::endl;
+    int fd = accept(listener, 0, 0);
+    if (fd < 0) fail(std::string("accept: ") + strerror(errno));
+    close(listener);
+    unlink(args[0].c_str());
+    if (!sendCredit(fd, credits)) fail("the job is gone");
+
+    std::map<unsigned int, Stream> streams;
+    std::uint32_t type = 0;
+    std::string payload;
+    while (true) {
+        if (!TupleStream::recvFrame(fd, type, payload)) fail("the job is gone before its end");
+        if (type == TupleStream::Schema) {
+            readSchema(payload, streams, out);
+        } else if (type == TupleStream::Batch) {
+            readBatch(payload, streams);
+            if (!sendCredit(fd, 1)) fail("the job is gone before its end");
+        } else if (type == TupleStream::End) {
+            break;
+        } else {
+            fail("unexpected frame");
+        }
+    }
+
+    for (std::map<unsigned int, Stream>::const_iterator it = streams.begin(); it != streams.end(); ++it) {
+        std::cout << "tupleConsumer: " << it->second.name << ": " << it->second.rows << " rows" << std::endl;
+        if (it->second.tree != 0) it->second.tree->Write(0, TObject::kOverwrite);
+    }
+    if (out != 0) {
+        out->Close();
+        delete out;
+    }
+    TupleStream::sendFrame(fd, TupleStream::Ack, std::string());
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,352 @@
+/** @file TupleEngine.cxx
+    @brief implement TupleEngine
+
+    $Header$
+*/
+#include "TupleEngine.h"
+
+#include "TBranch.h"
+#include "TChain.h"
+#include "TDirectory.h"
+#include "TFile.h"
+#include "TLeaf.h"
+#include "TObjArray.h"
+#include "TROOT.h"
+#include "TString.h"
+#include "TSystem.h"
+#include "TTree.h"
+#include "RVersion.h"
+
+#include <chrono>
+#include <cmath>
+#include <new>
+#include <sstream>
+#include <thread>
+
+namespace {
+    /// an output file to write and close, on its own thread if they are written in parallel
+    struct FileClose {
+        FileClose() : file(0), afterClose(0), bytes(0), seconds(0) {}
+        std::string name;
+        TFile* file;
+        const TupleEngine::FileHook* afterClose;
+        int bytes;
+        double seconds;
+    };
+
+    void writeAndClose(FileClose* c) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        // gDirectory is per thread once ROOT thread safety is on
+        TDirectory::TContext context(c->file);
+        c->bytes = c->file->Write(0, TObject::kOverwrite);
+        c->file->Close();
+        c->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+        if (*c->afterClose) (*c->afterClose)(c->name, c->file);
+    }
+}
+
+TupleEngine::TupleEngine(const TupleEngineOptions& options, TupleLog* log)
+: m_options(options), m_log(log), m_storeAll(options.defaultStore)
+, m_nextEntry(options.startingIndex), m_inputEntries(0), m_badRows(0)
+{}
+
+TupleEngine::~TupleEngine()
+{
+    close();
+    for (std::map<std::string, TChain*>::iterator it = m_chains.begin(); it != m_chains.end(); ++it)
+        delete it->second;
+    for (std::map<std::string, std::map<std::string, void*> >::iterator treeit = m_itemPool.begin();
+         treeit != m_itemPool.end(); ++treeit) {
+        for (std::map<std::string, void*>::iterator it = treeit->second.begin(); it != treeit->second.end(); ++it)
+            ::operator delete(it->second);
+    }
+}
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+TFile* TupleEngine::outputFile(const std::string& fileName)
+{
+    std::map<std::string, TFile*>::iterator it = m_files.find(fileName);
+    if (it != m_files.end()) return it->second;
+    // TFile::Open makes the file the current directory: not for long
+    TDirectory::TContext context;
+    TFile* f = m_open ? m_open(fileName) : TFile::Open(fileName.c_str(), "RECREATE");
+    if (f == 0 || f->IsZombie()) {
+        message(TupleLog::Error, "cannot open ROOT file: " + fileName);
+        delete f;
+        return 0;
+    }
+    m_files[fileName] = f;
+    return f;
+}
+
+TTree* TupleEngine::outputTree(const std::string& treeName, TDirectory* dir)
+{
+    // a new tree goes to the current directory, then to its own
+    TDirectory::TContext context(dir != 0 ? dir : gROOT);
+    TTree* t = 0;
+    if (hasInput()) {
+        // the structure only: the input rows are copied by filling it
+        TChain* ch = inputChain(treeName);
+        if (ch != 0) t = ch->CloneTree(0);
+    }
+    if (t == 0) {
+        t = new TTree(treeName.c_str(), m_options.title.c_str());
+        t->SetAutoSave(m_options.autoSave);
+    }
+    t->SetDirectory(dir);
+    return t;
+}
+
+TTree* TupleEngine::itemTree(const std::string& treeName0, const std::string& fileName0, bool write)
+{
+    std::string treeName = treeName0.empty() ? m_options.treeName : treeName0;
+    std::map<std::string, TTree*>::iterator it = m_trees.find(treeName);
+    if (it != m_trees.end()) return it->second;
+    if (!write) {
+        // in memory, with the items added only
+        TDirectory::TContext context(gROOT);
+        TTree* t = new TTree(treeName.c_str(), m_options.title.c_str());
+        t->SetDirectory(0);
+        m_trees[treeName] = t;
+        return t;
+    }
+    std::string fileName = fileName0.empty() ? m_options.fileName : fileName0;
+    TFile* f = outputFile(fileName);
+    if (f == 0) return 0;
+    m_trees[treeName] = outputTree(treeName, f);
+    if (m_setupTree) m_setupTree(treeName, f);
+    return m_trees[treeName];
+}
+
+bool TupleEngine::addItem(const std::string& treeName0, const std::string& itemName, const std::string& type,
+                          const void* address, const std::string& fileName, bool write)
+{
+    std::string treeName = treeName0.empty() ? m_options.treeName : treeName0;
+    TTree* t = itemTree(treeName, fileName, write);
+    if (t == 0) return false;
+    TBranch* b = t->GetBranch(itemName.c_str());
+    if (b != 0) {
+        b->SetAddress(const_cast<void*>(address));
+        return true;
+    }
+    message(TupleLog::Debug, "Creating new branch " + itemName + " of " + treeName);
+    return t->Branch(itemName.c_str(), const_cast<void*>(address), (itemName+type).c_str(),
+                     m_options.bufferSize) != 0;
+}
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void* TupleEngine::poolItem(const std::string& treeName, TChain* ch, const std::string& branchName, TLeaf* leaf)
+{
+    std::map<std::string, void*>& pool = m_itemPool[treeName];
+    std::map<std::string, void*>::iterator it = pool.find(branchName);
+    if (it != pool.end()) return it->second;
+    std::string typeName(leaf->GetTypeName());
+    size_t size = 0;
+    if (typeName == "Float_t" || typeName == "Int_t" || typeName == "UInt_t") size = 4;
+    else if (typeName == "Double_t" || typeName == "ULong64_t") size = 8;
+    else if (typeName == "Char_t") size = 1;
+    else {
+        message(TupleLog::Warning, "type: " + typeName + " not found");
+        return 0;
+    }
+    void* buffer = ::operator new(size*std::max(1, leaf->GetNdata()));
+    pool[branchName] = buffer;
+    ch->SetBranchAddress(branchName.c_str(), buffer);
+    return buffer;
+}
+
+TChain* TupleEngine::inputChain(const std::string& treeName)
+{
+    std::map<std::string, TChain*>::iterator it = m_chains.find(treeName);
+    if (it != m_chains.end()) return it->second;
+    if (!hasInput()) return 0;
+    // opening the files moves the current directory
+    TDirectory::TContext context;
+
+    // assumes all input ROOT files have the same tree name
+    TChain* ch = new TChain(treeName.c_str());
+    for (unsigned int i = 0; i<m_options.inputFiles.size(); ++i) {
+        TString fileName(m_options.inputFiles[i].c_str());
+        gSystem->ExpandPathName(fileName);
+        int stat = ch->Add(fileName.Data());
+        std::ostringstream text;
+        if (stat <= 0) {
+            text << "Failed to TChain::Add " << fileName.Data() << " return code: " << stat;
+            message(TupleLog::Warning, text.str());
+        } else {
+            message(TupleLog::Info, std::string("Added File: ") + fileName.Data());
+        }
+    }
+    m_chains[treeName] = ch;
+
+    // GetEntries loads the headers of the files
+    m_inputEntries = ch->GetEntries();
+    std::ostringstream text;
+    text << "Number of events in input files = " << m_inputEntries << " StartingIndex: " << m_nextEntry;
+    message(TupleLog::Info, text.str());
+    if (m_nextEntry > m_inputEntries-1 || m_nextEntry < 0) {
+        std::ostringstream warning;
+        warning << "StartingIndex invalid, resetting " << m_nextEntry << " to zero";
+        message(TupleLog::Warning, warning.str());
+        m_nextEntry = 0;
+    }
+    if (ch->GetEntry(m_nextEntry) <= 0) {
+        std::ostringstream warning;
+        warning << "Unable to read tuple event, " << m_nextEntry;
+        message(TupleLog::Warning, warning.str());
+    }
+
+    // a buffer for every branch of the whole chain, so that no element is missed
+    TObjArray* branches = ch->GetListOfBranches();
+    for (int i = 0; i<branches->GetEntries(); ++i) {
+        std::string branchName(((TBranch*)branches->At(i))->GetName());
+        std::string leafName = branchName.substr(0, branchName.find('['));
+        TLeaf* leaf = ((TBranch*)branches->At(i))->GetLeaf(leafName.c_str());
+        if (leaf == 0) {
+            message(TupleLog::Warning, "Leaf: " + leafName + " not found");
+            continue;
+        }
+        poolItem(treeName, ch, branchName, leaf);
+    }
+    selectBranches(ch);
+    return ch;
+}
+
+void TupleEngine::selectBranches(TChain* ch)
+{
+    const std::vector<std::string>& include = m_options.includeBranches;
+    const std::vector<std::string>& exclude = m_options.excludeBranches;
+    if (!include.empty()) ch->SetBranchStatus("*", 0);
+    else if (!exclude.empty()) ch->SetBranchStatus("*", 1);
+    const std::vector<std::string>& list = include.empty() ? exclude : include;
+    bool on = !include.empty();
+    for (unsigned int i = 0; i<list.size(); ++i) {
+        unsigned int found = 0;
+        ch->SetBranchStatus(list[i].c_str(), on, &found);
+        if (found == 0)
+            message(TupleLog::Warning, "Did not find any matching branch names for: " + list[i]);
+        else
+            message(TupleLog::Info, std::string("Set BranchStatus to ") + (on ? "1 (on)" : "0 (off)")
+                    + " for branch " + list[i]);
+    }
+}
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+bool TupleEngine::beginEvent(const InputHook& afterRead)
+{
+    if (!m_chains.empty()) {
+        if (m_nextEntry >= m_inputEntries) return false;
+        TDirectory::TContext context;
+        // the same entry of every input tree
+        long long entry = m_nextEntry++;
+        for (std::map<std::string, TChain*>::iterator it = m_chains.begin(); it != m_chains.end(); ++it) {
+            if (it->second->GetEntry(entry) <= 0) {
+                std::ostringstream text;
+                text << "Failed to load event " << entry << " from the input chain " << it->first;
+                message(TupleLog::Error, text.str());
+                return false;
+            }
+            if (afterRead) afterRead(it->first, it->second);
+        }
+    }
+    m_storeAll = m_options.defaultStore;
+    for (std::map<std::string, bool>::iterator it = m_store.begin(); it != m_store.end(); ++it)
+        it->second = false;
+    return true;
+}
+
+bool TupleEngine::storeRow(const std::string& treeName, bool flag)
+{
+    bool& store = m_store[treeName];
+    bool previous = store;
+    store = flag;
+    return previous;
+}
+
+int TupleEngine::endEvent()
+{
+    int bad = 0;
+    for (std::map<std::string, TTree*>::iterator it = m_trees.begin(); it != m_trees.end(); ++it) {
+        bool& store = m_store[it->first];
+        if (!m_storeAll && !store) continue;
+        store = false;
+        TTree* t = it->second;
+        if (m_select && !m_select(it->first, t)) continue;
+        // rows with non-finite values are not filled, unless asked to
+        if (!checkFinite(t)) {
+            ++m_badRows;
+            ++bad;
+            if (m_options.rejectIfBad) continue;
+        }
+        if (m_fill) m_fill(it->first, t);
+        else t->Fill();
+    }
+    return bad;
+}
+
+bool TupleEngine::checkFinite(TTree* t)
+{
+    bool finite = true;
+    bool debug = m_log != 0 && m_log->enabled(TupleLog::Debug);
+    TObjArray* branches = t->GetListOfBranches();
+    int entries = branches->GetEntries();
+    for (int i = 0; i<entries; ++i) {
+        TBranch* b = (TBranch*)(*branches)[i];
+        TLeaf* leaf = (TLeaf*)(*b->GetListOfLeaves())[0];
+        double val = leaf->GetValue();
+        if (debug) {
+            std::ostringstream text;
+            text << leaf->GetName() << " val: " << val;
+            message(TupleLog::Debug, text.str());
+        }
+        if (!std::isfinite(val)) {
+            if (debug) message(TupleLog::Debug, std::string("Tuple item ") + leaf->GetName() + " is not finite!");
+            m_badCounts[leaf->GetName()]++;
+            finite = false;
+        }
+    }
+    return finite;
+}
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void TupleEngine::close(bool parallel)
+{
+    // the trees kept in memory: those of the files go with them
+    for (std::map<std::string, TTree*>::iterator it = m_trees.begin(); it != m_trees.end(); ++it) {
+        if (it->second->GetDirectory() == 0) delete it->second;
+    }
+    m_trees.clear();
+
+    std::vector<FileClose> closes;
+    for (std::map<std::string, TFile*>::iterator it = m_files.begin(); it != m_files.end(); ++it) {
+        if (!it->second->IsOpen()) {
+            message(TupleLog::Warning, "ROOT File: " + it->first + " is not open - skipping write");
+            continue;
+        }
+        if (m_beforeWrite) m_beforeWrite(it->first, it->second);
+        FileClose c;
+        c.name = it->first;
+        c.file = it->second;
+        c.afterClose = &m_afterClose;
+        closes.push_back(c);
+    }
+#if ROOT_VERSION_CODE < ROOT_VERSION(6,0,0)
+    parallel = false;
+#endif
+    if (parallel && closes.size() > 1) {
+        // the files are independent: the time taken is that of the largest
+        std::vector<std::thread> workers;
+        for (unsigned int i = 0; i<closes.size(); ++i) workers.push_back(std::thread(writeAndClose, &closes[i]));
+        for (unsigned int i = 0; i<workers.size(); ++i) workers[i].join();
+    } else {
+        for (unsigned int i = 0; i<closes.size(); ++i) writeAndClose(&closes[i]);
+    }
+    for (unsigned int i = 0; i<closes.size(); ++i) {
+        std::ostringstream text;
+        text << "Wrote " << closes[i].bytes << " bytes to " << closes[i].name << " in " << closes[i].seconds << " s";
+        message(TupleLog::Debug, text.str());
+    }
+    for (std::map<std::string, TFile*>::iterator it = m_files.begin(); it != m_files.end(); ++it)
+        delete it->second;
+    m_files.clear();
+}
@@ -0,0 +1,187 @@
+/** @file TupleEngine.h
+    @brief declare TupleEngine, the trees, files and input chains of RootTupleSvc without Gaudi
+
+    $Header$
+*/
+#ifndef ntupleWriterSvc_TupleEngine_h
+#define ntupleWriterSvc_TupleEngine_h
+
+#include "TupleLog.h"
+
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+class TChain;
+class TDirectory;
+class TFile;
+class TLeaf;
+class TTree;
+
+/** @class TupleEngineOptions
+    @brief The settings of a TupleEngine: the RootTupleSvc properties of the same meaning
+*/
+struct TupleEngineOptions {
+    TupleEngineOptions()
+    : fileName("RootTupleSvc.root"), treeName("1"), title("Glast tuple"), autoSave(100000)
+    , bufferSize(32000), defaultStore(false), rejectIfBad(true), startingIndex(0) {}
+    std::string fileName;   ///< output file of the items added without one
+    std::string treeName;   ///< tree of the items added without one
+    std::string title;      ///< of the trees
+    long long   autoSave;
+    int         bufferSize; ///< of each branch
+    bool        defaultStore; ///< store every tree at each event unless told otherwise
+    bool        rejectIfBad;  ///< do not store rows with non-finite values
+    std::vector<std::string> inputFiles;
+    std::vector<std::string> includeBranches, excludeBranches; ///< of the input, with wildcards
+    long long   startingIndex; ///< first input entry
+};
+
+/** @class TupleEngine
+    @brief Trees of items at fixed addresses, written to several files and read from a chain of
+    input files, one row per event
+
+    @verbatim
+    TupleEngine engine(options);
+    engine.addItem("MeritTuple", "EvtEnergy", "/F", &energy);
+    while (engine.beginEvent()) {    // reads the next input entry, if there is an input
+        ...
+        engine.storeRow("MeritTuple", true);
+        engine.endEvent();           // fills the trees flagged
+    }
+    engine.close();                  // writes and closes the files
+    @endverbatim
+    It uses no global state of its own: several engines can run in one process, each on its
+    thread once ROOT::EnableThreadSafety has been called. It does not depend on, nor change,
+    the current ROOT directory.
+
+    It is the storage layer of RootTupleSvc, not its fill policy. The service wraps one: it
+    shares the maps of trees, files and flags below, and adds its own steps through the hooks:
+    how files are opened, how new trees are set up, which rows are filled and how, and what
+    happens to each file as it is closed. The row filters, prescales and reservoirs behind
+    those hooks stay in the service, as do the encoders, zone maps, the key index, checkpoints,
+    sinks and concurrent mode.
+*/
+class TupleEngine {
+public:
+    /// decides whether a flagged row goes on to the non-finite check and the fill
+    typedef std::function<bool(const std::string&, TTree*)> SelectHook;
+    /// fills a row, instead of TTree::Fill
+    typedef std::function<void(const std::string&, TTree*)> FillHook;
+    /// called for each input chain once the entry is read
+    typedef std::function<void(const std::string&, TChain*)> InputHook;
+    /// opens an output file instead of TFile::Open with "RECREATE": 0, or a zombie, if it cannot
+    typedef std::function<TFile*(const std::string&)> OpenHook;
+    /// sets up a new output tree, already in trees(), where it may replace it; with its file
+    typedef std::function<void(const std::string&, TFile*)> TreeHook;
+    /// called by close for an output file, with its name
+    typedef std::function<void(const std::string&, TFile*)> FileHook;
+
+    /// messages go to log, if not 0; it must outlive the engine
+    explicit TupleEngine(const TupleEngineOptions& options = TupleEngineOptions(), TupleLog* log = 0);
+    /// closes the files still open
+    ~TupleEngine();
+
+    TupleEngineOptions& options() { return m_options; }
+    void setLog(TupleLog* log) { m_log = log; }
+
+    // output
+    /** @brief add an item: a new branch of the tree, or a new address for the one there
+        @param type - ROOT leaflist type: "/D", "/F", "/I", "/i", "/l" or "/C"
+        @param fileName - empty for options().fileName
+        @param write - false for a tree kept in memory
+    */
+    bool addItem(const std::string& treeName, const std::string& itemName, const std::string& type,
+                 const void* address, const std::string& fileName = "", bool write = true);
+    /** @brief the tree of an item, made the first time: in its output file, opened if need be
+        and then set up by the tree hook, or in memory
+        @return 0 if the file cannot be opened
+    */
+    TTree* itemTree(const std::string& treeName, const std::string& fileName = "", bool write = true);
+    /// open an output file for writing, or the one open already; 0 if it cannot
+    TFile* outputFile(const std::string& fileName);
+    /** @brief a new tree in a directory: with an input, the structure of its chain, so that
+        the input rows are copied
+    */
+    TTree* outputTree(const std::string& treeName, TDirectory* dir);
+    void setOpen(const OpenHook& open) { m_open = open; }
+    void setTree(const TreeHook& tree) { m_setupTree = tree; }
+
+    // input
+    bool hasInput() const { return !m_options.inputFiles.empty(); }
+    /// the chain of a tree of the input files, made the first time with a buffer per branch
+    TChain* inputChain(const std::string& treeName);
+    /** @brief a buffer for a branch of an input chain, which stays where it is as the chain
+        moves from file to file; 0 if the type of the leaf is not supported
+        @param treeName - the tree of the chain: trees may have branches of the same name
+    */
+    void* poolItem(const std::string& treeName, TChain* ch, const std::string& branchName, TLeaf* leaf);
+
+    // events
+    /** @brief read the next input entry and clear the store flags
+        @return false at the end of the input, or if the entry cannot be read
+    */
+    bool beginEvent(const InputHook& afterRead = InputHook());
+    /// flag a tree to be stored at endEvent, return the previous flag
+    bool storeRow(const std::string& treeName, bool flag);
+    void storeAll(bool flag) { m_storeAll = flag; }
+    bool storeAll() const { return m_storeAll; }
+    void setSelect(const SelectHook& select) { m_select = select; }
+    void setFill(const FillHook& fill) { m_fill = fill; }
+    /** @brief fill the flagged trees, and clear their flags
+        @return the number of rows with non-finite values
+    */
+    int endEvent();
+    /// check the first element of each item for non-finite values, counting them by item
+    bool checkFinite(TTree* t);
+
+    /** @brief write every tree and close every file
+        @param parallel - write and close the files each on its own thread, if there are several;
+                          ROOT::EnableThreadSafety must have been called before the files were opened
+    */
+    void close(bool parallel = false);
+    /// before each file is written, in turn; and once it is closed, on the thread that closed it
+    void setClose(const FileHook& beforeWrite, const FileHook& afterClose) {
+        m_beforeWrite = beforeWrite;
+        m_afterClose = afterClose;
+    }
+
+    // state, shared with a wrapper such as RootTupleSvc
+    std::map<std::string, TTree*>& trees() { return m_trees; }
+    std::map<std::string, TFile*>& files() { return m_files; }
+    std::map<std::string, TChain*>& chains() { return m_chains; }
+    /// buffers of the input branches, by tree and branch name
+    std::map<std::string, std::map<std::string, void*> >& itemPool() { return m_itemPool; }
+    std::map<std::string, bool>& storeFlags() { return m_store; }
+    bool& storeAllFlag() { return m_storeAll; }
+    long long& nextEntry() { return m_nextEntry; }
+    long long& inputEntries() { return m_inputEntries; }
+    long long& badRows() { return m_badRows; }
+    std::map<std::string, int>& badCounts() { return m_badCounts; }
+
+private:
+    void message(TupleLog::Level level, const std::string& text) {
+        if (m_log != 0 && m_log->enabled(level)) m_log->message(level, text);
+    }
+    /// apply includeBranches and excludeBranches to a chain
+    void selectBranches(TChain* ch);
+
+    TupleEngineOptions m_options;
+    TupleLog* m_log;
+    std::map<std::string, TTree*> m_trees;
+    std::map<std::string, TFile*> m_files;
+    std::map<std::string, TChain*> m_chains;
+    std::map<std::string, std::map<std::string, void*> > m_itemPool;
+    std::map<std::string, bool> m_store;
+    bool m_storeAll;
+    long long m_nextEntry, m_inputEntries, m_badRows;
+    std::map<std::string, int> m_badCounts;
+    SelectHook m_select;
+    FillHook m_fill;
+    OpenHook m_open;
+    TreeHook m_setupTree;
+    FileHook m_beforeWrite, m_afterClose;
+};
+
+#endif
@@ -0,0 +1,42 @@
+/** @file TupleLog.h
+    @brief declare TupleLog, where TupleEngine sends its messages
+
+    $Header$
+*/
+#ifndef ntupleWriterSvc_TupleLog_h
+#define ntupleWriterSvc_TupleLog_h
+
+#include <iostream>
+#include <string>
+
+/** @class TupleLog
+    @brief Destination of the messages of a TupleEngine: RootTupleSvc sends them to its MsgStream,
+    a standalone program to a stream or to nothing
+*/
+class TupleLog {
+public:
+    enum Level { Debug, Info, Warning, Error };
+    virtual ~TupleLog() {}
+    /// false for the levels not shown, so that their messages are not even made
+    virtual bool enabled(Level level) const = 0;
+    virtual void message(Level level, const std::string& text) = 0;
+};
+
+/** @class StreamTupleLog
+    @brief A TupleLog writing to a std::ostream, std::cerr by default, from a given level
+*/
+class StreamTupleLog : public TupleLog {
+public:
+    explicit StreamTupleLog(Level threshold = Info, std::ostream& out = std::cerr)
+    : m_threshold(threshold), m_out(out) {}
+    virtual bool enabled(Level level) const { return level >= m_threshold; }
+    virtual void message(Level level, const std::string& text) {
+        static const char* names[] = { "DEBUG", "INFO", "WARNING", "ERROR" };
+        if (enabled(level)) m_out << "TupleEngine " << names[level] << " " << text << std::endl;
+    }
+private:
+    Level m_threshold;
+    std::ostream& m_out;
+};
+
+#endif
@@ -29,6 +29,65 @@
 
 @endverbatim
 
+ * To read an item, typically from the input tuple when reprocessing, an ItemRef resolves it
+ * once and checks its type, instead of getItem at each event:
+ @verbatim
+    ItemRef<float> energy(m_rootTupleSvc, "MeritTuple", "EvtEnergyCorr");
+    ... *energy ...
+ @endverbatim
+ * The service updates it when the input chain moves to another file.
+
+ * A memory resident tuple (addItem with write=false) can serve as a lookup table: declareKey
+ * indexes its rows by some of its items as they are stored, and findEntry reads the row
+ * with given key values without reading any other row. On an input tuple, declareKey (or InputKey)
+ * indexes the entries of the whole input chain by one or two integer items, and findEntry makes
+ * the next events read the entries with the given keys; findEntries does so for a whole list of
+ * keys. The entries are read in entry order, whatever the order of the keys.
+
+ * @section count The Count algorithm
+ * Instances of Count placed in the algorithm sequence, for example
+ * {"Count/start", "Reco", "Count/reco", "Filter", "Count/filtered"}, count the events that reach
+ * them. An instance given the name of the one before it, as reco.Previous="start", also times the
+ * section between them with a monotonic clock. At the end of the job the jobinfo tuple gets, per
+ * instance X, the item X and, if it has a Previous, X_rejected (events lost in the section), X_time
+ * (seconds in the section) and X_timeHist (times, in bins of a factor 2 from 1 microsecond).
+ * Properties: Count.Previous (default "", no timing), Count.Time (default true, needed on both
+ * instances) and Count.TimeBins (default 20).
+
+ * @section merge Merging output files
+ * The program mergeTuples combines the output files of several jobs:
+ @verbatim
+ mergeTuples [-j threads] [-f] [-t jobinfo] merged.root job1.root job2.root ...
+ @endverbatim
+ * The baskets of each tree are copied without decompressing them, so all files must have the
+ * same items. The jobinfo rows are combined into one: integer and Double_t items, such as the
+ * Count values, are summed; Float_t items are taken from the first file. The MeritVersion,
+ * which RootTupleSvc saves in each output file, must be the same in all of them.
+
+ * @section stream Streaming to another process
+ * Trees named in StreamTrees go to a consumer over a Unix socket. To keep them in a file:
+ @verbatim
+ tupleConsumer [-c credits] /tmp/merit.sock merit.root &
+ ... job with RootTupleSvc.StreamTrees={"MeritTuple"}; RootTupleSvc.StreamSocket="/tmp/merit.sock";
+ @endverbatim
+
+ * @section replay Measuring the writer alone
+ * A job run with RootTupleSvc.CaptureFile records what it asks of the service. The program replayTuple,
+ * with src/replay/replayOptions.txt, makes the same calls with the same rows and no other algorithm,
+ * as fast as the service takes them, and reports the rate; the output options to measure are
+ * set as for any job.
+
+ * @section engine Without Gaudi
+ * The trees, files, input chains, store flags and event cycle of RootTupleSvc are those of a
+ * TupleEngine (src/engine, library tupleEngine), which a program can use directly: addItem,
+ * then per event beginEvent, storeRow and endEvent, and close. Its messages go to a TupleLog.
+ * The choice of the rows stored (TreeFilters, Prescale, Reservoir), the encoders and the other
+ * features above stay in the service, which adds them through the engine's hooks.
+ * Several engines can run in one process, each on its own thread; benchTupleEngine measures them:
+ @verbatim
+ benchTupleEngine -j 4 -n 1000000 -i 100
+ @endverbatim
+
  <hr>
  * @section jobOptions jobOptions
  * @param RootTupleSvc.filename 
@@ -49,6 +108,56 @@
  * Default 100000
  * In Bytes, denoting the size the ntuple must reach before triggering a true
  * write to disk.  ROOT's default is 10000000
+ * @param RootTupleSvc.FlushBytes
+ * Default 0 (ROOT's default AutoFlush)
+ * Uncompressed size in bytes of the first cluster of every output tree, passed to
+ * TTree::SetAutoFlush as a negative value: ROOT flushes when the tree holds this many bytes,
+ * and keeps the number of entries it had then as the cluster size. The cluster size of each
+ * tree is reported at finalize
+ * @param RootTupleSvc.TreeFlushBytes
+ * Default "" (empty string)
+ * Per tree values of FlushBytes, in the form "MeritTuple=60000000,jobinfo=100000", for
+ * the trees named only
+ * @param RootTupleSvc.OutputMemoryBudget
+ * Default 0 (no limit)
+ * Total memory in MB of the baskets being filled by all trees written to files. Checked every
+ * MemoryCheckInterval events: above the budget, or below half of it, basket sizes are redistributed
+ * with TTree::OptimizeBaskets, each tree getting a share in proportion to the uncompressed bytes
+ * it has written (TTree::GetTotBytes). A redistribution is only made if the memory has changed by
+ * a tenth of the budget since the previous one. The new sizes apply as each basket is written; if the
+ * baskets are still above the budget, those of the largest trees are flushed at once (TTree::FlushBaskets),
+ * which ends a cluster of the tree early. The peak basket memory of each tree, and the number of
+ * these early flushes, are reported at the end of the job
+ * @param RootTupleSvc.MemoryCheckInterval
+ * Default 100
+ * Number of events between checks of the basket memory; 0 disables the checks and the report
+ * @param RootTupleSvc.CheckpointInterval
+ * Default 0 (no checkpoints)
+ * Number of events between checkpoints. At a checkpoint all trees written to files are flushed
+ * and their headers saved (TTree::AutoSave), and a small state record is written atomically:
+ * the next input index, the entries of each tree, the non-finite value counts, the number of
+ * events and the counters registered with addCounter (the Count algorithm values). ROOT's own
+ * AutoSave is turned off for the output trees. The record is removed at a normal end of job
+ * @param RootTupleSvc.CheckpointFile
+ * Default "" for the output file name followed by ".checkpoint"
+ * @param RootTupleSvc.Resume
+ * Default false
+ * Continue from the last checkpoint: the output files are opened for update, trees with entries
+ * after the checkpoint are cut back to it, and input reading continues from the saved index.
+ * Cutting a tree back copies its entries up to the checkpoint into a new tree, which takes about
+ * as long as writing them did; this only happens to trees saved again after the checkpoint.
+ * Without a checkpoint the job starts from the beginning. Memory resident trees, RNTuple trees and
+ * columnar exports are not restored
+ * @param RootTupleSvc.ParallelFinalize
+ * Default false
+ * Write and close the output files on one thread each at the end of the job, if there is more than
+ * one (needs ROOT 6, whose thread safety is then enabled at initialize)
+ * @param RootTupleSvc.PrintTrees
+ * Default false
+ * Print a summary of each tree written (TTree::Print) at the end of the job
+ * @param RootTupleSvc.ScanJobInfo
+ * Default false
+ * Print the contents of the jobinfo tree at the end of the job
  * @param RootTupleSvc.RejectIfBad
  * Default true
  * if set, tuple entries containing any non-finite values are not written
@@ -75,6 +184,172 @@
  * A list of merit branch names to exclude when reading an input set of merit 
  * files this list may use wildcards, and must conform to the case-sensitive 
  * names of the actual branches in the ROOT file
+ * @param RootTupleSvc.RNTupleTrees
+ * Default "" (empty list)
+ * Names of trees to write as ROOT RNTuples instead of TTrees, in the same output file.
+ * Items, storeRowFlag and the non-finite check work as for a TTree;
+ * getOutputTreeType returns "RNTuple" for them, and getOutputTreePtr a null pointer.
+ * Ignored, with a warning, if ROOT is older than 6.32
+ * @param RootTupleSvc.ColumnarTrees
+ * Default "" (empty list)
+ * Names of trees, or "*" for all trees written to a file, to also export as flat columns
+ * in the directory <ROOT file name>.columns/<tree name>: one uncompressed <item>.col file per item,
+ * which can be used directly with mmap, and a schema.json describing them
+ * @param RootTupleSvc.ColumnarClusterRows
+ * Default 10000
+ * Number of rows buffered in memory before they are appended to the column files
+ * @param RootTupleSvc.ConcurrentSlots
+ * Default 0
+ * Number of event slots for multi-threaded event processing. With 0, one event at a time is
+ * processed between the BeginEvent and EndEvent incidents. Otherwise the incidents are ignored:
+ * events are delimited by beginSlotEvent and endSlotEvent, each slot has its own tuple variables
+ * (addItem after selectSlot) and input buffers, and a writer thread fills the trees from
+ * the rows the slots submit. Needs ROOT 6; checkpoints are not available in this mode
+ * @param RootTupleSvc.OrderedOutput
+ * Default true
+ * In concurrent mode, write the rows in event number order, starting at StartingIndex,
+ * rather than in the order the slots end their events
+ * @param RootTupleSvc.DictionaryItems
+ * Default {}
+ * String items written as an integer code, for columns with few distinct values.
+ * An entry is "tree:item", or just "item" for that item in every tree. The codes go in
+ * the item's branch (Int_t), and the values in a tree tree_item_dict (code, value) of the same file.
+ * On input, such items are decoded: getItem returns the string, in a buffer sized for the
+ * longest value of all the input files. Each checkpoint saves the dictionaries as they are, and
+ * Resume continues them, so codes written before and after a restart agree. Not available in
+ * concurrent mode, where encoded input trees are refused as well; fillRows refuses these items
+ * @param RootTupleSvc.DeltaItems
+ * Default {}
+ * Integer items (Int_t, UInt_t, ULong64_t) written as the difference to the previous row,
+ * zigzag encoded so that small differences of either sign have only low bits set, which
+ * the compression then packs. For run numbers, event ids, time stamps. Entries as for DictionaryItems.
+ * A TParameter tree_item_delta in the file holds the block size; on input these items are
+ * decoded, so getItem sees the values. The size of each column is reported at the end.
+ * fillRows encodes the rows it is given, and Resume continues from the last row kept.
+ * Not available in concurrent mode
+ * @param RootTupleSvc.DeltaBlockRows
+ * Default 1000
+ * Every so many rows, a delta encoded value is stored whole: reading an entry out of
+ * sequence reads at most this many entries of the branch
+ * @param RootTupleSvc.ZoneMapTrees
+ * Default {}
+ * Output trees that get a zone map: for each zone of consecutive entries (a cluster, once
+ * its size is chosen), the minimum, maximum and number of non-finite values of each numeric item
+ * (over all the elements of arrays, encoded items excluded). Written as the tree tree_zonemap
+ * (first, entries, min[n], max[n], nonFinite[n]) with the item names in the TNamed tree_zonemap_columns
+ * @param RootTupleSvc.ZoneMapRows
+ * Default 10000
+ * Entries per zone while the cluster size is not known
+ * @param RootTupleSvc.InputCut
+ * Default ""
+ * A cut on the input, "tree: EvtEnergyCorr > 100 && EvtRun >= 5" (the default tree if no tree is named):
+ * comparisons of items with numbers, joined by && and ||. Using the zone maps of the input files,
+ * the zones where no entry can pass are skipped without being read; the other entries are all
+ * read, clients still apply the cut. The next entry is chosen at the end of each event, and the
+ * run is stopped there when no entry is left, so no event runs on the values of the previous one
+ * @param RootTupleSvc.EndingIndex
+ * Default -1
+ * Input entry at which to stop the run; -1 for the end of the input
+ * @param RootTupleSvc.InputKey
+ * Default ""
+ * Integer items that identify an input entry, for findEntry on that tree, as declareKey would:
+ * "MeritTuple: EvtRun, EvtEventId64" (one or two items; the default tree if none is named).
+ * The first call reads these items of the whole input chain and keeps the entries sorted by key;
+ * entries sharing a key are reported, and findEntry reads them all.
+ * Delta encoded items (see DeltaItems) are decoded first, so the keys are the values getItem returns
+ * @param RootTupleSvc.InputKeyCache
+ * Default ""
+ * File to keep that index in: a later job on the same input files, with the same number
+ * of entries and the same UUID each, reads it instead of the input. Any other input, including
+ * a file written again under the same name, makes a new one
+ * @param RootTupleSvc.CompressionTuneEvents
+ * Default 0
+ * If not 0, the values of every branch of the output trees are kept for that many rows, then
+ * compressed with each of CompressionCandidates, as ROOT would compress them, and each branch
+ * gets the setting that does best for CompressionObjective for the rest of the job.
+ * The settings chosen, with the ratio and speeds measured, go in the tree tree_compression
+ * @param RootTupleSvc.CompressionCandidates
+ * Default {"ZLIB:1", "ZLIB:6", "LZMA:5", "LZ4:4", "ZSTD:5"}
+ * Settings tried: algorithm (ZLIB, LZMA, LZ4, ZSTD) and level
+ * @param RootTupleSvc.CompressionObjective
+ * Default "size"
+ * "size": the smallest output; "write": the fastest compression, "read": the fastest
+ * decompression, of the settings whose size is within CompressionSizeTolerance of the smallest
+ * @param RootTupleSvc.CompressionSizeTolerance
+ * Default 1.5
+ * @param RootTupleSvc.CompressionTable
+ * Default ""
+ * Output file of an earlier job: the settings in its tree_compression trees are applied
+ * from the first row, without sampling
+ * @param RootTupleSvc.StagingDirectory
+ * Default ""
+ * Local directory where the output files are written, instead of their destination (filename, or
+ * the file name given to addItem). When finalize has written and closed a file, a thread moves it to its
+ * destination, while the other files are written: a rename if possible, else a copy to destination.part
+ * checked against the Adler-32 checksum of the staged file, then renamed. A file that fails stays
+ * where it was staged. Not used with checkpoints
+ * @param RootTupleSvc.PrefetchDirectory
+ * Default ""
+ * Local directory to copy input files to: while a file of inFileList is read, a thread copies the
+ * next PrefetchFiles files there, and the chains read a file from its copy if it is complete when
+ * they reach it. Copies behind the current file are removed. Only files of the file system are
+ * copied, in chunks, so that the end of the job does not wait for a whole file; remote files are
+ * read where they are. Not used in concurrent mode
+ * @param RootTupleSvc.PrefetchFiles
+ * Default 2
+ * @param RootTupleSvc.PrefetchLimitMB
+ * Default 10000
+ * Disk space the copies may take; a file that does not fit alone is read where it is
+ * @param RootTupleSvc.TreeFilters
+ * Default {} (empty list)
+ * Selections of the rows stored, as "tree: expression" over the numeric scalar items of the tree
+ * (the default tree without "tree:"), for example {"MeritTuple: CTBBestEnergy > 30"}, in the syntax
+ * of InputCut. A row that fails is not checked for non-finite values nor filled; rows given to
+ * fillRows are filtered the same way. Delta encoded items are tested on their values, and dictionary
+ * encoded ones, being strings, cannot be used. jobinfo gets tree_filterPassed and tree_filterFailed.
+ * In concurrent mode, the writer thread filters the rows of the slots
+ * @param RootTupleSvc.CaptureFile
+ * Default "" (no capture)
+ * Record the items added (addItem) and, at each event, the rows of the trees flagged to be stored
+ * and those stored with saveRow, to this file, in the format of ntupleWriterSvc/TupleCapture.h.
+ * A tree copied from the input has its input items recorded as if they were added. Not with ConcurrentSlots
+ * @param RootTupleSvc.StreamTrees
+ * Default {} (empty list)
+ * Trees whose rows are sent, in batches of columns, to a consumer listening on StreamSocket instead of
+ * being written to a file; the job fails at initialize if it cannot connect. The consumer grants
+ * credits for the batches it accepts, and the job waits when it has none. The protocol is in
+ * ntupleWriterSvc/TupleStream.h; the program tupleConsumer receives the trees and writes them to a file.
+ * Not available on Windows
+ * @param RootTupleSvc.StreamSocket
+ * Default ""
+ * Path of the Unix socket of the consumer
+ * @param RootTupleSvc.StreamBatchRows
+ * Default 1000
+ * Rows per batch
+ * @param RootTupleSvc.LiveTrees
+ * Default {} (empty list)
+ * Trees whose latest rows are published in a POSIX shared memory segment, for monitoring a running
+ * job. The layout, with the schema and a lock-free way to read it, is in ntupleWriterSvc/LiveRows.h.
+ * Encoded items are left out. The segment is removed at the end of the job. Not available on Windows
+ * @param RootTupleSvc.LiveRows
+ * Default 1000
+ * Number of rows each segment keeps
+ * @param RootTupleSvc.LiveSegment
+ * Default "" for "/RootTupleSvc_" followed by the process id
+ * Start of the segment names, each followed by _ and the tree name
+ * @param RootTupleSvc.Prescale
+ * Default ""
+ * "tree1=N,tree2=M": of the rows stored in a tree, keep the first and then every Nth.
+ * jobinfo gets an item tree1_weight, the number of rows each row kept stands for
+ * @param RootTupleSvc.Reservoir
+ * Default ""
+ * "tree1=N": keep a uniform random sample of N of the rows stored in the tree, filled in the order
+ * stored when the job ends; tree1_weight in jobinfo. RNTuple, stream and columnar outputs of the tree
+ * get the same rows. In concurrent mode, the sample is of the rows in the order they are written. A tree
+ * with encoded items is refused
+ * @param RootTupleSvc.ReservoirSeed
+ * Default 12345
+ * Seed of the reservoir sampling, so that a job is reproducible
  * <hr>
  * @section notes release notes
  * release.notes
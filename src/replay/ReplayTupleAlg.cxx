@@ -0,0 +1,231 @@
+/** @file ReplayTupleAlg.cxx
+    @brief replay a capture of RootTupleSvc (RootTupleSvc.CaptureFile) through the service
+
+    $Header$
+*/
+#include "GaudiKernel/Algorithm.h"
+#include "GaudiKernel/MsgStream.h"
+#include "GaudiKernel/AlgFactory.h"
+#include "GaudiKernel/IEventProcessor.h"
+
+#include "ntupleWriterSvc/INTupleWriterSvc.h"
+#include "ntupleWriterSvc/TupleCapture.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <vector>
+
+/** @class ReplayTupleAlg
+    @brief Makes the addItem, saveRow and storeRowFlag calls of a captured job, with its rows, and nothing else
+
+    Items are added in the order and at the event they were in the captured job, to buffers
+    of this algorithm; at each event the rows captured are copied there and flagged to be stored,
+    after the rows the job stored with saveRow are copied and saved in turn.
+    The run is stopped at the end of the capture, so ApplicationMgr.EvtMax only needs to be
+    large enough. Properties:
+    - CaptureFile: the file to replay
+    - Repeat (default 1): replay it this many times, for longer measurements
+    - FilePrefix (default "replay_"): put before the name of each output file of the captured
+      job, so as not to overwrite it
+    The rate reported at the end does not include the writing of the files at finalize.
+*/
+class ReplayTupleAlg : public Algorithm {
+public:
+    ReplayTupleAlg(const std::string& name, ISvcLocator* pSvcLocator);
+    StatusCode initialize();
+    StatusCode execute();
+    StatusCode finalize();
+
+private:
+    /// an item of a tree, and the buffer given to the service
+    struct Column {
+        TupleCapture::Column layout;
+        std::vector<double> buffer; ///< double, to keep it aligned
+    };
+    /// read up to the next Event, adding the items and keeping the saved rows on the way: false at the end of the capture
+    bool readEvent(MsgStream& log);
+    StatusCode addColumn(MsgStream& log);
+    /// copy a row to the buffers of a tree
+    bool unpack(unsigned int tree, const std::string& row);
+
+    std::string m_captureFile;
+    int m_repeat;
+    std::string m_filePrefix;
+    int m_pass;
+    INTupleWriterSvc* m_rootTupleSvc;
+    TupleCapture::Reader* m_reader;
+    bool m_pending;   ///< an Event has been read, not yet replayed
+    /// the Rows saved during that event: tree index and row
+    std::vector<std::pair<unsigned int, std::string> > m_saved;
+    std::vector<std::string> m_treeNames;
+    /// per tree, in the order of the capture; a buffer never moves once given to the service
+    std::vector<std::vector<Column*> > m_columns;
+    long long m_events, m_rows;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+DECLARE_ALGORITHM_FACTORY(ReplayTupleAlg);
+
+ReplayTupleAlg::ReplayTupleAlg(const std::string& name, ISvcLocator* pSvcLocator)
+: Algorithm(name, pSvcLocator), m_pass(0), m_rootTupleSvc(0), m_reader(0), m_pending(false)
+, m_events(0), m_rows(0)
+{
+    declareProperty("CaptureFile", m_captureFile="");
+    declareProperty("Repeat", m_repeat=1);
+    declareProperty("FilePrefix", m_filePrefix="replay_");
+}
+
+StatusCode ReplayTupleAlg::initialize()
+{
+    MsgStream log(msgSvc(), name());
+    setProperties();
+    StatusCode sc = service("RootTupleSvc", m_rootTupleSvc);
+    if (sc.isFailure()) {
+        log << MSG::ERROR << "Could not find the RootTupleSvc" << endreq;
+        return sc;
+    }
+    m_reader = new TupleCapture::Reader;
+    if (!m_reader->open(m_captureFile)) {
+        log << MSG::ERROR << "Cannot read capture file \"" << m_captureFile << "\"" << endreq;
+        return StatusCode::FAILURE;
+    }
+    // the items added before the first event, as the captured job did in its initialize
+    m_pending = readEvent(log);
+    m_start = std::chrono::steady_clock::now();
+    return StatusCode::SUCCESS;
+}
+
+StatusCode ReplayTupleAlg::addColumn(MsgStream& log)
+{
+    const TupleCapture::Reader& r = *m_reader;
+    std::vector<std::string>::const_iterator it = std::find(m_treeNames.begin(), m_treeNames.end(), r.tree);
+    unsigned int tree = it - m_treeNames.begin();
+    if (it == m_treeNames.end()) {
+        m_treeNames.push_back(r.tree);
+        m_columns.push_back(std::vector<Column*>());
+    }
+    Column* c = new Column;
+    c->layout = TupleCapture::column(r.item, r.type);
+    // a string is copied up to its zero: room for any the job had
+    size_t bytes = c->layout.type == 'C' ? 4096 : c->layout.size*c->layout.length;
+    c->buffer.resize((bytes+sizeof(double)-1)/sizeof(double));
+    m_columns[tree].push_back(c);
+
+    std::string file(r.file);
+    std::string::size_type slash = file.rfind('/');
+    file.insert(slash == std::string::npos ? 0 : slash+1, m_filePrefix);
+
+    void* p = &c->buffer[0];
+    StatusCode sc = StatusCode::FAILURE;
+    switch (c->layout.type) {
+        case 'D': sc = m_rootTupleSvc->addItem(r.tree, r.item, static_cast<double*>(p), file, r.write); break;
+        case 'F': sc = m_rootTupleSvc->addItem(r.tree, r.item, static_cast<float*>(p), file, r.write); break;
+        case 'I': sc = m_rootTupleSvc->addItem(r.tree, r.item, static_cast<int*>(p), file, r.write); break;
+        case 'i': sc = m_rootTupleSvc->addItem(r.tree, r.item, static_cast<unsigned int*>(p), file, r.write); break;
+        case 'l': sc = m_rootTupleSvc->addItem(r.tree, r.item, static_cast<unsigned long long*>(p), file, r.write); break;
+        case 'C': sc = m_rootTupleSvc->addItem(r.tree, r.item, static_cast<char*>(p), file, r.write); break;
+    }
+    if (sc.isFailure())
+        log << MSG::ERROR << "Cannot add item " << r.item << " of type " << r.type << " to " << r.tree << endreq;
+    return sc;
+}
+
+bool ReplayTupleAlg::readEvent(MsgStream& log)
+{
+    while (true) {
+        int kind = m_reader->next();
+        if (kind == TupleCapture::Event) return true;
+        if (kind == TupleCapture::Row) {
+            m_saved.push_back(std::make_pair(m_reader->trees[0], m_reader->rows[0]));
+            continue;
+        }
+        if (kind != TupleCapture::Item) return false;
+        // an item seen in an earlier pass is there already
+        if (m_pass > 0) continue;
+        if (addColumn(log).isFailure()) return false;
+    }
+}
+
+bool ReplayTupleAlg::unpack(unsigned int tree, const std::string& row)
+{
+    if (tree >= m_columns.size()) return false;
+    const std::vector<Column*>& cols = m_columns[tree];
+    const char* p = row.data();
+    const char* end = p + row.size();
+    for (unsigned int i = 0; i<cols.size(); ++i) {
+        char* buffer = reinterpret_cast<char*>(&cols[i]->buffer[0]);
+        if (cols[i]->layout.type == 'C') {
+            size_t n = strnlen(p, end - p);
+            if (n == size_t(end - p)) return false;
+            size_t room = cols[i]->buffer.size()*sizeof(double);
+            memcpy(buffer, p, std::min(n+1, room));
+            buffer[room-1] = 0;
+            p += n+1;
+            continue;
+        }
+        size_t n = cols[i]->layout.size*cols[i]->layout.length;
+        if (n > size_t(end - p)) return false;
+        memcpy(buffer, p, n);
+        p += n;
+    }
+    return p == end;
+}
+
+StatusCode ReplayTupleAlg::execute()
+{
+    MsgStream log(msgSvc(), name());
+    if (!m_pending) m_pending = readEvent(log);
+    if (!m_pending && ++m_pass < m_repeat) {
+        // again from the start: the items are all there
+        delete m_reader;
+        m_reader = new TupleCapture::Reader;
+        m_saved.clear();
+        m_pending = m_reader->open(m_captureFile) && readEvent(log);
+    }
+    if (!m_pending) {
+        log << MSG::INFO << "End of the capture, stopping the run" << endreq;
+        IEventProcessor* eventProcessor = 0;
+        if (service("ApplicationMgr", eventProcessor).isSuccess()) eventProcessor->stopRun();
+        m_rootTupleSvc->storeRowFlag(false);
+        return StatusCode::SUCCESS;
+    }
+    m_pending = false;
+    for (unsigned int i = 0; i<m_saved.size(); ++i) {
+        unsigned int tree = m_saved[i].first;
+        if (!unpack(tree, m_saved[i].second)) {
+            log << MSG::ERROR << "Row saved at event " << m_events << " does not match the items of its tree" << endreq;
+            return StatusCode::FAILURE;
+        }
+        m_rootTupleSvc->saveRow(m_treeNames[tree]);
+        ++m_rows;
+    }
+    m_saved.clear();
+    for (unsigned int i = 0; i<m_reader->trees.size(); ++i) {
+        unsigned int tree = m_reader->trees[i];
+        if (!unpack(tree, m_reader->rows[i])) {
+            log << MSG::ERROR << "Captured row " << m_events << " does not match the items of its tree" << endreq;
+            return StatusCode::FAILURE;
+        }
+        m_rootTupleSvc->storeRowFlag(m_treeNames[tree], true);
+        ++m_rows;
+    }
+    ++m_events;
+    return StatusCode::SUCCESS;
+}
+
+StatusCode ReplayTupleAlg::finalize()
+{
+    MsgStream log(msgSvc(), name());
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count();
+    log << MSG::INFO << "Replayed " << m_events << " events, " << m_rows << " rows in " << seconds << " s";
+    if (seconds > 0) log << ": " << m_events/seconds << " events/s";
+    log << endreq;
+    for (unsigned int t = 0; t<m_columns.size(); ++t) {
+        for (unsigned int i = 0; i<m_columns[t].size(); ++i) delete m_columns[t][i];
+    }
+    m_columns.clear();
+    delete m_reader;
+    m_reader = 0;
+    return StatusCode::SUCCESS;
+}
@@ -0,0 +1,329 @@
+/** @file concurrentTupleAlg.cxx
+    @brief test of the concurrent mode of RootTupleSvc
+
+    $Header$
+*/
+
+#include "GaudiKernel/MsgStream.h"
+#include "GaudiKernel/AlgFactory.h"
+#include "GaudiKernel/Algorithm.h"
+#include "GaudiKernel/StatusCode.h"
+
+#include "ntupleWriterSvc/INTupleWriterSvc.h"
+
+#include "TTree.h"
+#include "TBranch.h"
+#include "TLeaf.h"
+#include "TObjArray.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+/**
+ * @class concurrentTupleAlg
+ * @brief test algorithm for the concurrent mode of the ntupleWriterSvc
+ *
+ * In its one event, it fills the tree "serial" with the rows of all the events from slot 0,
+ * one event at a time, then the tree "concurrent" with the same rows from all the slots at
+ * once, each slot on its own thread. finalize checks that the two trees have the same entries:
+ * in the same order with ordered output, matched by index without.
+ *
+ * With the input property set, it reads instead the tree "serial" of a file written that way,
+ * from all the slots at once: each slot checks that its own input variables hold the entry it
+ * asked for, and stores it again with the number of the slot. finalize checks that every input
+ * entry was written once, at its own place with ordered output.
+ *
+ * Run with src/test/concurrentOptions.txt, then src/test/concurrentInputOptions.txt,
+ * which reads the file of the first job, without ordering.
+ */
+class concurrentTupleAlg : public Algorithm {
+
+public:
+    concurrentTupleAlg(const std::string& name, ISvcLocator* pSvcLocator);
+
+    StatusCode initialize();
+    StatusCode execute();
+    StatusCode finalize();
+
+private:
+    /// the tuple variables of one slot
+    struct Row {
+        int    index;
+        double value;
+        float  array[3];
+        char   name[16];
+    };
+    /// add the items of a row to a tree, for the current slot
+    StatusCode addRow(const std::string& tupleName, Row& row);
+    /// the values of the row of an event
+    static void makeRow(long long event, Row& row);
+    /// process the events of one slot: those with event%slots==slot
+    void runSlot(unsigned int slot);
+    /// process the input entries of one slot, those with entry%slots==slot
+    void readSlot(unsigned int slot);
+    /// entry of each index of a tree, false if an index is missing or repeated
+    bool entriesByIndex(TTree* t, std::vector<long long>& entries, MsgStream& log);
+    /// compare the two trees entry by entry
+    StatusCode compare(MsgStream& log);
+    /// check the tree written from the input
+    StatusCode checkInput(MsgStream& log);
+
+    int m_slots;
+    int m_events;
+    bool m_ordered;
+    bool m_input;
+    std::vector<Row> m_rows; ///< one per slot
+    Row m_serial;
+    std::vector<int> m_slotNumber;            ///< per slot, the item "slot" added to the input tree
+    std::vector<const int*> m_inputIndex;     ///< per slot, the input item "index"
+    std::vector<int> m_failures; ///< per slot
+    INTupleWriterSvc* m_rootTupleSvc;
+};
+
+DECLARE_ALGORITHM_FACTORY(concurrentTupleAlg);
+
+concurrentTupleAlg::concurrentTupleAlg(const std::string& name, ISvcLocator* pSvcLocator)
+: Algorithm(name, pSvcLocator), m_rootTupleSvc(0)
+{
+    declareProperty("slots",  m_slots=4);  // must match RootTupleSvc.ConcurrentSlots
+    declareProperty("events", m_events=1000);
+    declareProperty("ordered", m_ordered=true); // must match RootTupleSvc.OrderedOutput
+    declareProperty("input",  m_input=false);   // read "serial" from RootTupleSvc.inFileList
+}
+
+StatusCode concurrentTupleAlg::addRow(const std::string& tupleName, Row& row)
+{
+    if (m_rootTupleSvc->addItem(tupleName, "index",    &row.index).isFailure()) return StatusCode::FAILURE;
+    if (m_rootTupleSvc->addItem(tupleName, "value",    &row.value).isFailure()) return StatusCode::FAILURE;
+    if (m_rootTupleSvc->addItem(tupleName, "array[3]", row.array).isFailure())  return StatusCode::FAILURE;
+    return m_rootTupleSvc->addItem(tupleName, "name", row.name);
+}
+
+StatusCode concurrentTupleAlg::initialize()
+{
+    MsgStream log(msgSvc(), name());
+    setProperties();
+
+    StatusCode sc = service("RootTupleSvc", m_rootTupleSvc);
+    if( sc.isFailure() ) {
+        log << MSG::ERROR << "concurrentTupleAlg failed to get the RootTupleSvc" << endreq;
+        return sc;
+    }
+
+    // one set of variables per slot, slot 0 first
+    m_rows.resize(m_slots);
+    m_failures.assign(m_slots, 0);
+    if (m_input) {
+        m_slotNumber.assign(m_slots, 0);
+        m_inputIndex.assign(m_slots, 0);
+        for (int slot = 0; slot<m_slots; ++slot) {
+            m_rootTupleSvc->selectSlot(slot);
+            // a new item makes the tree a copy of the input one
+            if (m_rootTupleSvc->addItem("serial", "slot", &m_slotNumber[slot]).isFailure()) {
+                log << MSG::ERROR << "Could not add the item slot for slot " << slot << endreq;
+                return StatusCode::FAILURE;
+            }
+            void* ptr = 0;
+            if (m_rootTupleSvc->getItem("serial", "index", ptr) != "Int_t") {
+                log << MSG::ERROR << "No input item index for slot " << slot << endreq;
+                return StatusCode::FAILURE;
+            }
+            m_inputIndex[slot] = reinterpret_cast<const int*>(ptr);
+            if (slot > 0 && m_inputIndex[slot] == m_inputIndex[0]) {
+                log << MSG::ERROR << "Slot " << slot << " shares the input variables of slot 0" << endreq;
+                return StatusCode::FAILURE;
+            }
+        }
+        m_rootTupleSvc->selectSlot(0);
+        return StatusCode::SUCCESS;
+    }
+    for (int slot = 0; slot<m_slots; ++slot) {
+        m_rootTupleSvc->selectSlot(slot);
+        makeRow(0, m_rows[slot]);
+        if (addRow("concurrent", m_rows[slot]).isFailure()) {
+            log << MSG::ERROR << "Could not add the items of slot " << slot << endreq;
+            return StatusCode::FAILURE;
+        }
+    }
+    m_rootTupleSvc->selectSlot(0);
+    makeRow(0, m_serial);
+    return addRow("serial", m_serial);
+}
+
+void concurrentTupleAlg::makeRow(long long event, Row& row)
+{
+    row.index    = (int)event;
+    row.value    = std::sqrt(double(event));
+    row.array[0] = event;
+    row.array[1] = 0.5f*event;
+    row.array[2] = -1.f*event;
+    sprintf(row.name, "event%lld", event % 100);
+}
+
+void concurrentTupleAlg::runSlot(unsigned int slot)
+{
+    // the serial events came first: this pass continues the event numbers after them
+    for (long long event = slot; event<m_events; event += m_slots) {
+        if (m_rootTupleSvc->beginSlotEvent(slot, m_events+event).isFailure()) { ++m_failures[slot]; return; }
+        makeRow(event, m_rows[slot]);
+        m_rootTupleSvc->storeRowFlag("concurrent", true);
+        if (m_rootTupleSvc->endSlotEvent(slot).isFailure()) { ++m_failures[slot]; return; }
+    }
+}
+
+void concurrentTupleAlg::readSlot(unsigned int slot)
+{
+    for (long long entry = slot; entry<m_events; entry += m_slots) {
+        if (m_rootTupleSvc->beginSlotEvent(slot, entry).isFailure()) { ++m_failures[slot]; return; }
+        // another slot reading its entry at the same time must not show here
+        if (*m_inputIndex[slot] != entry) { ++m_failures[slot]; return; }
+        m_slotNumber[slot] = slot;
+        m_rootTupleSvc->storeRowFlag("serial", true);
+        if (m_rootTupleSvc->endSlotEvent(slot).isFailure()) { ++m_failures[slot]; return; }
+    }
+}
+
+StatusCode concurrentTupleAlg::execute()
+{
+    MsgStream log(msgSvc(), name());
+
+    if (m_input) {
+        std::vector<std::thread> threads;
+        for (int slot = 0; slot<m_slots; ++slot)
+            threads.push_back(std::thread(&concurrentTupleAlg::readSlot, this, slot));
+        for (unsigned int i = 0; i<threads.size(); ++i) threads[i].join();
+        m_rootTupleSvc->drainSlots();
+        m_rootTupleSvc->selectSlot(0);
+        for (int slot = 0; slot<m_slots; ++slot) {
+            if (m_failures[slot] > 0) {
+                log << MSG::ERROR << "Slot " << slot << " did not read its input entries" << endreq;
+                return StatusCode::FAILURE;
+            }
+        }
+        return StatusCode::SUCCESS;
+    }
+
+    // reference: every event from slot 0 on this thread
+    for (long long event = 0; event<m_events; ++event) {
+        if (m_rootTupleSvc->beginSlotEvent(0, event).isFailure()) return StatusCode::FAILURE;
+        makeRow(event, m_serial);
+        m_rootTupleSvc->storeRowFlag("serial", true);
+        if (m_rootTupleSvc->endSlotEvent(0).isFailure()) return StatusCode::FAILURE;
+    }
+    m_rootTupleSvc->drainSlots();
+
+    std::vector<std::thread> threads;
+    for (int slot = 0; slot<m_slots; ++slot)
+        threads.push_back(std::thread(&concurrentTupleAlg::runSlot, this, slot));
+    for (unsigned int i = 0; i<threads.size(); ++i) threads[i].join();
+    m_rootTupleSvc->drainSlots();
+    m_rootTupleSvc->selectSlot(0);
+
+    for (int slot = 0; slot<m_slots; ++slot) {
+        if (m_failures[slot] > 0) {
+            log << MSG::ERROR << "Slot " << slot << " failed" << endreq;
+            return StatusCode::FAILURE;
+        }
+    }
+    return StatusCode::SUCCESS;
+}
+
+StatusCode concurrentTupleAlg::compare(MsgStream& log)
+{
+    void* ptr = 0;
+    long long nSerial = m_rootTupleSvc->getOutputTreePtr(ptr, "serial");
+    TTree* serial = reinterpret_cast<TTree*>(ptr);
+    long long nConcurrent = m_rootTupleSvc->getOutputTreePtr(ptr, "concurrent");
+    TTree* concurrent = reinterpret_cast<TTree*>(ptr);
+    if (serial == 0 || concurrent == 0 || nSerial != m_events || nConcurrent != m_events) {
+        log << MSG::ERROR << "Expected " << m_events << " rows in each tree, found "
+            << nSerial << " and " << nConcurrent << endreq;
+        return StatusCode::FAILURE;
+    }
+
+    // without ordering, the rows of the concurrent tree are matched by index
+    std::vector<long long> entries;
+    if (!m_ordered && !entriesByIndex(concurrent, entries, log)) return StatusCode::FAILURE;
+
+    TObjArray* branches = serial->GetListOfBranches();
+    for (long long entry = 0; entry<m_events; ++entry) {
+        serial->GetEntry(entry);
+        concurrent->GetEntry(m_ordered ? entry : entries[entry]);
+        for (int i = 0; i<branches->GetEntries(); ++i) {
+            TLeaf* a = (TLeaf*)(*((TBranch*)(*branches)[i])->GetListOfLeaves())[0];
+            TLeaf* b = concurrent->GetLeaf(a->GetName());
+            bool same = b != 0;
+            if (same && std::string(a->GetTypeName()) == "Char_t") {
+                same = strcmp((const char*)a->GetValuePointer(), (const char*)b->GetValuePointer()) == 0;
+            } else {
+                for (int k = 0; same && k<a->GetLen(); ++k) same = a->GetValue(k) == b->GetValue(k);
+            }
+            if (!same) {
+                log << MSG::ERROR << "Entry " << entry << ": item " << a->GetName()
+                    << " differs between the serial and concurrent trees" << endreq;
+                return StatusCode::FAILURE;
+            }
+        }
+    }
+    log << MSG::INFO << "The " << m_events << " rows written from " << m_slots
+        << " slots match the serial ones" << endreq;
+    return StatusCode::SUCCESS;
+}
+
+bool concurrentTupleAlg::entriesByIndex(TTree* t, std::vector<long long>& entries, MsgStream& log)
+{
+    TBranch* branch = t->GetBranch("index");
+    if (branch == 0) {
+        log << MSG::ERROR << "Tree " << t->GetName() << " has no item index" << endreq;
+        return false;
+    }
+    entries.assign(m_events, -1);
+    for (long long entry = 0; entry<t->GetEntries(); ++entry) {
+        branch->GetEntry(entry);
+        long long index = (long long)branch->GetLeaf("index")->GetValue(0);
+        if (index < 0 || index >= m_events || entries[index] >= 0) {
+            log << MSG::ERROR << "Tree " << t->GetName() << ": index " << index << " of entry "
+                << entry << " is out of range or repeated" << endreq;
+            return false;
+        }
+        entries[index] = entry;
+    }
+    return true;
+}
+
+StatusCode concurrentTupleAlg::checkInput(MsgStream& log)
+{
+    void* ptr = 0;
+    long long n = m_rootTupleSvc->getOutputTreePtr(ptr, "serial");
+    TTree* t = reinterpret_cast<TTree*>(ptr);
+    if (t == 0 || n != m_events || t->GetBranch("slot") == 0) {
+        log << MSG::ERROR << "Expected " << m_events << " rows with a slot item, found " << n << endreq;
+        return StatusCode::FAILURE;
+    }
+    std::vector<long long> entries;
+    if (!entriesByIndex(t, entries, log)) return StatusCode::FAILURE;
+    TBranch* slotBranch = t->GetBranch("slot");
+    for (long long index = 0; index<m_events; ++index) {
+        if (m_ordered && entries[index] != index) {
+            log << MSG::ERROR << "Input entry " << index << " written as entry " << entries[index] << endreq;
+            return StatusCode::FAILURE;
+        }
+        slotBranch->GetEntry(entries[index]);
+        if ((long long)slotBranch->GetLeaf("slot")->GetValue(0) != index % m_slots) {
+            log << MSG::ERROR << "Input entry " << index << " was not stored by slot " << index % m_slots << endreq;
+            return StatusCode::FAILURE;
+        }
+    }
+    log << MSG::INFO << "The " << m_events << " input entries read by " << m_slots
+        << " slots were each written once" << endreq;
+    return StatusCode::SUCCESS;
+}
+
+StatusCode concurrentTupleAlg::finalize()
+{
+    MsgStream log(msgSvc(), name());
+    return m_input ? checkInput(log) : compare(log);
+}
@@ -0,0 +1,125 @@
+/** @file readJunkAlg.cxx
+    @brief test of the reading of an input tuple by RootTupleSvc
+
+    $Header$
+*/
+
+#include "GaudiKernel/MsgStream.h"
+#include "GaudiKernel/AlgFactory.h"
+#include "GaudiKernel/Algorithm.h"
+#include "GaudiKernel/StatusCode.h"
+
+#include "ntupleWriterSvc/INTupleWriterSvc.h"
+
+/**
+ * @class readJunkAlg
+ * @brief test algorithm for the input side of the ntupleWriterSvc
+ *
+ * Reads tree_1 of the file written by writeJunkAlg (src/test/jobOptions.txt), through
+ * an InputCut on count. That file has zone maps of 5 rows: the zones that cannot pass
+ * must be skipped without running an event, and the run must stop after the last entry.
+ * Each event checks that count passes the cut, finalize that exactly the entries of
+ * the zones that may pass were read.
+ *
+ * initialize also looks up input entries by the item int, which is delta encoded:
+ * the index must hold the values, not the stored differences. The first entry with
+ * the key is found: readOptions.txt reads the file twice, the second time from the
+ * copy of the PrefetchDirectory.
+ *
+ * Run with src/test/readOptions.txt, after src/test/jobOptions.txt.
+ */
+class readJunkAlg : public Algorithm {
+
+public:
+    readJunkAlg(const std::string& name, ISvcLocator* pSvcLocator);
+
+    StatusCode initialize();
+    StatusCode execute();
+    StatusCode finalize();
+
+private:
+    double m_minCount;  ///< the cut: count > minCount
+    int m_expected;     ///< events the cut leaves
+    int m_events;
+    int m_failures;
+    double m_seen;      ///< an output item, which makes tree_1 a copy of the input one
+    const double* m_count;
+    INTupleWriterSvc* m_rootTupleSvc;
+};
+
+DECLARE_ALGORITHM_FACTORY(readJunkAlg);
+
+readJunkAlg::readJunkAlg(const std::string& name, ISvcLocator* pSvcLocator)
+: Algorithm(name, pSvcLocator), m_events(0), m_failures(0), m_seen(0), m_count(0), m_rootTupleSvc(0)
+{
+    declareProperty("minCount", m_minCount=16); // must match RootTupleSvc.InputCut
+    declareProperty("expected", m_expected=4);
+}
+
+StatusCode readJunkAlg::initialize()
+{
+    MsgStream log(msgSvc(), name());
+    setProperties();
+
+    StatusCode sc = service("RootTupleSvc", m_rootTupleSvc);
+    if( sc.isFailure() ) {
+        log << MSG::ERROR << "readJunkAlg failed to get the RootTupleSvc" << endreq;
+        return sc;
+    }
+    if( m_rootTupleSvc->addItem("tree_1", "seen", &m_seen).isFailure() ) {
+        log << MSG::ERROR << "Could not add an item to tree_1" << endreq;
+        return StatusCode::FAILURE;
+    }
+    void* ptr = 0;
+    if( m_rootTupleSvc->getItem("tree_1", "count", ptr) != "Double_t" ) {
+        log << MSG::ERROR << "No input item count in tree_1" << endreq;
+        return StatusCode::FAILURE;
+    }
+    m_count = reinterpret_cast<const double*>(ptr);
+
+    // int is count: 18 is at entry 16, after the rejected row of count 5
+    if( m_rootTupleSvc->declareKey("tree_1", std::vector<std::string>(1, "int")).isFailure() ) {
+        log << MSG::ERROR << "Could not index the input by int" << endreq;
+        return StatusCode::FAILURE;
+    }
+    int key = 18;
+    long long entry = m_rootTupleSvc->findEntry("tree_1", std::vector<const void*>(1, &key), false);
+    if( entry != 16 ) {
+        log << MSG::ERROR << "findEntry for int=18 returned " << entry << ", expected 16" << endreq;
+        sc = StatusCode::FAILURE;
+    }
+    key = 5;
+    entry = m_rootTupleSvc->findEntry("tree_1", std::vector<const void*>(1, &key), false);
+    if( entry != -1 ) {
+        log << MSG::ERROR << "findEntry found the rejected row int=5, at " << entry << endreq;
+        sc = StatusCode::FAILURE;
+    }
+    return sc;
+}
+
+StatusCode readJunkAlg::execute()
+{
+    MsgStream log(msgSvc(), name());
+    ++m_events;
+    // an entry of a skipped zone, or the one before the end read again
+    if( !(*m_count > m_minCount) ) {
+        log << MSG::ERROR << "Event " << m_events << " has count " << *m_count
+            << ", which does not pass the input cut" << endreq;
+        ++m_failures;
+    }
+    m_seen = *m_count;
+    return StatusCode::SUCCESS;
+}
+
+StatusCode readJunkAlg::finalize()
+{
+    MsgStream log(msgSvc(), name());
+    if( m_events != m_expected ) {
+        log << MSG::ERROR << m_events << " events run, expected " << m_expected
+            << ": the zones of tree_1 were not pruned as expected" << endreq;
+        return StatusCode::FAILURE;
+    }
+    if( m_failures > 0 ) return StatusCode::FAILURE;
+    log << MSG::INFO << m_events << " entries read, all passing the cut" << endreq;
+    return StatusCode::SUCCESS;
+}
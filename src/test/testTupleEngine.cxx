@@ -0,0 +1,110 @@
+/** @file testTupleEngine.cxx
+    @brief test of TupleEngine without Gaudi: writing trees, then reading them back as input
+
+    usage: test_tupleEngine, in a directory it can write to; returns 0 if every check passes
+
+    $Header$
+*/
+#include "engine/TupleEngine.h"
+
+#include "TFile.h"
+#include "TROOT.h"
+#include "TTree.h"
+#include "RVersion.h"
+
+#include <iostream>
+#include <limits>
+#include <string>
+
+namespace {
+    int failures = 0;
+
+    void check(bool ok, const std::string& what) {
+        if (ok) return;
+        std::cerr << "test_tupleEngine: " << what << std::endl;
+        ++failures;
+    }
+
+    /// rows of a tree of a file, -1 if it is not there
+    long long entries(const std::string& fileName, const std::string& treeName) {
+        TFile f(fileName.c_str(), "READ");
+        TTree* t = f.IsOpen() ? static_cast<TTree*>(f.Get(treeName.c_str())) : 0;
+        return t != 0 ? t->GetEntries() : -1;
+    }
+}
+
+int main()
+{
+    const int events = 10;
+    StreamTupleLog log(TupleLog::Warning);
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6,0,0)
+    // before any file is opened, for the parallel close
+    ROOT::EnableThreadSafety();
+#endif
+
+    // two trees in one file, one in another and one in memory; the row with a non-finite value is rejected
+    {
+        TupleEngineOptions options;
+        options.fileName = "engineTest.root";
+        TupleEngine engine(options, &log);
+        int a = 0, b = 0, kept = 0, runA = 0, runB = 0;
+        float x = 0;
+        check(engine.addItem("a", "a", "/I", &a) && engine.addItem("b", "b", "/I", &b)
+              && engine.addItem("finite", "x", "/F", &x, "engineFinite.root"), "cannot add the items");
+        // an item of the same name in two trees, with other values
+        check(engine.addItem("a", "run", "/I", &runA) && engine.addItem("b", "run", "/I", &runB),
+              "cannot add the items of the same name");
+        check(engine.addItem("memory", "kept", "/I", &kept, "", false), "cannot add a memory item");
+        for (int i = 0; i<events; ++i) {
+            check(engine.beginEvent(), "beginEvent failed without an input");
+            a = b = kept = runA = i;
+            runB = 100+i;
+            x = i == 3 ? std::numeric_limits<float>::infinity() : float(i);
+            engine.storeAll(true);
+            engine.endEvent();
+        }
+        check(engine.badRows() == 1, "the non-finite row was not counted");
+        check(engine.trees()["memory"]->GetEntries() == events, "the memory tree did not get every row");
+        // in parallel: the memory tree is deleted first, the trees of the files with them
+        engine.close(true);
+    }
+    check(entries("engineTest.root", "a") == events && entries("engineTest.root", "b") == events,
+          "trees a and b do not have every row");
+    check(entries("engineFinite.root", "finite") == events-1, "tree finite does not have the rows with finite values");
+
+    // both trees as input: every chain must be at the same entry at each event, and each item of
+    // the same name in both must have a buffer of its own
+    {
+        TupleEngineOptions options;
+        options.fileName = "engineCopy.root";
+        options.inputFiles.push_back("engineTest.root");
+        TupleEngine engine(options, &log);
+        int c = 0, d = 0;
+        check(engine.addItem("a", "c", "/I", &c) && engine.addItem("b", "d", "/I", &d),
+              "cannot add items to the copies of the input trees");
+        int read = 0;
+        while (engine.beginEvent()) {
+            const int* a = static_cast<const int*>(engine.itemPool()["a"]["a"]);
+            const int* b = static_cast<const int*>(engine.itemPool()["b"]["b"]);
+            const int* runA = static_cast<const int*>(engine.itemPool()["a"]["run"]);
+            const int* runB = static_cast<const int*>(engine.itemPool()["b"]["run"]);
+            check(a != 0 && *a == read, "input tree a is not at the entry of the event");
+            check(b != 0 && *b == read, "input tree b is not at the same entry as a");
+            check(runA != 0 && runB != 0 && runA != runB, "item run of trees a and b does not have two buffers");
+            check(runA != 0 && *runA == read, "item run of input tree a does not have its value");
+            check(runB != 0 && *runB == 100+read, "item run of input tree b does not have its value");
+            c = d = read;
+            engine.storeRow("a", true);
+            engine.endEvent();
+            ++read;
+        }
+        check(read == events, "the input did not end after its last entry");
+        engine.close();
+    }
+    check(entries("engineCopy.root", "a") == events, "the copy of tree a does not have every input row");
+    check(entries("engineCopy.root", "b") == 0, "the copy of tree b has rows it was not asked to store");
+
+    if (failures > 0) return 1;
+    std::cout << "test_tupleEngine: all checks passed" << std::endl;
+    return 0;
+}
@@ -7,12 +7,15 @@
 #include "GaudiKernel/SmartDataPtr.h"
 #include "GaudiKernel/Algorithm.h"
 #include "TTree.h"
+#include "TLeaf.h"
+#include "TFile.h"
 
 
 #include "GaudiKernel/SmartDataPtr.h"
 #include "GaudiKernel/StatusCode.h"
 
 #include "ntupleWriterSvc/INTupleWriterSvc.h"
+#include "ntupleWriterSvc/ItemRef.h"
 #include <cmath>
 
 /**
@@ -21,7 +24,8 @@
  *
  * This algorithm tests the creation and writing of ntuples via
  * the ntupleWriterSvc.  The output from this routine is a
- * ROOT ntuple, containing 19 entries.
+ * ROOT ntuple, containing 19 entries; tree_2 and t2 are reduced by
+ * the Prescale and TreeFilters of src/test/jobOptions.txt.
  */
 
 class writeJunkAlg : public Algorithm {
@@ -55,6 +59,12 @@ private:
 
     char  m_name[10];
 
+    // items for the batch fill test
+    float  m_bulkFloat;
+    double m_bulkArray[2];
+
+    ItemRef<float> m_floatRef;
+
 };
 
 //static const AlgFactory<writeJunkAlg>  Factory;
@@ -108,6 +118,12 @@ StatusCode writeJunkAlg::initialize() {
     // test creation of memory resident tuple
     m_rootTupleSvc->addItem("memoryTree","memoryFloat",&m_memoryFloat, "", false);
     m_rootTupleSvc->addItem("memoryTree","memoryInt",&m_memoryInt,"",false);
+    // rows of the memory resident tuple are found by the value of memoryFloat
+    m_rootTupleSvc->declareKey("memoryTree", std::vector<std::string>(1, "memoryFloat"));
+
+    // tree filled only in batches, from finalize
+    m_rootTupleSvc->addItem("bulkTree","bulkFloat", &m_bulkFloat);
+    m_rootTupleSvc->addItem("bulkTree","bulkArray[2]", m_bulkArray);
 
     // check that we can find a previous item
 
@@ -121,6 +137,20 @@ StatusCode writeJunkAlg::initialize() {
         log << MSG::INFO << "Found previous entry OK" << endreq;
     }
 
+    // the same through a typed reference, which must refuse the wrong type
+    m_floatRef.bind(m_rootTupleSvc, "tree_1", "float");
+    if( m_floatRef.get()!=&m_float ){
+        log << MSG::ERROR << "ItemRef did not find the float" << endreq;
+        sc = StatusCode::FAILURE;
+    }
+    try {
+        ItemRef<int> wrongType(m_rootTupleSvc, "tree_1", "float");
+        log << MSG::ERROR << "ItemRef accepted a float as an int" << endreq;
+        sc = StatusCode::FAILURE;
+    } catch(const std::invalid_argument&) {
+        log << MSG::INFO << "ItemRef type check OK" << endreq;
+    }
+
     return sc;
 }
 
@@ -168,6 +198,9 @@ StatusCode writeJunkAlg::execute() {
     // Test the ability to turn off a row
     m_rootTupleSvc->storeRowFlag("tree_1",true) ; //callCount == 5);
     m_rootTupleSvc->storeRowFlag("memoryTree",true);
+    // every row offered: the Prescale and TreeFilters of the jobOptions decide
+    m_rootTupleSvc->storeRowFlag("tree_2",true);
+    m_rootTupleSvc->storeRowFlag("t2",true);
     ++callCount;
 
 
@@ -180,7 +213,81 @@ StatusCode writeJunkAlg::finalize() {
     
     MsgStream log(msgSvc(), name());
     log << MSG::INFO << "finalize writeJunkAlg " << endreq;
+
+    // test filling rows from columns: the third row has a non-finite value, and is rejected
+    const int nRows = 4;
+    float  floats[nRows]   = { 1, 2, 0, 4 };
+    double arrays[2*nRows] = { 1, 10, 2, 20, 3, 30, 4, 40 };
+    floats[2] = floats[2]/0.0f;
+    std::vector<std::string> items;
+    items.push_back("bulkArray[2]");
+    items.push_back("bulkFloat");
+    std::vector<const void*> columns;
+    columns.push_back(arrays);
+    columns.push_back(floats);
+    long long written = m_rootTupleSvc->fillRows("bulkTree", nRows, items, columns);
+    if( written!=nRows-1 ){
+        log << MSG::ERROR << "fillRows wrote " << written << " rows, expected " << nRows-1 << endreq;
+        sc = StatusCode::FAILURE;
+    }
+    // a negative row count, or a column missing for one of the names, is refused
+    if( m_rootTupleSvc->fillRows("bulkTree", -1, items, columns)!=-1 ){
+        log << MSG::ERROR << "fillRows accepted a negative number of rows" << endreq;
+        sc = StatusCode::FAILURE;
+    }
+    columns.pop_back();
+    if( m_rootTupleSvc->fillRows("bulkTree", nRows, items, columns)!=-1 ){
+        log << MSG::ERROR << "fillRows accepted fewer columns than item names" << endreq;
+        sc = StatusCode::FAILURE;
+    }
+
+    // look up the third row of the memory resident tuple by its key, memoryFloat=3
+    float key = 3;
+    long long entry = m_rootTupleSvc->findEntry("memoryTree", std::vector<const void*>(1, &key));
+    if( entry!=2 || m_memoryFloat!=key ){
+        log << MSG::ERROR << "findEntry returned entry " << entry << ", memoryFloat " << m_memoryFloat << endreq;
+        sc = StatusCode::FAILURE;
+    }
+
+    // name is dictionary encoded (jobOptions): its branch holds the codes
+    void* tree1 = 0;
+    m_rootTupleSvc->getOutputTreePtr(tree1, "tree_1");
+    TLeaf* nameLeaf = tree1==0 ? 0 : reinterpret_cast<TTree*>(tree1)->GetLeaf("name");
+    if( nameLeaf==0 || std::string(nameLeaf->GetTypeName())!="Int_t" ){
+        log << MSG::ERROR << "item name of tree_1 is not dictionary encoded" << endreq;
+        sc = StatusCode::FAILURE;
+    }
+
+    // int is delta encoded (jobOptions): the second row holds 2-1, zigzag encoded as 2
+    TBranch* intBranch = tree1==0 ? 0 : reinterpret_cast<TTree*>(tree1)->GetBranch("int");
+    if( intBranch==0 || intBranch->GetEntry(1)<=0 || intBranch->GetLeaf("int")->GetValue(0)!=2 ){
+        log << MSG::ERROR << "item int of tree_1 is not delta encoded" << endreq;
+        sc = StatusCode::FAILURE;
+    }
+
+    // test.root is staged (jobOptions): written elsewhere, moved to its name when the service ends
+    TFile* file1 = tree1==0 ? 0 : reinterpret_cast<TTree*>(tree1)->GetCurrentFile();
+    if( file1==0 || std::string(file1->GetName())=="test.root" ){
+        log << MSG::ERROR << "test.root is not staged" << endreq;
+        sc = StatusCode::FAILURE;
+    }
+
+    // tree_2 is prescaled by 3 (jobOptions): of the 20 rows, the first and every third
+    void* tree2 = 0;
+    long long rows = m_rootTupleSvc->getOutputTreePtr(tree2, "tree_2");
+    if( rows!=7 ){
+        log << MSG::ERROR << "tree_2 has " << rows << " rows, expected 7 with a prescale of 3" << endreq;
+        sc = StatusCode::FAILURE;
+    }
+
+    // t2 is filtered on float2 > 15 (jobOptions): the last 5 rows
+    void* t2 = 0;
+    rows = m_rootTupleSvc->getOutputTreePtr(t2, "t2");
+    if( rows!=5 ){
+        log << MSG::ERROR << "t2 has " << rows << " rows, expected 5 passing its filter" << endreq;
+        sc = StatusCode::FAILURE;
+    }
  
-    return StatusCode::SUCCESS;
+    return sc;
 }
 